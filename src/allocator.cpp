@@ -2,12 +2,20 @@
 #include "prelude.hpp"
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <iostream>
 #include <iomanip>
 #include <vector>
 #include <cstring>
 #include <cstdlib>
 #include <cassert>
+#include <unordered_map>
+#include <utility>
+
+#ifdef LILITH_COMPRESSED_REFS
+#include <sys/mman.h>
+#endif
 
 #ifdef DEBUG
 #define DEBUG_SHOW 1
@@ -16,7 +24,7 @@
 #endif
 #define DEBUGMSG if(DEBUG_SHOW)
 
-// value.cppの中で、Valueの下2bitに情報をつめこんでいるので、allocの返り値は最低でも4byte alignmentはないと壊れる。
+// value.cppの中で、Valueの下2bit(Objectは下3bit)に情報をつめこんでいるので、allocの返り値は最低でも8byte alignmentはないと壊れる。
 
 enum class AllocatorStrategy {
   NOP,
@@ -52,7 +60,7 @@ unsigned char get(void* base, size_t offset = 0) {
 void* PreAlloc_pointer_slice_alloc(size_t size) {
   // おもらしするポインタずらし。
   size_t const block_size = 1024 * 32 * 1024;
-  size_t const alignment_size = 4;
+  size_t const alignment_size = 8; // Objectの下3bitを使うので8
   static void* current_block = nullptr;
   static size_t current_offset = block_size;
 
@@ -192,143 +200,420 @@ public:
 } markSweepAllocator;
 */
 
-// indexでアクセスできるメモリ
-template<class T, size_t PerPage = 256> class PandoraBox {
-  std::vector<T*> pages;
+#ifdef LILITH_COMPRESSED_REFS
+std::uintptr_t cons_heap_base;
+std::vector<Value> boxed_values; // 空いている所はnil(nilは箱に入らない)
+namespace {
+std::unordered_map<Value, Slot> box_of;
+std::vector<Slot> free_boxes;
+} // namespace
+
+Slot box(Value v) {
+  auto const it = box_of.find(v);
+  if(it != end(box_of)) return it->second;
+  std::size_t i;
+  if(free_boxes.empty()) {
+    i = boxed_values.size();
+    if(i >= (std::size_t{1} << 30)) throw std::bad_alloc();
+    boxed_values.push_back(v);
+  } else {
+    i = free_boxes.back() >> 2;
+    free_boxes.pop_back();
+    boxed_values[i] = v;
+  }
+  Slot const s = static_cast<Slot>(i << 2 | 2);
+  box_of.emplace(v, s);
+  return s;
+}
+#endif
+
+// consのslotを通し番号(index)でアクセスできるメモリ。ページの中身はallocator.hppのcons_page_*を参照。
+// LILITH_COMPRESSED_REFSなら、ページは予約しておいた4GiBの領域から順に切り出す(slotのoffsetが32bitに収まるように)。
+class ConsPages {
+  std::vector<std::uint8_t*> pages;
+#ifdef LILITH_COMPRESSED_REFS
+  static constexpr size_t reserved_bytes = size_t{1} << 32;
+  static std::uint8_t* reserve_region() {
+    void* p = mmap(nullptr, reserved_bytes + cons_page_bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(p == MAP_FAILED) throw std::bad_alloc();
+    auto const addr = roundup(reinterpret_cast<std::uintptr_t>(p), cons_page_bytes);
+    cons_heap_base = addr;
+    return reinterpret_cast<std::uint8_t*>(addr);
+  }
+  std::uint8_t* new_page() {
+    static std::uint8_t* const base = reserve_region();
+    if((pages.size() + 1) * cons_page_bytes > reserved_bytes) throw std::bad_alloc();
+    std::uint8_t* p = base + pages.size() * cons_page_bytes;
+    if(mprotect(p, cons_page_bytes, PROT_READ | PROT_WRITE) != 0) throw std::bad_alloc();
+    return p;
+  }
+#else
+  std::uint8_t* new_page() {
+    return static_cast<std::uint8_t*>(std::aligned_alloc(cons_page_bytes, cons_page_bytes));
+  }
+#endif
 public:
-  PandoraBox() : pages{} {}
-  T& operator[](size_t i) {
-    assert(i < pages.size() * PerPage);
-    return *(pages[i / PerPage] + i % PerPage);
-  }
-  // O(n)かかってヤバそうなら考えましょう。
-  // pageの増減時にしか変わらないのでなんとかできそう。
-  size_t addr2page(T const* t) {
-    for(size_t i{}; i < pages.size(); ++i) {
-      if (pages[i] <= t && t < pages[i] + PerPage) return i; // ここの比較本当はアドレスでやるとダメなので整数型にしないといけない気はするけど実際動かないことはなさそう。
-    }
-    [[unlikely]] throw "never";
+  static constexpr size_t PerPage = cons_page_slots;
+  ConsPages() : pages{} {}
+#ifndef LILITH_COMPRESSED_REFS
+  static std::uint8_t* new_free_page() {
+    auto p = static_cast<std::uint8_t*>(std::aligned_alloc(cons_page_bytes, cons_page_bytes));
+    if(!p) throw std::bad_alloc();
+    return p;
+  }
+#endif
+  Slot* slot(size_t i) {
+    assert(i < capacity());
+    return reinterpret_cast<Slot*>(pages[i / PerPage] + cons_page_header) + i % PerPage;
   }
-  size_t get_index(T const* t) {
-    size_t page = addr2page(t);
-    size_t offset = t - pages[page];
-    assert(offset <= PerPage);
-    return page * PerPage + offset;
+  // ページの先頭に書いておいた番号を使うので探さなくてよい。
+  size_t get_index(Slot const* p) {
+    auto const addr = reinterpret_cast<std::uintptr_t>(p);
+    auto const page = reinterpret_cast<std::uint64_t const*>(addr & ~std::uintptr_t{cons_page_bytes - 1});
+    size_t const offset = (addr & (cons_page_bytes - 1)) - cons_page_header;
+    return *page * PerPage + offset / sizeof(Slot);
   }
   void alloc_page() {
-    T* p = static_cast<T*>(std::malloc(sizeof(T) * PerPage));
+    auto p = new_page();
     if(!p) throw std::bad_alloc();
+    *reinterpret_cast<std::uint64_t*>(p) = pages.size();
     pages.push_back(p);
   }
-  void release_page() {
-    std::free(pages.back());
-    pages.pop_back();
+  // 他で確保したページをat番目のページの前に挟む。後ろのページの番号は付け直す。
+  void insert_pages(size_t at, std::vector<std::uint8_t*> const& added) {
+    pages.insert(pages.begin() + at, begin(added), end(added));
+    for(size_t i = at; i < pages.size(); ++i) *reinterpret_cast<std::uint64_t*>(pages[i]) = i;
   }
-  size_t capacity() { return pages.size() * PerPage; }
+  size_t capacity() const { return pages.size() * PerPage; }
 };
 
+struct Region {
+  std::vector<std::uint8_t*> pages;
+  size_t offset; // 最後のページの中で次に使うslot
+  std::vector<Object*> objects;
+  std::uint64_t conses;
+  std::uint64_t object_bytes;
+
+  void next_page() {
+#ifdef LILITH_COMPRESSED_REFS
+    throw "regions are not supported with compressed refs";
+#else
+    pages.push_back(ConsPages::new_free_page());
+    offset = 0;
+#endif
+  }
+  Slot* take(size_t n) {
+    Slot* p = reinterpret_cast<Slot*>(pages.back() + cons_page_header) + offset;
+    offset += n;
+    conses += n;
+    return p;
+  }
+  Slot* alloc_cons() {
+    if(pages.empty() || offset + 2 > ConsPages::PerPage) next_page();
+    return take(2);
+  }
+  Slot* alloc_run(size_t& n) {
+    if(pages.empty() || offset + 2 > ConsPages::PerPage) next_page();
+    n = std::min(n, ConsPages::PerPage - offset);
+    return take(n);
+  }
+  Object* alloc_object(size_t size) {
+    auto obj = static_cast<Object*>(std::malloc(size));
+    if(!obj) throw std::bad_alloc();
+    objects.push_back(obj);
+    object_bytes += size;
+    return obj;
+  }
+};
+
+namespace {
+thread_local Region* current_region = nullptr;
+} // namespace
+
+std::array<void (*)(Object*), 16> finalizers{};
+
+void set_finalizer(ObjectKind kind, void (*finalize)(Object*)) {
+  finalizers.at(static_cast<std::size_t>(kind)) = finalize;
+}
+
+std::vector<std::function<void()>>& before_collect_hooks() {
+  static std::vector<std::function<void()>> hooks;
+  return hooks;
+}
+
+void add_before_collect(std::function<void()> hook) {
+  before_collect_hooks().push_back(std::move(hook));
+}
+
+std::vector<std::function<void(RootVisitor const&)>>& root_scanners() {
+  static std::vector<std::function<void(RootVisitor const&)>> scanners;
+  return scanners;
+}
+
+void add_roots(std::function<void(RootVisitor const&)> scan) {
+  root_scanners().push_back(std::move(scan));
+}
+
+std::vector<std::function<void(WeakVisitor const&)>>& weak_scanners() {
+  static std::vector<std::function<void(WeakVisitor const&)>> scanners;
+  return scanners;
+}
+
+void add_weak_roots(std::function<void(WeakVisitor const&)> scan) {
+  weak_scanners().push_back(std::move(scan));
+}
+
+std::vector<std::function<void(EphemeronVisitor const&)>>& ephemeron_scanners() {
+  static std::vector<std::function<void(EphemeronVisitor const&)>> scanners;
+  return scanners;
+}
+
+void add_ephemerons(std::function<void(EphemeronVisitor const&)> scan) {
+  ephemeron_scanners().push_back(std::move(scan));
+}
+
 class MoveCompactAllocator {
   std::vector<bool> bitmap;
-  size_t static constexpr PerPage = 2;
-  PandoraBox<ConsCell, PerPage> heap;
+  static constexpr size_t PerPage = ConsPages::PerPage;
+  ConsPages heap;
   size_t offset;
+  std::vector<std::uint32_t> forwarding; // compactの間だけ使う、slotの引越し先のindex
+  size_t live_cells;
+  std::vector<Object*> objects; // consのページの外に確保したもの。動かさずにmark sweepする。
+#ifdef LILITH_COMPRESSED_REFS
+  std::vector<bool> box_marks;
+#endif
+
+  // offsetから同じページにn slot無ければ、残りをnilで埋めて次のページへ。
+  void reserve(size_t n) {
+    if(offset % PerPage + n > PerPage) {
+      for(; offset % PerPage != 0; ++offset) *heap.slot(offset) = compress(nil());
+    }
+    if(offset >= heap.capacity()) heap.alloc_page();
+  }
 public:
-  MoveCompactAllocator() : bitmap{}, heap{}, offset{} {}
-  ConsCell* alloc_cons() {
-    if (offset >= heap.capacity()) heap.alloc_page();
-    auto addr = &heap[offset];
-    ++offset;
+  MoveCompactAllocator() : bitmap{}, heap{}, offset{}, forwarding{}, live_cells{}, objects{} {}
+  Slot* alloc_cons() {
+    reserve(2);
+    auto addr = heap.slot(offset);
+    offset += 2;
     return addr;
   }
-  void mark_cons(Value v) {
-    DEBUGMSG std::cout << "marking: " << show(v) << " addr: " << to_ptr(v) << std::endl;
-    if(!is_cons(v)) {
-      DEBUGMSG std::cout << "not cons skip! " << std::endl;
-      return;
+  Slot* alloc_run(size_t& n) {
+    if(PerPage - offset % PerPage < 2) reserve(PerPage);
+    if(offset >= heap.capacity()) heap.alloc_page();
+    n = std::min(n, PerPage - offset % PerPage);
+    auto addr = heap.slot(offset);
+    offset += n;
+    return addr;
+  }
+  Object* alloc_object(size_t size) {
+    auto obj = static_cast<Object*>(std::malloc(size));
+    if(!obj) throw std::bad_alloc();
+    objects.push_back(obj);
+    return obj;
+  }
+  // 今のページの残りは使わずに、その次にRegionのページを挟む。使っていない所はmarkされないのでcompactが飛ばす。
+  void adopt(Region& region) {
+    if(!region.pages.empty()) {
+      size_t const at = (offset + PerPage - 1) / PerPage;
+      heap.insert_pages(at, region.pages);
+      offset = (at + region.pages.size() - 1) * PerPage + region.offset;
     }
-    ConsCell* vp = to_ptr(v);
-    auto base = heap.get_index(vp);
-    if (bitmap[base]) {
-      DEBUGMSG std::cout << "already marked!" << std::endl;
-      return;
+    objects.insert(end(objects), begin(region.objects), end(region.objects));
+  }
+  void mark_object(Object* obj) {
+    if (obj->marked) return;
+    obj->marked = true;
+    Value* fields = object_fields(obj);
+    for(std::uint32_t i{}; i < obj->fields; ++i) {
+      mark_cons(fields[i]);
     }
-    bitmap[base] = true;
+  }
+  void mark_cons(Value v) {
+    // cdr方向はループで辿る。長いlistでstackを使い切らないように。
+    while(true) {
+      DEBUGMSG std::cout << "marking: " << show(v) << " addr: " << to_ptr(v) << std::endl;
+      if(is_object(v)) {
+        mark_object(to_object(v));
+        return;
+      }
+      if(!is_cons(v)) {
+        DEBUGMSG std::cout << "not cons skip! " << std::endl;
+        return;
+      }
+      if(is_immortal(v)) return;
+      auto base = heap.get_index(to_ptr(v));
+      if (bitmap[base]) {
+        DEBUGMSG std::cout << "already marked!" << std::endl;
+        return;
+      }
+      bitmap[base] = true;
+      mark_box(to_ptr(v)[0]);
+      if(cdr_code(v) == CdrCode::Normal) {
+        bitmap[base + 1] = true;
+        mark_box(to_ptr(v)[1]);
+      }
 
-    mark_cons(car(v));
-    mark_cons(cdr(v));
+      mark_cons(car(v));
+      v = cdr(v); // Nextなら隣のslot、Splitなら表の中身
+    }
+  }
+  // markの途中で、もう印が付いているか。consとobject以外は常に生きている。
+  bool marked(Value v) {
+    if(is_object(v)) return to_object(v)->marked;
+    if(!is_cons(v) || is_immortal(v)) return true;
+    return bitmap[heap.get_index(to_ptr(v))];
   }
-  Value compact(Value root) {
-    size_t free = 0;
-    size_t scan = heap.capacity() - 1;
-    while(free != scan) {
-      if (free > scan) break; // このへんも境界怪しい。
-      while(bitmap[free]) ++free;
-      while(!bitmap[scan]) --scan;
-      // https://gyazo.com/d778d19b52397d0a7930a01ebba11695
-      auto to = &heap[free];
-      auto from = &heap[scan];
-      std::cout << "to: " << to << " from: " << from << " free: " << std::dec << free << " scan: " << scan << std::endl;
-   //   DEBUGMSG std::cout << "to content is " << show(to_Value(to, nullptr)) << std::endl;
-//      DEBUGMSG std::cout << "from content is " << show(to_Value(static_cast<void*>(to), nullptr)) << "(is nil?: " << (nil() == from->cell[0]) << ")" << std::endl;
-      to->cell[0] = from->cell[0];
-      to->cell[1] = from->cell[1];
-      *reinterpret_cast<ConsCell**>(from) = to;
-      // 引っ越し先のアドレスを元の住所に書いておく。1cellで2Value分の領域があり、Valueはstd::uintptr_tなので必ず収まる。
-      // scanより後ろで、bitが立っているところは引越しした。
-      ++free;
-      --scan;
+  // keyが全部markされているephemeronのvalueをmarkする。valueから辿ってkeyが生き返ることもあるので、増えなくなるまで。
+  void mark_ephemerons() {
+    bool grew = true;
+    while(grew) {
+      grew = false;
+      for(auto& scan: ephemeron_scanners()) scan([&](Value const* keys, std::size_t n, Value value) {
+        if(marked(value) || !std::all_of(keys, keys + n, [&](Value k) { return marked(k); })) return;
+        mark_cons(value);
+        grew = true;
+      });
     }
-    std::cout << "scan is " << std::dec << scan << std::endl;
-
-    for(size_t i{}; i < scan; ++i) {
-      auto e = &heap[i];
-      for(size_t j{}; j < 2; ++j) {
-        auto v = e->cell[j];
-        if (!is_cons(v)) continue;
-        ConsCell* vp = to_ptr(v);
-        auto base = heap.get_index(vp);
-        if (base > scan) { // 境界？
-          // これread/writeバリアでやったほうがいいかもしれない。
-          e->cell[j] = to_Value(*(reinterpret_cast<ConsCell**>(&heap[base])), nullptr);
+  }
+  // 生きているslotを順番を変えずに前に詰める(sliding)。cdr-codeで繋がったslotは離れないように、
+  // 同じページに収まらなければ次のページの先頭に置く。詰め終わった境界を返す。
+  size_t compact() {
+    forwarding.assign(offset, 0);
+    live_cells = 0;
+    size_t to = 0;
+    size_t i = 0;
+    while(i < offset) {
+      if(!bitmap[i]) {
+        ++i;
+        continue;
+      }
+      // 一緒に動かすslotの塊。Nextが続いて、Normal(とそのcdr)かNilかSplitで終わる。
+      size_t end = i;
+      while(true) {
+        CdrCode const code = cdr_code(to_Value(heap.slot(end), nullptr));
+        ++live_cells;
+        if(code == CdrCode::Normal) {
+          end += 2;
+          break;
+        }
+        ++end;
+        if(code != CdrCode::Next) break;
+      }
+      assert(std::all_of(bitmap.begin() + i, bitmap.begin() + end, [](bool b) { return b; }));
+      size_t const n = end - i;
+      if(to % PerPage + n > PerPage) {
+        for(; to % PerPage != 0; ++to) {
+          *heap.slot(to) = compress(nil());
+          set_cdr_code(to_Value(heap.slot(to), nullptr), CdrCode::Nil);
         }
       }
+      DEBUGMSG std::cout << "move " << std::dec << n << " slots from " << i << " to " << to << std::endl;
+      for(; i < end; ++i, ++to) {
+        forwarding[i] = static_cast<std::uint32_t>(to);
+        if(i == to) continue;
+        Value const from = to_Value(heap.slot(i), nullptr);
+        *heap.slot(to) = *heap.slot(i);
+        set_cdr_code(to_Value(heap.slot(to), nullptr), cdr_code(from));
+      }
     }
-
-    // rootも引越ししてるかもしれないので、新たなrootを返す。
-    ConsCell* vp = to_ptr(root);
-    auto base = heap.get_index(vp);
-    if (base > scan) { // 境界？
-      // これread/writeバリアでやったほうがいいかもしれない。
-      return to_Value(*(reinterpret_cast<ConsCell**>(&heap[base])), nullptr);
+    DEBUGMSG std::cout << "compacted to " << std::dec << to << std::endl;
+    return to;
+  }
+  void forward(Value& v) {
+    if (!is_cons(v) || is_immortal(v)) return;
+    v = to_Value(heap.slot(forwarding[heap.get_index(to_ptr(v))]), nullptr);
+  }
+#ifdef LILITH_COMPRESSED_REFS
+  // 縮めたslotの中のconsを書き換える。箱に入っているのはconsではないので見なくてよい。
+  void forward_slot(Slot& s) {
+    if((s & 3) != 0 || s == 0) return;
+    Value v = decompress(s);
+    forward(v);
+    s = compress(v);
+  }
+  void mark_box(Slot s) {
+    if((s & 3) == 2) box_marks[s >> 2] = true;
+  }
+  // slotから使われなくなった箱を空ける。
+  void sweep_boxes() {
+    for(size_t i{}; i < boxed_values.size(); ++i) {
+      if(box_marks[i] || boxed_values[i] == nil()) continue;
+      box_of.erase(boxed_values[i]);
+      boxed_values[i] = nil();
+      free_boxes.push_back(static_cast<Slot>(i << 2 | 2));
     }
-
-    offset = scan + 1;
-    // 以下の1行を入れると何故か動かない。
-    // for(size_t unused_page_cnt = heap.capacity() % PerPage - offset % PerPage; unused_page_cnt > 0; --unused_page_cnt) heap.release_page();
-    return root;
   }
+#else
+  void forward_slot(Slot& s) { forward(s); }
+  void mark_box(Slot) {}
+  void sweep_boxes() {}
+#endif
+  // markの結果(bitmap)は引越しの前のindexのままなので、書き換える前の場所で生死を見る。
+  bool survive(Value& v) {
+    if(is_object(v)) return to_object(v)->marked;
+    if(!is_cons(v) || is_immortal(v)) return true;
+    if(!bitmap[heap.get_index(to_ptr(v))]) return false;
+    forward(v);
+    return true;
+  }
+  void sweep_objects() {
+    auto const dead = std::partition(begin(objects), end(objects), [](Object* obj) { return obj->marked; });
+    std::for_each(dead, end(objects), [](Object* obj) {
+      if(auto const finalize = finalizers[static_cast<std::size_t>(obj->kind)]) finalize(obj);
+      std::free(obj);
+    });
+    objects.erase(dead, end(objects));
+    for(auto obj: objects) obj->marked = false;
+  }
+  size_t live_conses() const { return live_cells; }
+  size_t live_slots() const { return offset; }
+#ifdef LILITH_COMPRESSED_REFS
+  size_t box_bytes() const {
+    return boxed_values.capacity() * sizeof(Value) + box_of.bucket_count() * sizeof(void*)
+      + box_of.size() * (sizeof(std::pair<Value, Slot>) + sizeof(void*) + sizeof(size_t));
+  }
+#else
+  size_t box_bytes() const { return 0; }
+#endif
   void show_bitmap() {
     for(auto e: bitmap) {
       std::cout << (e ? '.' : ' ');
     }
     std::cout << "| kokomade" << std::endl;
-    for(size_t i{}; i < bitmap.size(); ++i) { /*
-      auto base = pages[i / par_page] + i % par_page;
-      auto head = base->cell[0];
-      auto tail = base->cell[1];
-
-      std::cout << "addr index: " << std::dec << i << "(raw: " << base << ") mark: " << bitmap[i] << std::hex << " content: " << show(to_Value(base, nullptr))
-      << " (raw: " << head << ", " << tail << ")" << std::endl; */
-    }
   }
   Value collect(Value root) {
     assert(heap.capacity() > 0); // allocする前にcollectすることなんて無いでしょw
+    assert(heap.capacity() <= UINT32_MAX); // forwardingの大きさ
     bitmap = std::vector<bool>(heap.capacity());
+#ifdef LILITH_COMPRESSED_REFS
+    box_marks = std::vector<bool>(boxed_values.size());
+#endif
     mark_cons(root);
+    for(auto& scan: root_scanners()) scan([this](Value& v) { mark_cons(v); });
+    mark_ephemerons();
     DEBUGMSG std::cout << "marked bit cnt is " << std::count(begin(bitmap), end(bitmap), true) << std::endl;
-    show_bitmap();
-    Value new_root = compact(root);
-   // show_bitmap();
+    DEBUGMSG show_bitmap();
+    size_t const boundary = compact();
+    for(size_t i{}; i < boundary; ++i) {
+      // これread/writeバリアでやったほうがいいかもしれない。
+      forward_slot(*heap.slot(i));
+    }
+    for(auto obj: objects) {
+      if (!obj->marked) continue;
+      Value* fields = object_fields(obj);
+      for(std::uint32_t i{}; i < obj->fields; ++i) forward(fields[i]);
+    }
+    // rootも引越ししてるかもしれないので、新たなrootを返す。
+    Value new_root = root;
+    forward(new_root);
+    for(auto& scan: root_scanners()) scan([this](Value& v) { forward(v); });
+    for(auto& scan: weak_scanners()) scan([this](Value& v) { return survive(v); });
+    offset = boundary;
+    forwarding = {};
+    sweep_boxes();
+    sweep_objects();
     DEBUGMSG std::cout << "!!!!!!" << show_env(new_root) << std::endl;
     DEBUGMSG std::cout << "!!!!!!" << show(new_root) << std::endl;
     DEBUGMSG std::cout << "old root: " << std::hex << root << " new root: " <<  new_root << std::endl;
@@ -336,7 +621,11 @@ public:
   }
 } moveCompactAllocator;
 
-static int alloc_cnt = 0;
+AllocStats stats{};
+
+AllocStats const& alloc_stats() {
+  return stats;
+}
 
 void* alloc(size_t size) {
   switch(strategy) {
@@ -348,28 +637,104 @@ void* alloc(size_t size) {
   }
 }
 
-ConsCell* alloc_cons() {
-  ++alloc_cnt;
-  switch(strategy) { /*
-  case AllocatorStrategy::MarkSweep:
-    return markSweepAllocator.alloc_cons(); */
+Region* new_region() {
+#ifdef LILITH_COMPRESSED_REFS
+  throw "regions are not supported with compressed refs";
+#else
+  return new Region{};
+#endif
+}
+
+Region* use_region(Region* region) {
+  return std::exchange(current_region, region);
+}
+
+void adopt_region(Region* region) {
+  assert(current_region == nullptr);
+  moveCompactAllocator.adopt(*region);
+  stats.conses += region->conses;
+  stats.objects += region->objects.size();
+  stats.object_bytes += region->object_bytes;
+  delete region;
+}
+
+namespace {
+
+// 止めている間は0にならないほど大きくしておいて、確保のたびには引き算と比較だけにする。
+std::int64_t sample_countdown = INT64_MAX;
+std::size_t sample_interval{};
+AllocationSampler sampler{};
+
+void take_sample(Value v, size_t bytes, size_t cells) {
+  auto const interval = static_cast<std::int64_t>(sample_interval);
+  std::int64_t const crossed = -sample_countdown / interval + 1; // 大きな確保はintervalをいくつも跨ぐ
+  sample_countdown += crossed * interval;
+  sampler(v, bytes, cells, static_cast<size_t>(crossed * interval));
+}
+inline void count_bytes(Value v, size_t bytes, size_t cells) {
+  sample_countdown -= static_cast<std::int64_t>(bytes);
+  if(sample_countdown <= 0) [[unlikely]] take_sample(v, bytes, cells);
+}
+
+} // namespace
+
+void set_allocation_sampler(size_t interval, AllocationSampler fn) {
+  sample_interval = fn ? interval : 0;
+  sampler = fn;
+  sample_countdown = sample_interval == 0 ? INT64_MAX : static_cast<std::int64_t>(sample_interval);
+}
+
+Object* alloc_object(size_t size) {
+  if(current_region) [[unlikely]] return current_region->alloc_object(size);
+  ++stats.objects;
+  stats.object_bytes += size;
+  Object* res;
+  switch(strategy) {
   case AllocatorStrategy::MoveCompact:
-    return moveCompactAllocator.alloc_cons();
+    res = moveCompactAllocator.alloc_object(size);
+    break;
   default:
-    size_t const cell_size = sizeof(Value) * 2;
-    return static_cast<ConsCell*>(alloc(cell_size));
+    res = static_cast<Object*>(alloc(size));
+    break;
   }
+  count_bytes(to_Value(res, nullptr), size, 0);
+  return res;
+}
+
+// consはcdr-codeを引くためにページの中に置く必要があるので、どのstrategyでもconsのページから取る(collectしなければおもらし)。
+Slot* alloc_cons() {
+  if(current_region) [[unlikely]] return current_region->alloc_cons();
+  ++stats.conses;
+  Slot* res = moveCompactAllocator.alloc_cons();
+  count_bytes(to_Value(res, nullptr), 2 * sizeof(Slot), 1);
+  return res;
+}
+
+Slot* alloc_run(size_t& n) {
+  if(current_region) [[unlikely]] return current_region->alloc_run(n);
+  Slot* res = moveCompactAllocator.alloc_run(n);
+  stats.conses += n;
+  count_bytes(to_Value(res, nullptr), n * sizeof(Slot), n);
+  return res;
 }
 
 Value collect(Value root) {
-  std::cout << alloc_cnt << " cons total allocations!" << std::endl;
+  for(auto& hook: before_collect_hooks()) hook();
+  auto const start = std::chrono::steady_clock::now();
   switch(strategy) { /*
   case AllocatorStrategy::MarkSweep:
     markSweepAllocator.collect(root);
     return; */
   case AllocatorStrategy::MoveCompact:
-    return moveCompactAllocator.collect(root);
+    root = moveCompactAllocator.collect(root);
+    stats.live_conses = moveCompactAllocator.live_conses();
+    stats.live_cons_bytes = moveCompactAllocator.live_slots() * sizeof(Slot) + moveCompactAllocator.live_slots() / 4
+      + moveCompactAllocator.box_bytes();
+    break;
   default:
-    return root; // nop
+    break; // nop
   }
+  ++stats.collections;
+  stats.gc_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  return root;
 }
@@ -3,7 +3,142 @@
 #include "value.hpp"
 
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
 void* alloc(size_t size);
-ConsCell* alloc_cons();
+Object* alloc_object(size_t size); // 返り値は8byte alignment
+
+// consは専用のページにslot(普通は8byteのValue)を並べて置く。ページはcons_page_bytes境界にそろえて確保する。
+// ページの先頭のcons_page_header byteはslotごとに2bitのcdr-codeの置き場で、そのうち最初の8byteはページの番号。
+// consを指すValueはcarのslotのアドレス。cdrがどこにあるかはcdr-codeで決まる:
+//   Normal  次のslotにcdrが入っている(普通のcons。2slot使う)
+//   Next    次のslotそのものがcdr(cdr-coded。listの要素が1slotずつ並ぶ)
+//   Nil     cdrはnil(cdr-codedなlistの最後)
+//   Split   set_cdrで書き換えられたので、cdrは別の表にある(value.cpp)
+constexpr std::size_t cons_page_bytes = std::size_t{1} << 16;
+constexpr std::size_t cons_page_header = cons_page_bytes / (4 * sizeof(Slot));
+constexpr std::size_t cons_page_slots = (cons_page_bytes - cons_page_header) / sizeof(Slot);
+enum class CdrCode : std::uint8_t {
+  Normal = 0,
+  Next = 1,
+  Nil = 2,
+  Split = 3,
+};
+inline std::uint8_t* cdr_code_byte(Value cons, unsigned& shift) {
+  auto const page = reinterpret_cast<std::uint8_t*>(cons & ~Value{cons_page_bytes - 1});
+  std::size_t const slot = (cons & (cons_page_bytes - 1)) / sizeof(Slot);
+  shift = slot % 4 * 2;
+  return page + slot / 4;
+}
+inline CdrCode cdr_code(Value cons) {
+  unsigned shift;
+  return static_cast<CdrCode>((*cdr_code_byte(cons, shift) >> shift) & 3);
+}
+// ページの番号の代わりにこれが入っているページは、プログラムに埋め込んだ不死の領域(lisp_prelude.cpp)。
+// collectはその中のconsをmarkも引越しもせず、常に生きているものとして扱う。
+constexpr std::uint64_t immortal_page = ~std::uint64_t{};
+inline bool is_immortal(Value cons) {
+  return *reinterpret_cast<std::uint64_t const*>(cons & ~Value{cons_page_bytes - 1}) == immortal_page;
+}
+inline void set_cdr_code(Value cons, CdrCode code) {
+  unsigned shift;
+  std::uint8_t* p = cdr_code_byte(cons, shift);
+  *p = static_cast<std::uint8_t>((*p & ~(3u << shift)) | static_cast<unsigned>(code) << shift);
+}
+
+#ifdef LILITH_COMPRESSED_REFS
+// consのページは起動時に予約した4GiBの領域から取り、slotにはValueを32bitに縮めて入れる。下2bitが
+//   00 領域の先頭からのoffset(0ならnil。先頭はページのheaderなのでconsとは被らない)
+//   01 fixnum。32bitの2の補数に収まるもの(Valueの下位4byteをそのまま)
+//   11 3文字までのshort symbol(Valueの上位4byte)
+//   10 それ以外(長いsymbol、Object、大きなfixnum)。上30bitはboxed_valuesのindex。使われなくなったらcollectで空ける
+extern std::uintptr_t cons_heap_base;
+extern std::vector<Value> boxed_values;
+Slot box(Value v);
+inline Slot compress(Value v) {
+  switch(v & 3) {
+  case 0:
+    return v == 0 ? 0 : static_cast<Slot>(v - cons_heap_base);
+  case 1:
+    if(static_cast<std::int64_t>(v) == static_cast<std::int32_t>(v)) return static_cast<Slot>(v);
+    break;
+  case 3:
+    if((v & 0xFF'FFFF'FFFF) == 3) return static_cast<Slot>(v >> 32) | 3; // 4文字目(byte 4)が空
+    break;
+  }
+  return box(v);
+}
+inline Value decompress(Slot s) {
+  switch(s & 3) {
+  case 0:
+    return s == 0 ? 0 : cons_heap_base + s;
+  case 1:
+    return static_cast<Value>(std::int64_t{static_cast<std::int32_t>(s)});
+  case 3:
+    return Value{s & ~3u} << 32 | 3;
+  case 2:
+  default:
+    return boxed_values[s >> 2];
+  }
+}
+#else
+inline Slot compress(Value v) { return v; }
+inline Value decompress(Slot s) { return s; }
+#endif
+
+Slot* alloc_cons(); // 同じページの2slot
+// 同じページに連続したslotを最大n個。確保できた数(2以上)をnに入れる。
+Slot* alloc_run(std::size_t& n);
+
+// 別threadで評価している間のallocation先(future.cpp)。use_regionしたthreadのalloc_cons/alloc_run/alloc_objectは、
+// 共有のheapではなくそのRegionのページとobjectから取る(lockは要らない)。
+// 使い終わったRegionはmain threadがadopt_regionで共有のheapに加える。ページはそのまま繋ぐのでcopyはしない。
+// collectはRegionの中を知らないので、その前に全部adoptしておくこと(add_before_collect)。
+// LILITH_COMPRESSED_REFSのbuildでは、ページを4GiBの領域の中に順に置くので使えない(new_regionが投げる)。
+struct Region;
+Region* new_region();
+Region* use_region(Region* region); // 今のthreadのallocation先。nullptrなら共有のheap。前のを返す
+void adopt_region(Region* region); // regionは消える
+
+// collectで回収するobjectのうちkindのものは、freeする前にfinalizeを呼ぶ(C++の資源を持っているobject用)。
+void set_finalizer(ObjectKind kind, void (*finalize)(Object*));
+
+// collectの最初(markの前)に呼ばれる。
+void add_before_collect(std::function<void()> hook);
+
+// collectの引数以外にrootになるValue(global tableなど)を登録しておく。
+// 渡したscanはcollectのたびに呼ばれ、全部のrootをvisitに渡す。visitは引越し先に書き換えることがある。
+using RootVisitor = std::function<void(Value&)>;
+void add_roots(std::function<void(RootVisitor const&)> scan);
+
+// 弱い参照(hash-consの表など)。markとcompactの後に呼ばれる。
+// visitはそのValueが生き残っていればtrueを返して引越し先に書き換え、死んでいればfalseを返す。
+using WeakVisitor = std::function<bool(Value&)>;
+void add_weak_roots(std::function<void(WeakVisitor const&)> scan);
+
+// keyが全部生きている間だけvalueを生かす弱い参照(ephemeron。memoの表など)。rootからmarkした後、
+// 新しく生き返るものが無くなるまで繰り返し呼ばれる。scanは持っている組を全部visitに渡す。
+// valueはmarkするだけで引越し先には書き換えないので、後でadd_weak_rootsの方で書き換えること。
+using EphemeronVisitor = std::function<void(Value const* keys, std::size_t n, Value value)>;
+void add_ephemerons(std::function<void(EphemeronVisitor const&)> scan);
+
+// heap profiler(profiler.hpp)用。main threadで約interval byte確保するごとに1回、確保したばかりのconsかobjectをsamplerに渡す。
+// bytesとcells(consの数。objectなら0)はその確保の大きさ、weightはこのsampleが代表するbyte数(intervalの倍数)。
+// まだ中身を書いていないので、samplerは読まずに覚えておくだけにすること。intervalが0なら止める。Regionの中の確保は数えない。
+using AllocationSampler = void (*)(Value v, std::size_t bytes, std::size_t cells, std::size_t weight);
+void set_allocation_sampler(std::size_t interval, AllocationSampler sampler);
 
 Value collect(Value rootset);
+
+// 起動してからの累計。
+struct AllocStats {
+  std::uint64_t conses; // alloc_consの回数とalloc_runのslotの数
+  std::uint64_t objects; // alloc_objectの回数
+  std::uint64_t object_bytes;
+  std::uint64_t collections;
+  std::uint64_t gc_nanoseconds; // collectにかかった時間の合計
+  std::uint64_t live_conses; // 最後のcollectの後に残ったcons
+  std::uint64_t live_cons_bytes; // それらが使っているslotとcdr-code(と縮められなかったValueの箱)の大きさ
+};
+AllocStats const& alloc_stats();
@@ -0,0 +1,386 @@
+#include "aot.hpp"
+#include "prelude.hpp"
+#include "lisp_prelude.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+bool is_tagged(Value v, char const* tag) {
+  return !is_atom_bool(v) && car(v) == make_symbol(tag);
+}
+
+// Lispの名前をC++の識別子に使える形にする。英数字以外は `_xx`(16進)、`_` は `__`。
+std::string mangle(Value name) {
+  std::string res;
+  for(unsigned char c: show(name)) {
+    if(std::isalnum(c)) {
+      res += static_cast<char>(c);
+    } else if(c == '_') {
+      res += "__";
+    } else {
+      char buf[4];
+      std::snprintf(buf, sizeof buf, "_%02x", c);
+      res += buf;
+    }
+  }
+  return res;
+}
+
+std::string literal(std::string const& s) {
+  std::string res = "\"";
+  for(char c: s) {
+    if(c == '"' || c == '\\') res += '\\';
+    res += c;
+  }
+  return res + '"';
+}
+
+std::string join(std::vector<std::string> const& xs) {
+  std::string res;
+  for(auto const& x: xs) {
+    if(!res.empty()) res += ", ";
+    res += x;
+  }
+  return res;
+}
+
+// cons/car/cdr/atom/eq/equal?/succ/predとfl+などは値を直接計算する関数がvalue.hppにある。
+struct Builtin {
+  char const* name;
+  std::int64_t arity;
+  char const* cxx; // 直接呼ぶC++の関数。applyはaot_callにする
+};
+Builtin const builtins[] = {
+  {"cons", 2, "make_cons"},
+  {"car", 1, "car"},
+  {"cdr", 1, "cdr"},
+  {"atom", 1, "atom"},
+  {"eq", 2, "eq"},
+  {"equal?", 2, "equal"},
+  {"succ", 1, "succ"},
+  {"pred", 1, "pred"},
+  {"fl+", 2, "fl_add"},
+  {"fl-", 2, "fl_sub"},
+  {"fl*", 2, "fl_mul"},
+  {"fl/", 2, "fl_div"},
+  {"fl<?", 2, "fl_less"},
+  {"fl=?", 2, "fl_equal"},
+  {"flonum?", 1, "flonum_p"},
+  {"fixnum->flonum", 1, "to_flonum"},
+  {"flonum->fixnum", 1, "to_fixnum"},
+  {"touch", 1, "aot_touch"},
+  {"pmap", 2, "aot_pmap"},
+  {"apply", -1, nullptr},
+};
+Builtin const* find_builtin(Value name) {
+  for(auto const& b: builtins) {
+    if(make_symbol(b.name) == name) return &b;
+  }
+  return nullptr;
+}
+
+struct Function {
+  std::string cname; // fn_/fa_/fv_の後ろ
+  std::string lisp_name;
+  Value params;
+  Value body;
+  std::int64_t arity; // -1なら `(lambda xs ...)`
+};
+
+std::int64_t arity_of(Value params) {
+  if(params != nil() && is_symbol(params)) return -1;
+  std::int64_t n{};
+  for(; params != nil(); params = cdr(params)) {
+    if(is_atom_bool(params) || !is_symbol(car(params))) throw "compile: unsupported parameter list";
+    ++n;
+  }
+  return n;
+}
+
+using Scope = std::vector<Value>; // 見えているlocal変数
+
+class Translator {
+  std::vector<Function> functions;
+  std::map<Value, std::size_t> function_of; // トップレベルの名前 -> functions
+  std::set<Value> variables; // 関数以外のトップレベルの定義
+  std::set<Value> prelude_names; // programで上書きしてよい名前
+  std::vector<Value> main_forms;
+  std::vector<std::string> constants; // 初期化式
+  std::map<std::string, std::size_t> constant_of;
+  std::set<Value> builtins_used;
+  std::size_t lifted{};
+
+  bool is_local(Value name, Scope const& scope) {
+    return std::find(begin(scope), end(scope), name) != end(scope);
+  }
+
+  std::string datum(Value v) {
+    if(v == nil()) return "nil()";
+    if(is_integer(v)) return "to_Value(std::int64_t{" + std::to_string(to_int(v)) + "})";
+    if(is_float(v)) return "make_float(std::bit_cast<double>(std::uint64_t{" + std::to_string(std::bit_cast<std::uint64_t>(to_double(v))) + "u}))";
+    if(is_symbol(v)) return "make_symbol(" + literal(show(v)) + ")";
+    if(!is_atom_bool(v)) return "make_cons(" + datum(car(v)) + ", " + datum(cdr(v)) + ")";
+    throw "compile: unsupported constant";
+  }
+  // 定数は起動時に一度だけ作っておく。
+  std::string constant(Value v) {
+    if(v == nil()) return "nil()";
+    std::string const init = datum(v);
+    auto [it, added] = constant_of.try_emplace(init, constants.size());
+    if(added) constants.push_back(init);
+    return "k" + std::to_string(it->second);
+  }
+
+  std::string variable(Value name, Scope const& scope) {
+    if(is_local(name, scope)) return "v_" + mangle(name);
+    if(name == t()) return constant(t());
+    if(name == make_symbol("nil")) return "nil()";
+    if(auto it = function_of.find(name); it != end(function_of)) return "fv_" + functions[it->second].cname;
+    if(variables.count(name)) return "gv_" + mangle(name);
+    if(find_builtin(name)) {
+      builtins_used.insert(name);
+      return "bv_" + mangle(name);
+    }
+    return "aot_unbound(" + literal(show(name)) + ")";
+  }
+
+  std::string arity_error(std::int64_t arity, std::size_t n) {
+    if(arity >= 0 && n < static_cast<std::size_t>(arity)) return "aot_error(\"too few arguments\")";
+    return "aot_error(\"too many arguments\")";
+  }
+  std::string arguments(std::int64_t arity, std::vector<std::string> const& args) {
+    if(arity < 0) return "aot_list({" + join(args) + "})";
+    return join(args);
+  }
+
+  std::string sequence(Value body, Scope const& scope) {
+    if(body == nil()) throw "compile: empty lambda body";
+    std::string res;
+    for(; cdr(body) != nil(); body = cdr(body)) {
+      res += "(void)(" + expr(car(body), scope) + "); ";
+    }
+    return res + "return " + expr(car(body), scope) + ";";
+  }
+
+  // 外側のlocal変数を使っていないか(quoteの中は見ない)
+  bool captures(Value v, Value params, Scope const& scope) {
+    if(is_symbol(v)) {
+      if(params != nil() && is_symbol(params)) return v != params && is_local(v, scope);
+      for(Value p = params; p != nil(); p = cdr(p)) {
+        if(car(p) == v) return false;
+      }
+      return is_local(v, scope);
+    }
+    if(is_atom_bool(v) || is_tagged(v, "quote")) return false;
+    for(; !is_atom_bool(v); v = cdr(v)) {
+      if(captures(car(v), params, scope)) return true;
+    }
+    return false;
+  }
+
+  // `(lambda ...)` を値として使う所。自由変数が無ければトップレベルの関数にする。
+  std::string lift(Value v, Scope const& scope) {
+    Value const params = car(cdr(v));
+    Value const body = cdr(cdr(v));
+    if(captures(body, params, scope)) throw "compile: lambdas that capture local variables are not supported";
+    functions.push_back(Function{"lambda_" + std::to_string(lifted++), "lambda", params, body, arity_of(params)});
+    return "fv_" + functions.back().cname;
+  }
+
+  // `((lambda (x y) ...) a b)` はC++のlambdaをその場で呼ぶ。
+  std::string immediate(Value lam, std::vector<std::string> const& args, Scope scope) {
+    Value const params = car(cdr(lam));
+    std::int64_t const arity = arity_of(params);
+    if(arity >= 0 && args.size() != static_cast<std::size_t>(arity)) return arity_error(arity, args.size());
+    std::vector<std::string> decls;
+    if(arity < 0) {
+      decls.push_back("Value v_" + mangle(params));
+      scope.push_back(params);
+    } else {
+      for(Value p = params; p != nil(); p = cdr(p)) {
+        decls.push_back("Value v_" + mangle(car(p)));
+        scope.push_back(car(p));
+      }
+    }
+    return "[=](" + join(decls) + ") -> Value { " + sequence(cdr(cdr(lam)), scope) + " }(" + arguments(arity, args) + ")";
+  }
+
+  std::string application(Value v, Scope const& scope) {
+    Value const op = car(v);
+    std::vector<std::string> args;
+    for(Value o = cdr(v); o != nil(); o = cdr(o)) {
+      if(is_atom_bool(o)) throw "compile: improper argument list";
+      args.push_back(expr(car(o), scope));
+    }
+    if(is_symbol(op) && !is_local(op, scope)) {
+      if(auto it = function_of.find(op); it != end(function_of)) {
+        Function const& f = functions[it->second];
+        if(f.arity >= 0 && args.size() != static_cast<std::size_t>(f.arity)) return arity_error(f.arity, args.size());
+        return "fn_" + f.cname + "(" + arguments(f.arity, args) + ")";
+      }
+      Builtin const* b = variables.count(op) ? nullptr : find_builtin(op);
+      if(b && b->cxx == nullptr) { // `(apply f x ...)` は `(f x ...)`
+        if(args.empty()) return "aot_error(\"wrong number of arguments\")";
+        return "aot_call(" + args.front() + ", {" + join({begin(args) + 1, end(args)}) + "})";
+      }
+      if(b) {
+        if(args.size() != static_cast<std::size_t>(b->arity)) return "aot_error(\"wrong number of arguments\")";
+        return std::string{b->cxx} + "(" + join(args) + ")";
+      }
+    }
+    if(is_tagged(op, "lambda")) return immediate(op, args, scope);
+    return "aot_call(" + expr(op, scope) + ", {" + join(args) + "})";
+  }
+
+  std::string expr(Value v, Scope const& scope) {
+    if(v == nil()) return "nil()";
+    if(is_integer(v) || is_float(v)) return constant(v);
+    if(is_symbol(v)) return variable(v, scope);
+    if(is_atom_bool(v)) throw "compile: unsupported object in source";
+    if(is_tagged(v, "quote")) return constant(car(cdr(v)));
+    if(is_tagged(v, "if")) {
+      Value const rest = cdr(v);
+      std::string const alter = cdr(cdr(rest)) == nil() ? "nil()" : expr(car(cdr(cdr(rest))), scope);
+      return "(" + expr(car(rest), scope) + " != nil() ? " + expr(car(cdr(rest)), scope) + " : " + alter + ")";
+    }
+    if(is_tagged(v, "define")) throw "compile: define is only supported at the top level";
+    if(is_tagged(v, "lambda")) return lift(v, scope);
+    if(is_tagged(v, "future")) return expr(car(cdr(v)), scope); // threadは使わずにその場で評価する
+    if(is_tagged(v, "delay")) throw "compile: delay is not supported";
+    if(is_tagged(v, "defmacro")) throw "compile: defmacro is not supported";
+    return application(v, scope);
+  }
+
+  // トップレベルの形を先に全部集めておけば、後ろで定義される関数も直接呼べる。
+  void declare(Value form, bool prelude) {
+    if(!is_tagged(form, "define")) {
+      main_forms.push_back(form);
+      return;
+    }
+    Value const name = car(cdr(form));
+    Value const value = car(cdr(cdr(form)));
+    if(!is_symbol(name)) throw "compile: unsupported define";
+    bool const known = function_of.count(name) || variables.count(name);
+    if(known && !(prelude_names.count(name) && !prelude)) throw "compile: redefinition of a top-level name";
+    if(known) { // preludeの定義をprogramで上書きする
+      prelude_names.erase(name);
+      function_of.erase(name);
+      variables.erase(name);
+    }
+    if(prelude) prelude_names.insert(name);
+    if(is_tagged(value, "lambda")) {
+      Value const params = car(cdr(value));
+      function_of[name] = functions.size();
+      functions.push_back(Function{mangle(name), show(name), params, cdr(cdr(value)), arity_of(params)});
+      return;
+    }
+    variables.insert(name);
+    main_forms.push_back(form);
+  }
+
+public:
+  void add(Value form, bool prelude) {
+    declare(form, prelude);
+  }
+
+  void write(std::ostream& out) {
+    std::vector<std::string> statements;
+    for(Value form: main_forms) {
+      if(is_tagged(form, "define")) {
+        statements.push_back("gv_" + mangle(car(cdr(form))) + " = " + expr(car(cdr(cdr(form))), {}) + ";");
+      } else {
+        statements.push_back("print_value(print, " + expr(form, {}) + ");");
+      }
+    }
+
+    // 関数の本体を翻訳している間にもlambdaが増えるので、添字で回す。
+    std::vector<std::string> bodies;
+    for(std::size_t i{}; i < functions.size(); ++i) {
+      Function const f = functions[i];
+      Scope scope;
+      std::vector<std::string> params;
+      if(f.arity < 0) {
+        params.push_back("Value v_" + mangle(f.params));
+        scope.push_back(f.params);
+      } else {
+        for(Value p = f.params; p != nil(); p = cdr(p)) {
+          params.push_back("Value v_" + mangle(car(p)));
+          scope.push_back(car(p));
+        }
+      }
+      bodies.push_back("Value fn_" + f.cname + "(" + join(params) + ") {\n  " + sequence(f.body, scope) + "\n}\n");
+    }
+    out << "// generated by `lilith compile`\n"
+        << "#include \"aot_runtime.hpp\"\n\n"
+        << "#include <iostream>\n\n";
+    for(std::size_t i{}; i < constants.size(); ++i) out << "Value k" << i << ";\n";
+    for(Value b: builtins_used) out << "Value bv_" << mangle(b) << ";\n";
+    for(Value v: variables) out << "Value gv_" << mangle(v) << ";\n";
+    for(auto const& f: functions) out << "Value fv_" << f.cname << ";\n";
+    out << '\n';
+    for(auto const& f: functions) {
+      std::vector<std::string> params(f.arity < 0 ? 1 : f.arity, "Value");
+      out << "Value fn_" << f.cname << "(" << join(params) << ");\n";
+    }
+    out << '\n';
+    for(auto const& b: bodies) out << b << '\n';
+    // 関数を値として使う時(aot_call)の入口
+    for(auto const& f: functions) {
+      out << "Value fa_" << f.cname << "(Value const* args, std::size_t n) {\n";
+      if(f.arity < 0) {
+        out << "  return fn_" << f.cname << "(make_list(args, n));\n";
+      } else {
+        std::vector<std::string> args;
+        for(std::int64_t i{}; i < f.arity; ++i) args.push_back("args[" + std::to_string(i) + "]");
+        out << "  (void)n;\n"
+            << "  return fn_" << f.cname << "(" << join(args) << ");\n";
+      }
+      out << "}\n";
+    }
+    out << "\nvoid init() {\n";
+    for(std::size_t i{}; i < constants.size(); ++i) out << "  k" << i << " = " << constants[i] << ";\n";
+    for(Value b: builtins_used) out << "  bv_" << mangle(b) << " = aot_builtin(" << literal(show(b)) << ");\n";
+    for(auto const& f: functions) {
+      out << "  fv_" << f.cname << " = make_primitive(" << literal(f.lisp_name) << ", " << f.arity << ", fa_" << f.cname << ");\n";
+    }
+    out << "}\n\n"
+        << "void print_value(bool print, Value v) {\n"
+        << "  if(print) std::cout << show(v) << std::endl;\n"
+        << "}\n\n"
+        << "void lisp_main(bool print) {\n"
+        << "  (void)print;\n";
+    for(auto const& s: statements) out << "  " << s << '\n';
+    out << "}\n\n"
+        << "int main(int argc, char** argv) {\n"
+        << "  init();\n"
+        << "  return aot_main(lisp_main, argc, argv);\n"
+        << "}\n";
+  }
+};
+
+bool skip_space(std::istream& in) {
+  while(std::isspace(in.peek())) in.get();
+  return in.peek() != EOF;
+}
+
+} // namespace
+
+void compile_program(std::istream& in, std::ostream& out) {
+  Translator translator;
+  for(char const* src: prelude_lisp_sources()) {
+    std::stringstream ss{src};
+    translator.add(read(ss), true);
+  }
+  while(skip_space(in)) {
+    translator.add(read(in), false);
+  }
+  translator.write(out);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <iosfwd>
+
+// Lispのprogram(トップレベルのdefineと式の並び)をC++のsourceに翻訳する。`lilith compile prog.lisp -o prog.cpp`
+//   - トップレベルで `(define f (lambda ...))` した関数はC++の関数に、lambdaの引数はC++の引数(local変数)になる。
+//   - cons/car/cdr/atom/eq/equal?/succ/predとfl+などは直接呼び出しになる。preludeの関数も一緒に翻訳する。
+//   - `((lambda (x) ...) e)` はその場で呼ぶC++のlambdaに、自由変数を持たないlambdaはトップレベルの関数になる。
+//   - 外側のlocal変数をcaptureするlambdaと、関数の中のdefineは翻訳できない(char const*を投げる)。
+// 出力はaot_runtime.hppをincludeするので、value.o、allocator.o、hashcons.o、aot_runtime.oとlinkする(`make prog.aot`)。
+void compile_program(std::istream& in, std::ostream& out);
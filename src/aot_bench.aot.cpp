@@ -0,0 +1,217 @@
+// generated by `lilith compile`
+#include "aot_runtime.hpp"
+
+#include <iostream>
+
+Value k0;
+Value k1;
+Value k2;
+Value k3;
+Value k4;
+Value k5;
+Value k6;
+Value k7;
+Value fv_id;
+Value fv__2b;
+Value fv__2a;
+Value fv_list;
+Value fv_null_3f;
+Value fv_not;
+Value fv_length;
+Value fv__3c_2dwalk;
+Value fv__3c;
+Value fv__2d;
+Value fv_fib;
+Value fv_tak;
+Value fv_build;
+Value fv_rev;
+Value fv_map1;
+Value fv_lambda_0;
+
+Value fn_id(Value);
+Value fn__2b(Value, Value);
+Value fn__2a(Value, Value);
+Value fn_list(Value);
+Value fn_null_3f(Value);
+Value fn_not(Value);
+Value fn_length(Value);
+Value fn__3c_2dwalk(Value, Value, Value);
+Value fn__3c(Value, Value);
+Value fn__2d(Value, Value);
+Value fn_fib(Value);
+Value fn_tak(Value, Value, Value);
+Value fn_build(Value, Value);
+Value fn_rev(Value, Value);
+Value fn_map1(Value, Value);
+Value fn_lambda_0(Value);
+
+Value fn_id(Value v_x) {
+  return v_x;
+}
+
+Value fn__2b(Value v_x, Value v_y) {
+  return (eq(v_y, k5) != nil() ? v_x : fn__2b(succ(v_x), pred(v_y)));
+}
+
+Value fn__2a(Value v_x, Value v_y) {
+  return (eq(v_y, k5) != nil() ? k5 : fn__2b(fn__2a(v_x, pred(v_y)), v_x));
+}
+
+Value fn_list(Value v_x) {
+  return v_x;
+}
+
+Value fn_null_3f(Value v_x) {
+  return eq(nil(), v_x);
+}
+
+Value fn_not(Value v_x) {
+  return (v_x != nil() ? nil() : k6);
+}
+
+Value fn_length(Value v_x) {
+  return (v_x != nil() ? succ(fn_length(cdr(v_x))) : k5);
+}
+
+Value fn__3c_2dwalk(Value v_up, Value v_down, Value v_y) {
+  return (eq(v_up, v_y) != nil() ? k6 : (eq(v_down, v_y) != nil() ? nil() : fn__3c_2dwalk(succ(v_up), pred(v_down), v_y)));
+}
+
+Value fn__3c(Value v_x, Value v_y) {
+  return (eq(v_x, v_y) != nil() ? nil() : fn__3c_2dwalk(succ(v_x), pred(v_x), v_y));
+}
+
+Value fn__2d(Value v_x, Value v_y) {
+  return (eq(v_y, k5) != nil() ? v_x : fn__2d(pred(v_x), pred(v_y)));
+}
+
+Value fn_fib(Value v_n) {
+  return (fn__3c(v_n, k7) != nil() ? v_n : fn__2b(fn_fib(pred(v_n)), fn_fib(fn__2d(v_n, k7))));
+}
+
+Value fn_tak(Value v_x, Value v_y, Value v_z) {
+  return (fn__3c(v_y, v_x) != nil() ? fn_tak(fn_tak(pred(v_x), v_y, v_z), fn_tak(pred(v_y), v_z, v_x), fn_tak(pred(v_z), v_x, v_y)) : v_z);
+}
+
+Value fn_build(Value v_n, Value v_acc) {
+  return (eq(v_n, k5) != nil() ? v_acc : fn_build(pred(v_n), make_cons(v_n, v_acc)));
+}
+
+Value fn_rev(Value v_l, Value v_acc) {
+  return (v_l != nil() ? fn_rev(cdr(v_l), make_cons(car(v_l), v_acc)) : v_acc);
+}
+
+Value fn_map1(Value v_f, Value v_l) {
+  return (v_l != nil() ? make_cons(aot_call(v_f, {car(v_l)}), fn_map1(v_f, cdr(v_l))) : nil());
+}
+
+Value fn_lambda_0(Value v_x) {
+  return succ(v_x);
+}
+
+Value fa_id(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_id(args[0]);
+}
+Value fa__2b(Value const* args, std::size_t n) {
+  (void)n;
+  return fn__2b(args[0], args[1]);
+}
+Value fa__2a(Value const* args, std::size_t n) {
+  (void)n;
+  return fn__2a(args[0], args[1]);
+}
+Value fa_list(Value const* args, std::size_t n) {
+  return fn_list(make_list(args, n));
+}
+Value fa_null_3f(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_null_3f(args[0]);
+}
+Value fa_not(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_not(args[0]);
+}
+Value fa_length(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_length(args[0]);
+}
+Value fa__3c_2dwalk(Value const* args, std::size_t n) {
+  (void)n;
+  return fn__3c_2dwalk(args[0], args[1], args[2]);
+}
+Value fa__3c(Value const* args, std::size_t n) {
+  (void)n;
+  return fn__3c(args[0], args[1]);
+}
+Value fa__2d(Value const* args, std::size_t n) {
+  (void)n;
+  return fn__2d(args[0], args[1]);
+}
+Value fa_fib(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_fib(args[0]);
+}
+Value fa_tak(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_tak(args[0], args[1], args[2]);
+}
+Value fa_build(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_build(args[0], args[1]);
+}
+Value fa_rev(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_rev(args[0], args[1]);
+}
+Value fa_map1(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_map1(args[0], args[1]);
+}
+Value fa_lambda_0(Value const* args, std::size_t n) {
+  (void)n;
+  return fn_lambda_0(args[0]);
+}
+
+void init() {
+  k0 = to_Value(std::int64_t{16});
+  k1 = to_Value(std::int64_t{12});
+  k2 = to_Value(std::int64_t{8});
+  k3 = to_Value(std::int64_t{4});
+  k4 = to_Value(std::int64_t{3000});
+  k5 = to_Value(std::int64_t{0});
+  k6 = make_symbol("#t");
+  k7 = to_Value(std::int64_t{2});
+  fv_id = make_primitive("id", 1, fa_id);
+  fv__2b = make_primitive("+", 2, fa__2b);
+  fv__2a = make_primitive("*", 2, fa__2a);
+  fv_list = make_primitive("list", -1, fa_list);
+  fv_null_3f = make_primitive("null?", 1, fa_null_3f);
+  fv_not = make_primitive("not", 1, fa_not);
+  fv_length = make_primitive("length", 1, fa_length);
+  fv__3c_2dwalk = make_primitive("<-walk", 3, fa__3c_2dwalk);
+  fv__3c = make_primitive("<", 2, fa__3c);
+  fv__2d = make_primitive("-", 2, fa__2d);
+  fv_fib = make_primitive("fib", 1, fa_fib);
+  fv_tak = make_primitive("tak", 3, fa_tak);
+  fv_build = make_primitive("build", 2, fa_build);
+  fv_rev = make_primitive("rev", 2, fa_rev);
+  fv_map1 = make_primitive("map1", 2, fa_map1);
+  fv_lambda_0 = make_primitive("lambda", 1, fa_lambda_0);
+}
+
+void print_value(bool print, Value v) {
+  if(print) std::cout << show(v) << std::endl;
+}
+
+void lisp_main(bool print) {
+  (void)print;
+  print_value(print, fn_fib(k0));
+  print_value(print, fn_tak(k1, k2, k3));
+  print_value(print, fn_length(fn_rev(fn_map1(fv_lambda_0, fn_build(k4, nil())), nil())));
+}
+
+int main(int argc, char** argv) {
+  init();
+  return aot_main(lisp_main, argc, argv);
+}
@@ -0,0 +1,11 @@
+(define <-walk (lambda (up down y) (if (eq up y) #t (if (eq down y) nil (<-walk (succ up) (pred down) y)))))
+(define < (lambda (x y) (if (eq x y) nil (<-walk (succ x) (pred x) y))))
+(define - (lambda (x y) (if (eq y 0) x (- (pred x) (pred y)))))
+(define fib (lambda (n) (if (< n 2) n (+ (fib (pred n)) (fib (- n 2))))))
+(define tak (lambda (x y z) (if (< y x) (tak (tak (pred x) y z) (tak (pred y) z x) (tak (pred z) x y)) z)))
+(define build (lambda (n acc) (if (eq n 0) acc (build (pred n) (cons n acc)))))
+(define rev (lambda (l acc) (if l (rev (cdr l) (cons (car l) acc)) acc)))
+(define map1 (lambda (f l) (if l (cons (f (car l)) (map1 f (cdr l))) nil)))
+(fib 16)
+(tak 12 8 4)
+(length (rev (map1 (lambda (x) (succ x)) (build 3000 nil)) nil))
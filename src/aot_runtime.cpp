@@ -0,0 +1,145 @@
+#include "aot_runtime.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+Value t() {
+  static Value t = make_symbol("#t");
+  return t;
+}
+
+Value from_bool(bool b) {
+  return b ? t() : nil();
+}
+
+std::string show_env(Value) {
+  return "#<env>"; // 出力したprogramにはframeが無い
+}
+
+Value aot_error(char const* msg) {
+  throw msg;
+}
+
+Value aot_unbound(char const* name) {
+  throw name;
+}
+
+Value aot_list(std::initializer_list<Value> values) {
+  return make_list(values.begin(), values.size());
+}
+
+namespace {
+
+Value call(Value f, Value const* args, std::size_t n) {
+  if(!is_primitive(f)) throw "ha?(apply)";
+  Primitive* prim = to_primitive(f);
+  if(prim->arity >= 0 && n != static_cast<std::size_t>(prim->arity)) throw "wrong number of arguments";
+  return prim->fn(args, n);
+}
+
+Value builtin_cons(Value const* args, std::size_t) { return make_cons(args[0], args[1]); }
+Value builtin_car(Value const* args, std::size_t) { return car(args[0]); }
+Value builtin_cdr(Value const* args, std::size_t) { return cdr(args[0]); }
+Value builtin_atom(Value const* args, std::size_t) { return atom(args[0]); }
+Value builtin_eq(Value const* args, std::size_t) { return eq(args[0], args[1]); }
+Value builtin_equal(Value const* args, std::size_t) { return equal(args[0], args[1]); }
+Value builtin_succ(Value const* args, std::size_t) { return succ(args[0]); }
+Value builtin_pred(Value const* args, std::size_t) { return pred(args[0]); }
+Value builtin_fl_add(Value const* args, std::size_t) { return fl_add(args[0], args[1]); }
+Value builtin_fl_sub(Value const* args, std::size_t) { return fl_sub(args[0], args[1]); }
+Value builtin_fl_mul(Value const* args, std::size_t) { return fl_mul(args[0], args[1]); }
+Value builtin_fl_div(Value const* args, std::size_t) { return fl_div(args[0], args[1]); }
+Value builtin_fl_less(Value const* args, std::size_t) { return fl_less(args[0], args[1]); }
+Value builtin_fl_equal(Value const* args, std::size_t) { return fl_equal(args[0], args[1]); }
+Value builtin_flonum_p(Value const* args, std::size_t) { return flonum_p(args[0]); }
+Value builtin_to_flonum(Value const* args, std::size_t) { return to_flonum(args[0]); }
+Value builtin_to_fixnum(Value const* args, std::size_t) { return to_fixnum(args[0]); }
+Value builtin_touch(Value const* args, std::size_t) { return aot_touch(args[0]); }
+Value builtin_pmap(Value const* args, std::size_t) { return aot_pmap(args[0], args[1]); }
+Value builtin_apply(Value const* args, std::size_t n) {
+  if(n < 1) throw "wrong number of arguments";
+  return call(args[0], args + 1, n - 1);
+}
+
+} // namespace
+
+Value aot_call(Value f, std::initializer_list<Value> args) {
+  return call(f, std::data(args), args.size());
+}
+
+Value aot_touch(Value v) {
+  return v;
+}
+
+Value aot_pmap(Value f, Value list) {
+  std::vector<Value> results;
+  for(; !is_atom_bool(list); list = cdr(list)) {
+    Value const x = car(list);
+    results.push_back(call(f, &x, 1));
+  }
+  return make_list(results.data(), results.size());
+}
+
+Value aot_builtin(char const* name) {
+  struct Builtin {
+    char const* name;
+    std::int64_t arity;
+    PrimitiveFn fn;
+  };
+  static Builtin const builtins[] = {
+    {"cons", 2, builtin_cons},
+    {"car", 1, builtin_car},
+    {"cdr", 1, builtin_cdr},
+    {"atom", 1, builtin_atom},
+    {"eq", 2, builtin_eq},
+    {"equal?", 2, builtin_equal},
+    {"succ", 1, builtin_succ},
+    {"pred", 1, builtin_pred},
+    {"fl+", 2, builtin_fl_add},
+    {"fl-", 2, builtin_fl_sub},
+    {"fl*", 2, builtin_fl_mul},
+    {"fl/", 2, builtin_fl_div},
+    {"fl<?", 2, builtin_fl_less},
+    {"fl=?", 2, builtin_fl_equal},
+    {"flonum?", 1, builtin_flonum_p},
+    {"fixnum->flonum", 1, builtin_to_flonum},
+    {"flonum->fixnum", 1, builtin_to_fixnum},
+    {"touch", 1, builtin_touch},
+    {"pmap", 2, builtin_pmap},
+    {"apply", -1, builtin_apply},
+  };
+  for(auto const& b: builtins) {
+    if(std::strcmp(b.name, name) == 0) return make_primitive(b.name, b.arity, b.fn);
+  }
+  throw name;
+}
+
+int aot_main(void (*body)(bool print), int argc, char** argv) {
+  int reps = 0;
+  if(argc >= 3 && std::strcmp(argv[1], "--time") == 0) reps = std::max(1, std::atoi(argv[2]));
+  try {
+    if(reps == 0) {
+      body(true);
+      return 0;
+    }
+    std::vector<double> samples;
+    for(int i{}; i < reps; ++i) {
+      auto const start = std::chrono::steady_clock::now();
+      body(false);
+      auto const end = std::chrono::steady_clock::now();
+      samples.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+    }
+    std::sort(begin(samples), end(samples));
+    std::cout << static_cast<std::uint64_t>(samples[samples.size() / 2]) << std::endl;
+  } catch(char const* msg) {
+    std::cout << "*** catch ***" << std::endl;
+    std::cout << msg << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <initializer_list>
+
+// `lilith compile` が出力したC++から使う道具。value.cpp、allocator.cpp、hashcons.cppと一緒にlinkする。
+// (prelude.cppはlinkしないので、value.cppが使うt()なども中で定義している)
+// 出力したprogramはcollectしない。最後まで走らせて終わるbatch向け。
+
+Value t();
+Value from_bool(bool b);
+
+[[noreturn]] Value aot_error(char const* msg);
+[[noreturn]] Value aot_unbound(char const* name); // interpreterと同じく名前を投げる
+Value aot_list(std::initializer_list<Value> values);
+// 関数の値(primitive)を呼ぶ。引数の数も確かめる。
+Value aot_call(Value f, std::initializer_list<Value> args);
+// 出力したprogramはthreadを使わないので、futureはその場で評価した値そのもので、pmapは順にmapする。
+Value aot_touch(Value v);
+Value aot_pmap(Value f, Value list);
+// car, consなどをprimitiveの値として
+Value aot_builtin(char const* name);
+
+// `prog` ならbodyを1回実行してトップレベルの式の値を表示する。
+// `prog --time N` ならN回実行して、1回あたりの時間(ns)の中央値だけを表示する。
+int aot_main(void (*body)(bool print), int argc, char** argv);
@@ -0,0 +1,1258 @@
+#include "prelude.hpp"
+#include "allocator.hpp"
+#include "jit.hpp"
+#include "optimizer.hpp"
+#include "hashcons.hpp"
+#include "future.hpp"
+#include "fasl.hpp"
+#include "escape.hpp"
+#include "macro.hpp"
+#include "memo.hpp"
+#include "typed_array.hpp"
+#include "server.hpp"
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// 決まったLispのworkloadを走らせて時間とallocationを測る。
+// 結果はtab区切りで標準出力に出すので、commitごとにとっておいてdiffできる。
+//   ./lilith_bench [--reps N] [--warmup N] [--no-jit] [--no-opt] [--hash-cons] [--no-cdr-coding] [workload...]
+//   ./lilith_bench --jit-compare  JITとinterpreterの結果の突き合わせと、速さの比較
+//   ./lilith_bench --opt-compare  optimizerで減ったclosureの呼び出し回数と時間
+//   ./lilith_bench --hash-cons-compare  同じ形のdataが多い時のhash-consingの有無での生きているconsの数とequal?の速さ
+//   ./lilith_bench --cdr-compare  長いlistのcdr-codingの有無での大きさとlength/showの速さ
+//   ./lilith_bench --footprint  consのdataの大きさと辿る速さ(`make bench-compressed` で32bitの参照と比べる)
+//   ./lilith_bench --numeric  doubleの計算の1反復あたりの時間とallocation
+//   ./lilith_bench --pmap-scaling  pmapのthreadの数ごとの時間を、1threadで順にmapしたのと比べる
+//   ./lilith_bench --lazy [--lazy-n N]  N要素(1000万)のmap/filter/takeを、generatorと段ごとにlistを作るので比べる
+//   ./lilith_bench --escape  木の中を探して見つけた所から戻るのを、Lispで1段ずつ、call/ec(longjmp)、C++の例外で比べる
+//   ./lilith_bench --macro  macroを使ったloopを、手で書いたもの、毎回展開するもの、thunkを渡す関数と比べる
+//   ./lilith_bench --memo  fibを、そのままとmemoizeしたもの(毎回空のcacheから、覚えたまま、LRUで8個だけ)で比べる
+//   ./lilith_bench --arrays [--array-n N]  N要素(100万)のsum/dot/min/add/scale/select<を、listとscalar/SSE/AVX2の配列で比べる
+//   ./lilith_bench --heap-profile  heap profileのsampleの間隔(512KiB/16KiB/1byte)ごとの遅さと、残ったbyteがどの関数に付いたか
+//   ./lilith_bench --server [--server-requests N]  `lilith serve` に1から64の接続で1行ずつN回(200)送った時の応答時間の分布
+//   ./lilith_bench --fasl [--fasl-mb N]  N MB(100)のs式のfileを、readとread-binaryで読む時間と大きさ
+//   ./lilith_bench --program prog.lisp [--aot ./prog.aot]  programをinterpreterと `lilith compile` したもので比べる
+
+namespace {
+
+// 複数の式が並んだsourceを順にevalする。
+Value eval_source(std::string const& src, Value env) {
+  std::stringstream ss{src};
+  while(true) {
+    while(ss.peek() == ' ' || ss.peek() == '\n') ss.get();
+    if(ss.peek() == EOF) break;
+    Value form = optimize(read(ss));
+    std::tie(std::ignore, env) = eval(form, env);
+  }
+  return env;
+}
+
+Value eval_string(std::string const& src, Value env) {
+  std::stringstream ss{src};
+  return std::get<0>(eval(optimize(read(ss)), env));
+}
+
+// workloadの中で使う道具。
+char const* const common_defines = R"(
+(define <-walk (lambda (up down y) (if (eq up y) #t (if (eq down y) nil (<-walk (succ up) (pred down) y)))))
+(define < (lambda (x y) (if (eq x y) nil (<-walk (succ x) (pred x) y))))
+(define - (lambda (x y) (if (eq y 0) x (- (pred x) (pred y)))))
+(define build (lambda (n acc) (if (eq n 0) acc (build (pred n) (cons n acc)))))
+(define rev (lambda (l acc) (if l (rev (cdr l) (cons (car l) acc)) acc)))
+)";
+
+// doubleのworkload。gridはxからstepずつ増えるn個のlist。
+char const* const float_defines = R"(
+(define grid (lambda (x step n) (if (eq n 0) nil (cons x (grid (fl+ x step) step (pred n))))))
+(define mandel-point (lambda (cr ci zr zi k)
+  (if (eq k 50) k
+    (if (fl<? 4.0 (fl+ (fl* zr zr) (fl* zi zi))) k
+      (mandel-point cr ci (fl+ (fl- (fl* zr zr) (fl* zi zi)) cr) (fl+ (fl* 2.0 (fl* zr zi)) ci) (succ k))))))
+(define mandel-row (lambda (ci xs acc) (if xs (mandel-row ci (cdr xs) (fl+ acc (fixnum->flonum (mandel-point (car xs) ci 0.0 0.0 0)))) acc)))
+(define mandel (lambda (ys xs acc) (if ys (mandel (cdr ys) xs (mandel-row (car ys) xs acc)) acc)))
+(define mandel-xs (grid (fl- 0.0 2.0) 0.125 20))
+(define mandel-ys (grid (fl- 0.0 1.25) 0.125 20))
+(define sum-squares (lambda (xs acc) (if xs (sum-squares (cdr xs) (fl+ acc (fl* (car xs) (car xs)))) acc)))
+)";
+
+std::string make_data_text(int width, int depth) {
+  // `(alpha 1 (beta 2 (...)) gamma-long-symbol ...)` のような入れ子のlist
+  std::stringstream ss;
+  auto rec = [&](auto&& self, int d) -> void {
+    ss << '(';
+    for(int i{}; i < width; ++i) {
+      if(i) ss << ' ';
+      switch(i % 4) {
+      case 0: ss << "alpha"; break;
+      case 1: ss << i * 37 + d; break;
+      case 2: ss << "some-long-symbol-name"; break;
+      default:
+        if(d > 0) self(self, d - 1);
+        else ss << "leaf";
+      }
+    }
+    ss << ')';
+  };
+  rec(rec, depth);
+  return ss.str();
+}
+
+struct Workload {
+  char const* name;
+  std::string setup; // 最初に一度だけevalする
+  std::size_t ops; // 1 repあたりの回数
+  // 1回分。formはrepごとに読み直したもの(collectで動くので持ち越さない)。collectしたらenvを書き換える。
+  std::function<void(Value form, Value& env)> op;
+  std::string form;
+};
+
+void eval_op(Value form, Value env) {
+  eval(form, env);
+}
+
+std::vector<Workload> workloads() {
+  std::string const data = make_data_text(12, 5);
+  return {
+    {"fib", "(define fib (lambda (n) (if (< n 2) n (+ (fib (pred n)) (fib (- n 2))))))", 1, eval_op, "(fib 15)"},
+    {"tak", "(define tak (lambda (x y z) (if (< y x) (tak (tak (pred x) y z) (tak (pred y) z x) (tak (pred z) x y)) z)))", 1, eval_op, "(tak 12 8 4)"},
+    {"list-build", "", 20, eval_op, "(build 1000 nil)"},
+    {"list-reverse", "(define bench-list (build 1000 nil))", 20, eval_op, "(rev bench-list nil)"},
+    {"list-length", "(define bench-list (build 1000 nil))", 20, eval_op, "(length bench-list)"},
+    // preludeのid/not/null?のような小さな関数を通す。optimizerはこれをinline展開する。
+    {"wrappers", "(define bench-list (build 1000 nil)) (define count-list (lambda (l n) (if (not (null? l)) (count-list (cdr l) (id (succ n))) n)))", 20, eval_op, "(count-list bench-list 0)"},
+    {"fixnum-loop", "(define spin (lambda (n x) (if (eq n 0) x (spin (pred n) (succ (succ (pred x)))))))", 20, eval_op, "(spin 2000 (- 0 1000))"},
+    {"mandelbrot", float_defines, 1, eval_op, "(mandel mandel-ys mandel-xs 0.0)"},
+    {"deep-recursion", "(define deep (lambda (n) (if (eq n 0) 0 (succ (deep (pred n))))))", 10, eval_op, "(deep 5000)"},
+    {"symbol-lookup", R"(
+(define a-rather-long-global-name 1)
+(define another-long-global-name 2)
+(define yet-another-global-name 3)
+(define lookup-loop (lambda (n)
+  ((lambda (outer-variable-one outer-variable-two)
+     ((lambda (inner-variable-one inner-variable-two inner-variable-three)
+        (if (eq n 0) outer-variable-one
+          (lookup-loop (pred n))))
+      a-rather-long-global-name another-long-global-name yet-another-global-name))
+   outer-variable-one-global yet-another-global-name)))
+(define outer-variable-one-global 4)
+)", 20, eval_op, "(lookup-loop 500)"},
+    {"reader", "", 20, [data](Value, Value) {
+      std::stringstream ss{data};
+      read(ss);
+    }, "nil"},
+    {"printer", "(define bench-data (quote " + data + "))", 20, [](Value, Value env) {
+      show(eval_string("bench-data", env));
+    }, "nil"},
+    // evalは末尾呼び出しでもC++のstackを積むので、1本のlistは数千要素までにしておく。
+    {"gc-stress", "(define bench-live (list (build 4000 nil) (build 4000 nil) (build 4000 nil) (build 4000 nil) (build 4000 nil)))", 5, [](Value, Value& env) {
+      // collectでformも動くので、毎回読み直す。
+      eval_string("(build 4000 nil)", env);
+      env = collect(env);
+    }, "nil"},
+  };
+}
+
+struct Result {
+  double ns_per_op_median;
+  double ns_per_op_min;
+  double conses_per_op;
+  double objects_per_op;
+  double object_bytes_per_op;
+  double gc_ns_per_op;
+  std::uint64_t live_conses;
+  std::uint64_t live_cons_bytes;
+  double closure_calls_per_op;
+  double boxed_floats_per_op; // objectsのうちFlonum
+};
+
+Result run(Workload const& w, Value env, int warmup, int reps) {
+  std::vector<double> samples;
+  AllocStats total{};
+  std::uint64_t gc_ns{};
+  std::uint64_t calls{};
+  std::uint64_t boxed{};
+  for(int rep = -warmup; rep < reps; ++rep) {
+    std::stringstream ss{w.form};
+    Value form = optimize(read(ss));
+    AllocStats const before = alloc_stats();
+    std::uint64_t const calls_before = closure_call_count();
+    std::uint64_t const boxed_before = boxed_floats();
+    auto const start = std::chrono::steady_clock::now();
+    for(std::size_t i{}; i < w.ops; ++i) w.op(form, env);
+    auto const end = std::chrono::steady_clock::now();
+    AllocStats const after = alloc_stats();
+    std::uint64_t const calls_after = closure_call_count();
+    std::uint64_t const boxed_after = boxed_floats();
+    env = collect(env);
+    if(rep < 0) continue;
+    double const ns = std::chrono::duration<double, std::nano>(end - start).count();
+    samples.push_back(ns / w.ops);
+    total.conses += after.conses - before.conses;
+    total.objects += after.objects - before.objects;
+    total.object_bytes += after.object_bytes - before.object_bytes;
+    gc_ns += alloc_stats().gc_nanoseconds - before.gc_nanoseconds;
+    calls += calls_after - calls_before;
+    boxed += boxed_after - boxed_before;
+  }
+  std::sort(begin(samples), end(samples));
+  double const n = static_cast<double>(reps) * w.ops;
+  return Result{
+    samples[samples.size() / 2],
+    samples.front(),
+    total.conses / n,
+    total.objects / n,
+    total.object_bytes / n,
+    gc_ns / n,
+    alloc_stats().live_conses,
+    alloc_stats().live_cons_bytes,
+    calls / n,
+    boxed / n,
+  };
+}
+
+// JITとinterpreterで同じ結果(errorならそのmessage)になるはずのprogram。
+// 型のguardに引っかかる場合や、途中で定義を上書きする場合も入れておく。
+char const* const jit_corpus[] = {
+  "(define fib (lambda (n) (if (< n 2) n (+ (fib (pred n)) (fib (- n 2)))))) (fib 12)",
+  "(define tak (lambda (x y z) (if (< y x) (tak (tak (pred x) y z) (tak (pred y) z x) (tak (pred z) x y)) z))) (tak 9 6 3)",
+  "(rev (build 50 nil) nil)",
+  "(length (build 100 nil))",
+  "(define down (lambda (n) (if (eq n -3) (quote done) (down (pred n))))) (down 2)",
+  "(define up (lambda (n) (if (eq n 3) n (up (succ n))))) (up -4)",
+  "(define first (lambda (x) (car x))) (list (first (quote (a b))) (first (quote ((1) 2))))",
+  "(define rest (lambda (x) (cdr x))) (rest (quote (a b c)))",
+  "(define first (lambda (x) (car x))) (first (quote (1))) (first 5)",
+  "(define up (lambda (x) (succ x))) (up 1) (up (quote a))",
+  "(define kind (lambda (x) (if (atom x) (quote atom) (quote cons)))) (list (kind 1) (kind nil) (kind (quote a)) (kind (quote (1))) (kind kind))",
+  "(define same (lambda (x y) (eq x y))) (list (same 1 1) (same -1 1) (same (quote a) (quote a)) (same (quote some-long-name) (quote some-long-name)) (same (quote (1)) (quote (1))))",
+  "(define pair (lambda (x) (cons x (quote (tail))))) (pair (pair 1))",
+  "(define twice (lambda (f x) (f (f x)))) (list (twice succ 3) (twice pred 3) (twice cdr (quote (1 2 3))))",
+  "(define adder (lambda (n) (lambda (x) (+ x n)))) ((adder 3) 4)",
+  "(define apply-to (lambda (x) (apply list x x))) (apply-to 5)",
+  "(define counter-base 1) (define get-base (lambda () counter-base)) (get-base) (get-base) (define counter-base 2) (get-base)",
+  "(define callee (lambda (x) (succ x))) (define caller (lambda (x) (callee x))) (caller 1) (caller 1) (define callee (lambda (x) (pred x))) (caller 1)",
+  "(define uses-missing (lambda (x) (no-such-function x))) (uses-missing 1)",
+  "(define reads-missing (lambda () no-such-variable)) (reads-missing)",
+  "(define one-arg (lambda (x) x)) (define bad-call (lambda () (one-arg 1 2))) (bad-call)",
+  "(define call-non-function (lambda (x) (x 1))) (call-non-function 3)",
+  "(define bump (lambda (x) (succ x))) (list (bump (pred 0)) (bump 2305843009213693951))",
+  "(define norm (lambda (x y) (fl+ (fl* x x) (fl* y y)))) (list (norm 3.0 4) (norm 1e200 1.0) (norm 0.0 0.0) (eq (norm 0.5 0.5) 0.5) (flonum->fixnum (norm 2.5 0.5)))",
+  "(define half (lambda (x) (fl/ x 2))) (list (half 1) (half (quote a)))",
+  "(define spawn (lambda (x) (future (cons x (build x nil))))) (list (touch (spawn 3)) (touch (spawn 0)) (touch 4))",
+  "(define failing (lambda (x) (future (no-such-function x)))) (define started (failing 1)) (touch started)",
+  "(define square-all (lambda (l) (pmap (lambda (x) (length (build x nil))) l))) (square-all (build 30 nil))",
+  "(pmap (lambda (x) (if (eq x 7) (car 7 7) x)) (build 10 nil))",
+  "(define ints (lambda (n) (cons n (delay (ints (succ n)))))) (define nth (lambda (s k) (if (eq k 0) (car s) (nth (force (cdr s)) (pred k))))) (list (nth (ints 0) 20) (force 5))",
+  "(define evens (lambda (g) (gen-filter (lambda (x) (eq x (pred (succ x)))) (gen-map (lambda (x) (succ (succ x))) g)))) (gen->list (gen-take 5 (evens (gen-unfold succ 0))))",
+  "(define deep (lambda (n) (if (eq n 0) 0 (succ (deep (pred n)))))) (apply gen-fold (lambda (acc x) (cons (deep 3000) acc)) nil (list->gen (list 1 2 3)))",
+  "(define walk-ec (lambda (k t) (if (atom t) (if (eq t 3) (k t) nil) (cons (walk-ec k (car t)) (walk-ec k (cdr t)))))) (list (call/ec (lambda (k) (walk-ec k (quote (1 (2 (3 4))))))) (call/ec (lambda (k) (walk-ec k (quote (1 2))))))",
+  "(define leak (lambda () (call/ec (lambda (k) k)))) (define call-k (lambda (k) (k 1))) (call-k (leak))",
+  "((call/ec (lambda (outer) (call/ec (lambda (inner) (outer inner))))) 5)",
+  "(define nest-ec (lambda (outer) (call/ec (lambda (inner) (outer inner))))) (define call-k (lambda (k) (k 1))) (call-k (call/ec nest-ec))",
+  "(defmacro my-unless (c a b) (list (quote if) c b a)) (define count-down (lambda (n acc) (my-unless (eq n 0) (count-down (pred n) (cons n acc)) acc))) (list (count-down 5 nil) (count-down 3 nil))",
+  "(defmacro quoted (x) (list (quote quote) x)) (define tag (lambda (x) (cons (quoted (x y)) x))) (list (tag 1) (tag 2) (quoted 3))",
+  "(defmacro ident (x) x) (define call-m (lambda (f) (f 1))) (call-m ident)",
+  "(defmacro my-if (c a b) (list (quote if) c a b)) (define pick (lambda (x) (my-if x (quote yes) (quote no)))) (pick 1) (pick 1) (defmacro my-if (c a b) (list (quote if) c b a)) (define pick2 (lambda (x) (my-if x (quote yes) (quote no)))) (define first-pick (pick 1)) (define my-if (lambda (c a b) (quote function))) (list first-pick (pick2 1) (pick 1))",
+  "(define mfib (memoize (lambda (n) (if (eq n 0) 0.0 (if (eq n 1) 1.0 (fl+ (mfib (pred n)) (mfib (pred (pred n))))))) 3)) (list (mfib 40) (mfib 20) (mfib 40))",
+  "(define xs (list->f64array (list 1 2.5 3 4 5 6 7 8 9))) (define is (list->i64array (list 9 1 8 2 7 3 6 4 5))) (list (array-sum xs) (array-dot xs xs) (array-min is) (array->list (array-select< is (array-scale is 0) is (array-add is is))) (array-ref xs 9))",
+  "(define pair-of (memoize (lambda (x y) (cons x y)) 2 #t)) (list (eq (pair-of (quote (1)) 2) (pair-of (quote (1)) 2)) (eq (pair-of 1 2) (pair-of 1 3)) ((memoize car) (quote (a))))",
+  "(define fut (list 7 (future (list 1 (car 5))) 8)) (list (length fut) (car (cdr (cdr fut))))",
+  "(call/ec (lambda (k) (pmap (lambda (x) (k x)) (list 1 2 3 4))))",
+  "(define mk (memoize (lambda (k x) (k (cons x x))))) (list (call/ec (lambda (k) (mk k 1))) (call/ec (lambda (k) (mk k 2))) (call/ec (lambda (k) (pmap (lambda (x) (mk k x)) (list 3)))))",
+  "(define per-item (pmap (lambda (x) (memoize (lambda (y) (cons x y)))) (build 200 nil))) (list (length per-item) ((car (cdr per-item)) 5))",
+};
+
+// 最後の式の値をshowした物。errorならそのmessage。
+std::string eval_source_result(std::string const& src, Value env) {
+  std::stringstream ss{src};
+  Value res = nil();
+  std::size_t const depth = arg_stack_depth();
+  try {
+    while(true) {
+      while(ss.peek() == ' ' || ss.peek() == '\n') ss.get();
+      if(ss.peek() == EOF) break;
+      Value form = read(ss);
+      std::tie(res, env) = eval(form, env);
+    }
+  } catch(char const* msg) {
+    unwind_arg_stack(depth);
+    return std::string{"error: "} + msg;
+  }
+  return show(res);
+}
+
+int jit_compare(Value env, int warmup, int reps) {
+  std::uint32_t const threshold = jit_threshold();
+  bool ok = true;
+  for(char const* src: jit_corpus) {
+    set_jit_threshold(0);
+    std::string const expected = eval_source_result(src, env);
+    set_jit_threshold(1); // 定義し直したclosureの最初の呼び出しからnative code
+    std::string const actual = eval_source_result(src, env);
+    if(expected != actual) {
+      std::cout << "MISMATCH\t" << src << "\n  interp: " << expected << "\n  jit:    " << actual << std::endl;
+      ok = false;
+    }
+    env = collect(env);
+  }
+  JitStats const& stats = jit_stats();
+  std::cout << "differential: " << std::size(jit_corpus) << " programs " << (ok ? "ok" : "FAILED")
+    << " (compiled " << stats.compiled << ", rejected " << stats.rejected << ", native calls " << stats.native_calls << ")" << std::endl;
+
+  std::cout << "workload\tinterp_ns_per_op\tjit_ns_per_op\tspeedup" << std::endl;
+  for(auto const& w: workloads()) {
+    if(w.form == "nil") continue; // evalを通らないworkload
+    env = eval_source(w.setup, env);
+    env = collect(env);
+    set_jit_threshold(0);
+    Result const interp = run(w, env, warmup, reps);
+    set_jit_threshold(threshold);
+    Result const jit = run(w, env, warmup, reps);
+    std::cout << w.name << '\t' << static_cast<std::uint64_t>(interp.ns_per_op_median)
+      << '\t' << static_cast<std::uint64_t>(jit.ns_per_op_median)
+      << '\t' << std::fixed << std::setprecision(2) << interp.ns_per_op_median / jit.ns_per_op_median << std::endl;
+  }
+  std::cout << "code bytes: " << stats.code_bytes << " (released pages: " << stats.released_bytes << " bytes)" << std::endl;
+  return ok ? 0 : 1;
+}
+
+// optimizerのon/offで、closureの呼び出し回数と時間を比べる。JITは止めてinterpreterだけで測る。
+int opt_compare(Value env, int warmup, int reps) {
+  set_jit_threshold(0);
+  std::cout << "workload\tcalls_per_op\topt_calls_per_op\tcalls_saved\tns_per_op\topt_ns_per_op\tspeedup" << std::endl;
+  for(auto const& w: workloads()) {
+    if(w.form == "nil") continue; // evalを通らないworkload
+    env = eval_source(w.setup, env);
+    env = collect(env);
+    set_optimize(false);
+    Result const plain = run(w, env, warmup, reps);
+    set_optimize(true);
+    Result const opt = run(w, env, warmup, reps);
+    std::cout << w.name << std::fixed << std::setprecision(1)
+      << '\t' << plain.closure_calls_per_op << '\t' << opt.closure_calls_per_op
+      << '\t' << std::setprecision(0) << 100 * (1 - opt.closure_calls_per_op / plain.closure_calls_per_op) << '%'
+      << '\t' << static_cast<std::uint64_t>(plain.ns_per_op_median)
+      << '\t' << static_cast<std::uint64_t>(opt.ns_per_op_median)
+      << '\t' << std::setprecision(2) << plain.ns_per_op_median / opt.ns_per_op_median << std::endl;
+  }
+  OptimizeStats const& stats = optimize_stats();
+  std::cout << "inlined " << stats.inlined << ", folded " << stats.folded << ", pruned " << stats.pruned << std::endl;
+  return 0;
+}
+
+// 同じ形のlistをたくさん持っておき、hash-consingのon/offで生きているconsの数とequal?の時間を比べる。
+int hash_cons_compare(Value env, int warmup, int reps) {
+  std::string const data = "(quote " + make_data_text(12, 5) + ")";
+  std::string src = "(define dup-data (list";
+  for(int i{}; i < 20; ++i) src += ' ' + data;
+  src += ")) (define dup-lists (list";
+  for(int i{}; i < 20; ++i) src += " (build 2000 nil)";
+  src += "))";
+  Workload const w{"equal", "", 20, eval_op, "(list (equal? (car dup-data) (car (cdr dup-data))) (equal? (car dup-lists) (car (cdr dup-lists))))"};
+  std::cout << "hash_cons\tlive_conses\tcons_bytes\ttable_size\ttable_bytes\tequal_ns_per_op" << std::endl;
+  std::uint64_t bytes[2]{};
+  std::uint64_t table_bytes{};
+  for(bool on: {false, true}) {
+    set_hash_consing(on);
+    env = eval_source("(define dup-data nil) (define dup-lists nil)", env);
+    env = collect(env);
+    AllocStats const base = alloc_stats();
+    env = eval_source(src, env);
+    env = collect(env);
+    std::uint64_t const live = alloc_stats().live_conses - base.live_conses;
+    bytes[on] = alloc_stats().live_cons_bytes - base.live_cons_bytes;
+    HashConsStats const& stats = hash_cons_stats();
+    if(on) table_bytes = stats.table_bytes;
+    Result const r = run(w, env, warmup, reps);
+    std::cout << (on ? "on" : "off") << '\t' << live << '\t' << bytes[on]
+      << '\t' << (on ? stats.table_size : 0) << '\t' << (on ? stats.table_bytes : 0)
+      << '\t' << static_cast<std::uint64_t>(r.ns_per_op_median) << std::endl;
+  }
+  set_hash_consing(false);
+  // boxしたdouble(1e300やnan)の入ったlistも、hash-consingの有無でequal?の答えが変わらないこと
+  char const* const checks[] = {
+    "(equal? (list 1e300) (list 1e300))",
+    "(equal? (list (fl/ 0.0 0.0)) (list (fl/ 0.0 0.0)))",
+    "(equal? (list 1.5 (list 1e300 2)) (list 1.5 (list 1e300 2)))",
+    "(equal? (list 1e300) (list 1e299))",
+    "(equal? (list (fl/ 1.0 0.0)) (list (fl/ (pred 0) 0.0)))",
+  };
+  bool checks_ok = true;
+  for(char const* check: checks) {
+    std::string results[2];
+    for(bool on: {false, true}) {
+      set_hash_consing(on);
+      results[on] = eval_source_result(check, env);
+      env = collect(env);
+    }
+    set_hash_consing(false);
+    if(results[0] != results[1]) {
+      std::cout << "MISMATCH " << check << ": off " << results[0] << ", on " << results[1] << std::endl;
+      checks_ok = false;
+    }
+  }
+  std::uint64_t const saved = bytes[0] - bytes[1];
+  std::cout << "cons bytes saved: " << saved
+    << " (" << std::fixed << std::setprecision(0) << 100.0 * saved / bytes[0] << "%), "
+    << "net of table: " << static_cast<std::int64_t>(saved) - static_cast<std::int64_t>(table_bytes) << std::endl;
+  std::cout << "boxed float checks: " << (checks_ok ? "ok" : "MISMATCH") << std::endl;
+  return checks_ok ? 0 : 1;
+}
+
+// 長いlistをreaderとlistで作り、cdr-codingのon/offで生きているconsの大きさとlength/showの時間を比べる。
+int cdr_compare(Value env, int warmup, int reps) {
+  std::string elements;
+  for(int i{}; i < 2000; ++i) elements += ' ' + std::to_string(i);
+  std::string src = "(define cdr-data (list";
+  for(int i{}; i < 20; ++i) src += " (quote (" + elements + "))"; // readerが作るlist
+  for(int i{}; i < 20; ++i) src += " (list" + elements + ")"; // `(lambda x x)` の引数のlist
+  src += "))";
+  Workload const length{"length", "", 20, eval_op, "(length (car cdr-data))"};
+  Workload const printer{"show", "", 1, [](Value, Value env) { show(eval_string("cdr-data", env)); }, "nil"};
+  std::cout << "cdr_coding\tlive_conses\tcons_bytes\tbytes_per_cons\tlength_ns_per_op\tshow_ns_per_op" << std::endl;
+  std::uint64_t bytes[2]{};
+  for(bool on: {false, true}) {
+    set_cdr_coding(on);
+    env = eval_source("(define cdr-data nil)", env);
+    env = collect(env);
+    AllocStats const base = alloc_stats();
+    env = eval_source(src, env);
+    env = collect(env);
+    std::uint64_t const live = alloc_stats().live_conses - base.live_conses;
+    bytes[on] = alloc_stats().live_cons_bytes - base.live_cons_bytes;
+    Result const l = run(length, env, warmup, reps);
+    Result const s = run(printer, env, warmup, reps);
+    std::cout << (on ? "on" : "off") << '\t' << live << '\t' << bytes[on]
+      << '\t' << std::fixed << std::setprecision(2) << static_cast<double>(bytes[on]) / live
+      << '\t' << static_cast<std::uint64_t>(l.ns_per_op_median)
+      << '\t' << static_cast<std::uint64_t>(s.ns_per_op_median) << std::endl;
+  }
+  set_cdr_coding(true);
+  std::cout << "cdr-coded size: " << std::fixed << std::setprecision(0) << 100.0 * bytes[1] / bytes[0] << "% of plain conses" << std::endl;
+  return 0;
+}
+
+// consでできたdata(readerで読んだ木とconsで作ったlist)の大きさと、それを辿る速さ。
+// `make bench-compressed` が普通のbuildとLILITH_COMPRESSED_REFSのbuildで走らせて比べる。
+int footprint(Value env, int warmup, int reps) {
+  std::string const data = "(quote " + make_data_text(12, 5) + ")";
+  std::string src = "(define fp-data (list";
+  for(int i{}; i < 20; ++i) src += ' ' + data;
+  src += ")) (define fp-lists (list";
+  for(int i{}; i < 20; ++i) src += " (build 2000 nil)";
+  src += "))";
+  Workload const length{"length", "", 20, eval_op, "(length (car fp-lists))"};
+  Workload const equal{"equal", "", 20, eval_op, "(equal? (car fp-data) (car (cdr fp-data)))"};
+  env = collect(env);
+  AllocStats const base = alloc_stats();
+  env = eval_source(src, env);
+  env = collect(env);
+  std::uint64_t const live = alloc_stats().live_conses - base.live_conses;
+  std::uint64_t const bytes = alloc_stats().live_cons_bytes - base.live_cons_bytes;
+  Result const l = run(length, env, warmup, reps);
+  Result const e = run(equal, env, warmup, reps);
+  std::cout << "refs\tlive_conses\tcons_bytes\tbytes_per_cons\tlength_ns_per_op\tequal_ns_per_op\n"
+    << sizeof(Slot) * 8 << "bit\t" << live << '\t' << bytes
+    << '\t' << std::fixed << std::setprecision(2) << static_cast<double>(bytes) / live
+    << '\t' << static_cast<std::uint64_t>(l.ns_per_op_median)
+    << '\t' << static_cast<std::uint64_t>(e.ns_per_op_median) << std::endl;
+  return 0;
+}
+
+// doubleの計算を1反復(mandelbrotなら点の更新1回、sum-squaresなら要素1つ)あたりで見る。
+// 指数が真ん中あたりの数はtagに収まるのでboxは0になるはずで、large-floatsは比べるためにわざと範囲の外にしてある。
+// (objectsにはinterpreterのFrameも入る)
+int numeric(Value env, int warmup, int reps) {
+  env = eval_source(float_defines, env);
+  env = eval_source("(define small-floats (grid 0.5 0.25 1000)) (define large-floats (grid 1e100 1e98 1000))", env);
+  env = collect(env);
+  struct Numeric {
+    Workload w;
+    std::string iterations; // 1回あたりの反復の数を返す式
+  };
+  Numeric const cases[] = {
+    {{"mandelbrot", "", 1, eval_op, "(mandel mandel-ys mandel-xs 0.0)"}, "(mandel mandel-ys mandel-xs 0.0)"},
+    {{"sum-squares", "", 20, eval_op, "(sum-squares small-floats 0.0)"}, "(length small-floats)"},
+    {{"sum-squares-large", "", 20, eval_op, "(sum-squares large-floats 0.0)"}, "(length large-floats)"},
+  };
+  std::cout << "workload\titerations_per_op\tns_per_iteration\tobjects_per_iteration\tboxed_floats_per_iteration" << std::endl;
+  for(auto const& c: cases) {
+    Value const n = eval_string(c.iterations, env);
+    double const iterations = is_integer(n) ? static_cast<double>(to_int(n)) : to_double(n);
+    Result const r = run(c.w, env, warmup, reps);
+    std::cout << c.w.name << '\t' << static_cast<std::uint64_t>(iterations) << std::fixed << std::setprecision(2)
+      << '\t' << r.ns_per_op_median / iterations
+      << '\t' << r.objects_per_op / iterations
+      << '\t' << r.boxed_floats_per_op / iterations << std::endl;
+  }
+  return 0;
+}
+
+// CPUを使う関数(fib)を長いlistの要素ごとに呼ぶ。threadの数を変えてpmapを測り、Lispで書いた順のmapと比べる。
+// 別threadはinterpreterだけで走るので、順の方もJITを切って揃える。
+int pmap_scaling(Value env, int warmup, int reps) {
+  set_jit_threshold(0);
+  env = eval_source(R"(
+(define fib (lambda (n) (if (< n 2) n (+ (fib (pred n)) (fib (- n 2))))))
+(define map1 (lambda (f l) (if l (cons (f (car l)) (map1 f (cdr l))) nil)))
+(define scaling-list (build 128 nil))
+(define scaling-f (lambda (x) (fib 11)))
+)", env);
+  env = collect(env);
+  Workload const serial{"map", "", 1, eval_op, "(map1 scaling-f scaling-list)"};
+  Workload const parallel{"pmap", "", 1, eval_op, "(pmap scaling-f scaling-list)"};
+  std::size_t const hardware = std::thread::hardware_concurrency();
+  std::vector<std::size_t> threads{1, 2, 4};
+  if(std::find(begin(threads), end(threads), hardware) == end(threads)) threads.push_back(hardware);
+  std::size_t const saved = future_threads();
+  double const base = run(serial, env, warmup, reps).ns_per_op_median;
+  std::cout << "workload\tthreads\tns_per_op\tspeedup\t(hardware_concurrency " << hardware << ")\n"
+    << "map\t1\t" << static_cast<std::uint64_t>(base) << "\t1.00" << std::endl;
+  for(std::size_t n: threads) {
+    set_future_threads(n);
+    double const ns = run(parallel, env, warmup, reps).ns_per_op_median;
+    std::cout << "pmap\t" << n << '\t' << static_cast<std::uint64_t>(ns)
+      << '\t' << std::fixed << std::setprecision(2) << base / ns << std::endl;
+  }
+  set_future_threads(saved);
+  return 0;
+}
+
+// 自然数をdoubleにして2乗し、0を除いてn個足す。generatorを繋いだ物と、同じ段を1つずつlistにしてから次に渡す物。
+// 最大RSSは減らないので、generatorの方を先に測る。
+int lazy_compare(Value env, std::size_t n) {
+  env = eval_source(R"(
+(define square (lambda (x) (fl* x x)))
+(define positive? (lambda (x) (fl<? 0.0 x)))
+)", env);
+  env = collect(env);
+  std::string const count = std::to_string(n);
+  struct Pipeline {
+    char const* name;
+    std::string form;
+  };
+  // 段ごとにgen->listで全部listにしてから、list->genで次の段に渡す
+  std::string list = "(gen->list (gen-take " + std::to_string(n + 1) + " (gen-unfold succ 0)))";
+  list = "(gen->list (gen-map fixnum->flonum (list->gen " + list + ")))";
+  list = "(gen->list (gen-map square (list->gen " + list + ")))";
+  list = "(gen->list (gen-filter positive? (list->gen " + list + ")))";
+  list = "(gen->list (gen-take " + count + " (list->gen " + list + ")))";
+  Pipeline const pipelines[] = {
+    {"generator", "(gen-fold fl+ 0.0 (gen-take " + count + " (gen-filter positive? (gen-map square (gen-map fixnum->flonum (gen-unfold succ 0))))))"},
+    {"list", "(gen-fold fl+ 0.0 (list->gen " + list + "))"},
+  };
+  auto const max_rss_kb = [] {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+  };
+  std::cout << "pipeline\telements\tms\tconses\tobjects\tmax_rss_growth_kb\tresult" << std::endl;
+  for(auto const& p: pipelines) {
+    std::uint64_t const rss_before = max_rss_kb();
+    AllocStats const before = alloc_stats();
+    auto const start = std::chrono::steady_clock::now();
+    Value const res = eval_string(p.form, env);
+    double const ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    AllocStats const after = alloc_stats();
+    std::cout << p.name << '\t' << n << '\t' << std::fixed << std::setprecision(1) << ms
+      << '\t' << after.conses - before.conses << '\t' << after.objects - before.objects
+      << '\t' << max_rss_kb() - rss_before << '\t' << show(res) << std::endl;
+    env = collect(env);
+  }
+  return 0;
+}
+
+// 木の中から最初に条件に合う葉を探す。見つけた所から一番上まで戻る方法を比べる。
+//   manual: 見つかったかどうかを呼び出しごとに返して、Lispで1段ずつ確かめながら戻る
+//   longjmp: call/ecのkで一度に戻る
+//   exception: 同じcall/ecを、C++の例外で戻るようにして(JITしたframeごとにhelperで受けて投げ直す)
+// chainは `(n (n-1 (... (1 0))))` の一番下にある0で、深い所から戻る。wideは深さ12の木の右半分の最初の葉。
+int escape_compare(Value env, int warmup, int reps) {
+  env = eval_source(R"(
+(define then (lambda (x y) y))
+(define or-find (lambda (found p rest) (if found found (find-manual p rest))))
+(define find-manual (lambda (p t) (if (atom t) (if (p t) t nil) (or-find (find-manual p (car t)) p (cdr t)))))
+(define walk-ec (lambda (k p t) (if (atom t) (if (p t) (k t) nil) (then (walk-ec k p (car t)) (walk-ec k p (cdr t))))))
+(define find-ec (lambda (p t) (call/ec (lambda (k) (walk-ec k p t)))))
+(define chain (lambda (n t) (if (eq n 0) t (chain (pred n) (list n t)))))
+(define full (lambda (d x) (if (eq d 0) x (cons (full (pred d) x) (full (pred d) x)))))
+(define zero? (lambda (x) (eq x 0)))
+(define two? (lambda (x) (eq x 2)))
+(define chain-tree (chain 1000 0))
+(define wide-tree (cons (full 12 1) (full 12 2)))
+)", env);
+  env = collect(env);
+  struct Case {
+    char const* tree;
+    char const* predicate;
+  };
+  Case const cases[] = {{"chain", "zero?"}, {"wide", "two?"}};
+  std::cout << "tree\tmanual_ns\tlongjmp_ns\texception_ns\tmanual/longjmp\texception/longjmp\tresult" << std::endl;
+  for(auto const& c: cases) {
+    std::string const args = std::string{c.predicate} + " " + c.tree + "-tree)";
+    Workload const manual{"manual", "", 10, eval_op, "(find-manual " + args};
+    Workload const ec{"call/ec", "", 10, eval_op, "(find-ec " + args};
+    std::string const expected = show(eval_string(manual.form, env));
+    if(show(eval_string(ec.form, env)) != expected) {
+      std::cout << c.tree << "\tMISMATCH" << std::endl;
+      return 1;
+    }
+    double const manual_ns = run(manual, env, warmup, reps).ns_per_op_median;
+    double const longjmp_ns = run(ec, env, warmup, reps).ns_per_op_median;
+    set_escape_longjmp(false);
+    double const exception_ns = run(ec, env, warmup, reps).ns_per_op_median;
+    set_escape_longjmp(true);
+    std::cout << c.tree << '\t' << static_cast<std::uint64_t>(manual_ns) << '\t' << static_cast<std::uint64_t>(longjmp_ns)
+      << '\t' << static_cast<std::uint64_t>(exception_ns) << std::fixed << std::setprecision(2)
+      << '\t' << manual_ns / longjmp_ns << '\t' << exception_ns / longjmp_ns << '\t' << expected << std::endl;
+  }
+  return 0;
+}
+
+// 同じloopを、macro(展開を覚える)、手で書いたもの、覚えずに毎回展開するmacro、thunkを渡す関数で書いて比べる。
+// 展開を覚えていれば、optimizerが展開した本体は手で書いたものと同じになり、expanderは呼び出しの場所ごとに1回だけ呼ばれる。
+int macro_compare(Value env, int warmup, int reps) {
+  env = eval_source(R"(
+(defmacro my-unless (c a b) (list (quote if) c b a))
+(defmacro inc2 (x) (list (quote succ) (list (quote succ) x)))
+(define loop-hand (lambda (n acc) (if (eq n 0) acc (loop-hand (pred n) (if (atom acc) (succ (succ acc)) acc)))))
+(define loop-macro (lambda (n acc) (my-unless (eq n 0) (loop-macro (pred n) (my-unless (atom acc) acc (inc2 acc))) acc)))
+(define loop-expand (lambda (n acc) (my-unless (eq n 0) (loop-expand (pred n) (my-unless (atom acc) acc (inc2 acc))) acc)))
+(define unless-fn (lambda (c a b) (if c (b) (a))))
+(define loop-thunk (lambda (n acc) (unless-fn (eq n 0) (lambda () (loop-thunk (pred n) (unless-fn (atom acc) (lambda () acc) (lambda () (succ (succ acc)))))) (lambda () acc))))
+)", env);
+  env = collect(env);
+  struct Variant {
+    char const* name;
+    char const* fn;
+    bool caching;
+  };
+  Variant const variants[] = {
+    {"hand-written", "loop-hand", true},
+    {"macro", "loop-macro", true},
+    {"macro-no-cache", "loop-expand", false},
+    {"thunk-function", "loop-thunk", true},
+  };
+  std::cout << "variant	ns_per_op	vs_hand	expansions	expansions_per_op	result" << std::endl;
+  double hand_ns{};
+  for(auto const& v: variants) {
+    Workload const w{v.name, "", 10, eval_op, std::string{"("} + v.fn + " 1000 0)"};
+    set_macro_caching(v.caching);
+    std::uint64_t const expansions_before = macro_expansions();
+    std::string const result = show(eval_string(w.form, env));
+    Result const r = run(w, env, warmup, reps);
+    std::uint64_t const expansions = macro_expansions() - expansions_before;
+    set_macro_caching(true);
+    if(hand_ns == 0) hand_ns = r.ns_per_op_median;
+    std::cout << v.name << '\t' << static_cast<std::uint64_t>(r.ns_per_op_median) << std::fixed << std::setprecision(2)
+      << '\t' << r.ns_per_op_median / hand_ns << '\t' << expansions
+      << '\t' << static_cast<double>(expansions) / (static_cast<double>(warmup + reps) * w.ops + 1) << '\t' << result << std::endl;
+  }
+  return 0;
+}
+
+// fib(n)の時間。naiveは呼び出しがfib(n)に比例して増えるので、n=30より大きい所は30の1回あたりの時間からの見積もり。
+// memoはn+1回しか本体を呼ばない。coldは毎回cacheを空にしてから、warmは覚えたまま(1回の表引き)。
+// lru8は8個しか覚えないmemoでcold。fibが次に使う結果は最近のものなので、追い出されても呼び出しの数は変わらない。
+int memo_compare(Value env, int warmup, int reps) {
+  env = eval_source(R"(
+(define nfib (lambda (n) (if (eq n 0) 0.0 (if (eq n 1) 1.0 (fl+ (nfib (pred n)) (nfib (pred (pred n))))))))
+(define mfib (memoize (lambda (n) (if (eq n 0) 0.0 (if (eq n 1) 1.0 (fl+ (mfib (pred n)) (mfib (pred (pred n)))))))))
+(define lfib (memoize (lambda (n) (if (eq n 0) 0.0 (if (eq n 1) 1.0 (fl+ (lfib (pred n)) (lfib (pred (pred n))))))) 8))
+)", env);
+  env = collect(env);
+  Value const mfib = find(make_symbol("mfib"), env); // objectは引越さない
+  Value const lfib = find(make_symbol("lfib"), env);
+  auto const cold = [](Value memo) {
+    return [memo](Value form, Value env) {
+      clear_memo(memo);
+      eval(form, env);
+    };
+  };
+  std::cout << "n	naive_calls	naive_ms	memo_cold_us	memo_warm_ns	lru8_cold_us	speedup_cold	lru8_evictions_per_op	result" << std::endl;
+  double naive_ns_per_call{};
+  for(int n = 20; n <= 90; n += n < 30 ? 5 : 10) {
+    std::string const arg = " " + std::to_string(n) + ")";
+    double fib_a = 0, fib_b = 1; // fib(n+1)
+    for(int i{}; i < n; ++i) fib_a = std::exchange(fib_b, fib_a + fib_b);
+    double const calls = 2 * fib_b - 1;
+    double naive_ns;
+    bool const measured = n <= 30;
+    if(measured) {
+      naive_ns = run(Workload{"naive", "", 1, eval_op, "(nfib" + arg}, env, std::min(warmup, 1), std::min(reps, 3)).ns_per_op_median;
+      naive_ns_per_call = naive_ns / calls;
+    } else {
+      naive_ns = naive_ns_per_call * calls;
+    }
+    Result const memo_cold = run(Workload{"memo-cold", "", 100, cold(mfib), "(mfib" + arg}, env, warmup, reps);
+    Result const memo_warm = run(Workload{"memo-warm", "", 1000, eval_op, "(mfib" + arg}, env, warmup, reps);
+    std::uint64_t const evictions_before = memo_stats().evictions;
+    Result const lru = run(Workload{"lru8-cold", "", 100, cold(lfib), "(lfib" + arg}, env, warmup, reps);
+    double const evictions = static_cast<double>(memo_stats().evictions - evictions_before) / ((warmup + reps) * 100);
+    std::cout << n << '\t' << static_cast<std::uint64_t>(calls) << std::fixed << std::setprecision(1)
+      << '\t' << naive_ns / 1e6 << (measured ? "" : " (est)")
+      << '\t' << memo_cold.ns_per_op_median / 1e3 << '\t' << memo_warm.ns_per_op_median
+      << '\t' << lru.ns_per_op_median / 1e3 << '\t' << naive_ns / memo_cold.ns_per_op_median
+      << '\t' << evictions << '\t' << show(eval_string("(mfib" + arg, env)) << std::endl;
+  }
+  // 結果は引数が生きている間は残る。fixnumの引数のlistの結果は他から見えなくてもcollectを越えて覚えていて、
+  // 死んだconsを引数にした組だけ忘れる。
+  env = eval_source("(define mlist (memoize (lambda (n) (build n nil)))) (define mpair (memoize (lambda (k) (cons k k))))", env);
+  eval_string("(mlist 50)", env);
+  eval_string("(mpair (build 3 nil))", env);
+  MemoStats const before = memo_stats();
+  env = collect(env);
+  bool const kept = show(eval_string("(length (mlist 50))", env)) == "50" && memo_stats().hits == before.hits + 1;
+  bool const dropped = memo_stats().dropped == before.dropped + 1;
+  std::cout << "ephemeron checks: " << (kept && dropped ? "ok" : "FAILED") << std::endl;
+  return kept && dropped ? 0 : 1;
+}
+
+// 同じ計算を、consのlist(tag付きの数)をLispで辿るものと、配列のprimitive(scalar/SSE4.2/AVX2)で比べる。
+// listは深く再帰できないので、1万要素ずつのlistのlistにしておく。i64の和と最小もfl+とfl<?で(fixnumの足し算のprimitiveが無い)。
+// levelsは3つのkernelの結果が同じだったか(配列なら全部の要素をequal?で)。listは遅いのでrepsは3まで。
+int array_compare(Value env, int warmup, int reps, std::size_t n) {
+  constexpr std::size_t chunk = 10000;
+  std::vector<double> xs(n);
+  std::vector<double> ys(n);
+  std::vector<std::int64_t> is(n);
+  for(std::size_t i{}; i < n; ++i) {
+    xs[i] = static_cast<double>(i % 1000) * 0.001 - 0.5 + static_cast<double>(i) * 1e-7;
+    ys[i] = static_cast<double>((i * 7) % 1013) * 0.002 - 1.0;
+    is[i] = static_cast<std::int64_t>((i * 7919) % 100003) - 50000;
+  }
+  auto const chunks = [&](auto const& v) {
+    std::vector<Value> lists;
+    for(std::size_t i{}; i < n; i += chunk) {
+      std::vector<Value> items;
+      for(std::size_t j = i; j < std::min(n, i + chunk); ++j) {
+        if constexpr(std::is_same_v<std::decay_t<decltype(v[0])>, double>) {
+          items.push_back(make_float(v[j]));
+        } else {
+          items.push_back(to_Value(v[j]));
+        }
+      }
+      lists.push_back(make_list(items.data(), items.size()));
+    }
+    return make_list(lists.data(), lists.size());
+  };
+  define_variable(make_symbol("xs-chunks"), chunks(xs), nil());
+  define_variable(make_symbol("ys-chunks"), chunks(ys), nil());
+  define_variable(make_symbol("is-chunks"), chunks(is), nil());
+  define_variable(make_symbol("xa"), make_f64array(xs.data(), n), nil());
+  define_variable(make_symbol("ya"), make_f64array(ys.data(), n), nil());
+  define_variable(make_symbol("ia"), make_i64array(is.data(), n), nil());
+  env = eval_source(R"(
+(define lsum (lambda (l acc) (if l (lsum (cdr l) (fl+ acc (car l))) acc)))
+(define csum (lambda (cs acc) (if cs (csum (cdr cs) (lsum (car cs) acc)) acc)))
+(define ldot (lambda (a b acc) (if a (ldot (cdr a) (cdr b) (fl+ acc (fl* (car a) (car b)))) acc)))
+(define cdot (lambda (as bs acc) (if as (cdot (cdr as) (cdr bs) (ldot (car as) (car bs) acc)) acc)))
+(define lmin (lambda (l m) (if l (lmin (cdr l) (if (fl<? (car l) m) (car l) m)) m)))
+(define cmin (lambda (cs m) (if cs (cmin (cdr cs) (lmin (car cs) m)) m)))
+(define ladd (lambda (a b acc) (if a (ladd (cdr a) (cdr b) (cons (fl+ (car a) (car b)) acc)) acc)))
+(define cadd (lambda (as bs acc) (if as (cadd (cdr as) (cdr bs) (cons (ladd (car as) (car bs) nil) acc)) acc)))
+(define lscale (lambda (l k acc) (if l (lscale (cdr l) k (cons (fl* (car l) k) acc)) acc)))
+(define cscale (lambda (cs k acc) (if cs (cscale (cdr cs) k (cons (lscale (car cs) k nil) acc)) acc)))
+(define lsel (lambda (a b acc) (if a (lsel (cdr a) (cdr b) (cons (if (fl<? (car a) (car b)) (car a) (car b)) acc)) acc)))
+(define csel (lambda (as bs acc) (if as (csel (cdr as) (cdr bs) (cons (lsel (car as) (car bs) nil) acc)) acc)))
+)", env);
+  env = collect(env);
+  struct Case {
+    char const* name;
+    std::string list;
+    std::string array;
+  };
+  Case const cases[] = {
+    {"f64-sum", "(csum xs-chunks 0.0)", "(array-sum xa)"},
+    {"f64-dot", "(cdot xs-chunks ys-chunks 0.0)", "(array-dot xa ya)"},
+    {"f64-min", "(cmin xs-chunks (car (car xs-chunks)))", "(array-min xa)"},
+    {"f64-add", "(cadd xs-chunks ys-chunks nil)", "(array-add xa ya)"},
+    {"f64-scale", "(cscale xs-chunks 1.5 nil)", "(array-scale xa 1.5)"},
+    {"f64-select<", "(csel xs-chunks ys-chunks nil)", "(array-select< xa ya xa ya)"},
+    {"i64-sum", "(csum is-chunks 0.0)", "(array-sum ia)"},
+    {"i64-min", "(cmin is-chunks (car (car is-chunks)))", "(array-min ia)"},
+    {"i64-add", "", "(array-add ia ia)"},
+    {"i64-select<", "", "(array-select< ia (array-scale ia 0) ia (array-add ia ia))"},
+  };
+  SimdLevel const best = simd_level();
+  SimdLevel const levels[] = {SimdLevel::Scalar, SimdLevel::Sse, SimdLevel::Avx2};
+  std::cout << "op\telements\tlist_ns\tscalar_ns\tsse_ns\tavx2_ns\tlist/best\tscalar/best\tlevels\tresult" << std::endl;
+  for(auto const& c: cases) {
+    double list_ns{};
+    if(!c.list.empty()) list_ns = run(Workload{c.name, "", 1, eval_op, c.list}, env, std::min(warmup, 1), std::min(reps, 3)).ns_per_op_median;
+    // collectするまでは結果のlistも動かないので、先に全部のlevelで計算して比べる
+    Value results[3]{};
+    bool agree = true;
+    for(int l{}; l < 3; ++l) {
+      if(set_simd_level(levels[l]) != levels[l]) continue; // CPUが対応していない
+      Value r = eval_string(c.array, env);
+      if(is_typed_array(r)) r = eval_string("(array->list " + c.array + ")", env);
+      results[l] = r;
+      agree = agree && equal_bool(r, results[0]);
+    }
+    Value const r = results[static_cast<int>(best)];
+    std::string const result = is_atom_bool(r) ? show(r) : "(" + show(car(r)) + " ...)"; // 配列なら最初の要素だけ
+    env = collect(env);
+    double ns[3]{};
+    for(int l{}; l < 3; ++l) {
+      if(set_simd_level(levels[l]) != levels[l]) continue;
+      ns[l] = run(Workload{c.name, "", 10, eval_op, c.array}, env, warmup, reps).ns_per_op_median;
+    }
+    set_simd_level(best);
+    double const best_ns = ns[static_cast<int>(best)];
+    // 測っていない所(listで書いていないop、CPUが対応していないlevel)は、0と読まれないように-にする
+    auto const cell = [](double v, int precision) {
+      if(v == 0) return std::string{"-"};
+      std::ostringstream os;
+      os << std::fixed << std::setprecision(precision) << v;
+      return os.str();
+    };
+    std::cout << c.name << '\t' << n
+      << '\t' << cell(list_ns, 0) << '\t' << cell(ns[0], 0) << '\t' << cell(ns[1], 0) << '\t' << cell(ns[2], 0)
+      << '\t' << cell(list_ns / best_ns, 1) << '\t' << cell(ns[0] / best_ns, 1)
+      << '\t' << (agree ? "same" : "DIFFER") << '\t' << result << std::endl;
+  }
+  return 0;
+}
+
+// heap profileのsampleの間隔ごとの遅さと、残ったbyteがどの関数のものになったか。
+// workはhoardで100要素のlistを20本作って返し(heap-keptに残る)、churnで同じlistを200本作って捨てる。
+// 1repごとにcollectするので、最後に残るのは最後にkeptに置いた分だけ(本当に生きているconsのbyteがlive_kb)。
+// defineし直すとJITしたcodeが作り直されるので、keptはC++のrootにしておく。
+// hoard_kbとchurn_kbはfoldedのretainedのうちその関数を通ったもの。churnは0になるはず。
+// 時間はheapの状態でrepごとにばらつくので、一番速かったrepで比べる。
+int heap_profile(Value env, int warmup, int reps) {
+  env = eval_source(R"(
+(define hoard (lambda (k) (if (eq k 0) nil (cons (build 100 nil) (hoard (pred k))))))
+(define churn (lambda (k) (if (eq k 0) nil ((lambda (x) (churn (pred k))) (build 100 nil)))))
+(define work (lambda () ((lambda (x) (hoard 20)) (churn 200))))
+)", env);
+  env = collect(env);
+  static Value kept = nil();
+  add_roots([](RootVisitor const& visit) { visit(kept); });
+  Workload const w{"heap", "", 10, [](Value form, Value env) { kept = std::get<0>(eval(form, env)); }, "(work)"};
+  double const live_kb = (20 * 101) * 2 * sizeof(Slot) / 1024.0; // 20本の100要素と、それを繋ぐ20個
+  std::string const folded = (std::filesystem::temp_directory_path() / ("lilith_bench_" + std::to_string(getpid()) + ".folded")).string();
+  auto const through = [](std::string const& path, char const* name) {
+    std::ifstream in{path};
+    std::uint64_t bytes{};
+    std::string line;
+    while(std::getline(in, line)) {
+      auto const space = line.rfind(' ');
+      if(line.find(std::string{";"} + name) < space) bytes += std::stoull(line.substr(space + 1));
+    }
+    return bytes / 1024.0;
+  };
+  run(w, env, warmup, reps); // JITしておく
+  // 同じprocessの中でも遅い時期と速い時期があるので、offと3つの間隔を交互に何周かして、それぞれ一番速かったもので比べる
+  std::size_t const intervals[] = {0, 512 * 1024, 16 * 1024, 1}; // 0はoff
+  double ns[4];
+  std::fill(std::begin(ns), std::end(ns), 1e300);
+  double alloc_kb[4]{};
+  double hoard_kb[4]{};
+  double churn_kb[4]{};
+  for(int round{}; round < 3; ++round) {
+    for(std::size_t k{}; k < 4; ++k) {
+      if(intervals[k] == 0) {
+        ns[k] = std::min(ns[k], run(w, env, warmup, reps).ns_per_op_min);
+        continue;
+      }
+      set_heap_sample_interval(intervals[k]);
+      profile_start(ProfileMode::Heap);
+      Result const r = run(w, env, warmup, reps);
+      std::ostringstream report;
+      profile_stop(report, folded.c_str());
+      ns[k] = std::min(ns[k], r.ns_per_op_min);
+      alloc_kb[k] = through(folded + ".alloc", "work") / ((warmup + reps) * w.ops);
+      hoard_kb[k] = through(folded, "hoard");
+      churn_kb[k] = through(folded, "churn");
+    }
+  }
+  std::cout << "interval\tns_per_op\toverhead\talloc_kb_per_op\thoard_kb\tchurn_kb\tlive_kb" << std::endl;
+  for(std::size_t k{}; k < 4; ++k) {
+    std::cout << (intervals[k] == 0 ? "off" : std::to_string(intervals[k])) << '\t' << static_cast<std::uint64_t>(ns[k])
+      << '\t' << std::fixed << std::setprecision(2) << ns[k] / ns[0] << std::setprecision(1);
+    if(intervals[k] == 0) std::cout << "\t-\t-\t-";
+    else std::cout << '\t' << alloc_kb[k] << '\t' << hoard_kb[k] << '\t' << churn_kb[k];
+    std::cout << '\t' << live_kb << std::endl;
+  }
+  std::filesystem::remove(folded);
+  std::filesystem::remove(folded + ".alloc");
+  set_heap_sample_interval(16 * 1024);
+  return 0;
+}
+
+// `lilith serve` (server.hpp)に同時にいくつもの接続から1行ずつ送って、返ってくるまでの時間を測る。
+// serverはforkした子で、今のglobals(common_defines)のまま動かす。接続ごとに最初にsessionの中でdefineしておき、
+// それを使う式をrequests回、前の答えが返ってから次を送る。10回ごとに型のerrorになる行も送る(時間には入れない)。
+int server_load(std::size_t requests) {
+  std::string const path = (std::filesystem::temp_directory_path() / ("lilith_bench_" + std::to_string(getpid()) + ".sock")).string();
+  std::filesystem::remove(path);
+  pid_t const child = fork();
+  if(child < 0) {
+    std::cout << "fork failed" << std::endl;
+    return 1;
+  }
+  if(child == 0) {
+    try {
+      serve(path.c_str());
+    } catch(char const* msg) {
+      std::cerr << msg << std::endl;
+    }
+    _exit(0);
+  }
+  auto const connect_to = [&]() -> int {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    int const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) return fd;
+    close(fd);
+    return -1;
+  };
+  for(int i{}; i < 500; ++i) { // 子が待ち始めるまで
+    int const fd = connect_to();
+    if(fd >= 0) {
+      close(fd);
+      break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  // 1行送って、改行までを読む。
+  auto const request = [](int fd, std::string const& line, std::string& buffer) {
+    std::string const msg = line + "\n";
+    for(std::size_t sent{}; sent < msg.size();) {
+      ssize_t const n = send(fd, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+      if(n <= 0) return std::string{"error: send"};
+      sent += static_cast<std::size_t>(n);
+    }
+    std::size_t nl;
+    while((nl = buffer.find('\n')) == std::string::npos) {
+      char buf[4096];
+      ssize_t const n = read(fd, buf, sizeof(buf));
+      if(n <= 0) return std::string{"error: closed"};
+      buffer.append(buf, static_cast<std::size_t>(n));
+    }
+    std::string res = buffer.substr(0, nl);
+    buffer.erase(0, nl + 1);
+    return res;
+  };
+  std::pair<char const*, char const*> const bad_requests[] = {
+    {"(car 5)", "error: car: not a cons"},
+    {"(cdr nil)", "error: cdr: not a cons"},
+    {"(succ (quote a))", "error: succ: not a fixnum"},
+    {"(pred (quote (1)))", "error: pred: not a fixnum"},
+  };
+  std::cout << "clients\trequests\tp50_us\tp90_us\tp99_us\tmax_us\trequests_per_sec" << std::endl;
+  int status = 0;
+  for(std::size_t clients: {1, 2, 4, 8, 16, 32, 64}) {
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed{false};
+    auto const start = std::chrono::steady_clock::now();
+    for(std::size_t c{}; c < clients; ++c) {
+      threads.emplace_back([&, c] {
+        int const fd = connect_to();
+        if(fd < 0) {
+          failed = true;
+          return;
+        }
+        std::string buffer;
+        std::string const expected = std::to_string(20 + c % 7);
+        request(fd, "(define mine (build " + expected + " nil))", buffer);
+        for(std::size_t i{}; i < requests; ++i) {
+          auto const t0 = std::chrono::steady_clock::now();
+          std::string const res = request(fd, "(length (rev mine (build 30 nil)))", buffer);
+          latencies[c].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+          if(res != std::to_string(30 + 20 + c % 7)) failed = true; // 他のsessionのmineが見えていないか
+          if(i % 10 == 9) { // 型のerrorはそのsessionにerrorを返すだけで、serverもほかのsessionも続く
+            auto const& bad = bad_requests[(c + i / 10) % std::size(bad_requests)];
+            if(request(fd, bad.first, buffer) != bad.second) failed = true;
+          }
+        }
+        close(fd);
+      });
+    }
+    for(auto& t: threads) t.join();
+    double const seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::vector<double> all;
+    for(auto const& l: latencies) all.insert(end(all), begin(l), end(l));
+    if(failed || all.empty()) {
+      std::cout << clients << "\tFAILED" << std::endl;
+      status = 1;
+      break;
+    }
+    std::sort(begin(all), end(all));
+    auto const at = [&](double p) { return all[std::min(all.size() - 1, static_cast<std::size_t>(p * all.size()))]; };
+    std::cout << clients << '\t' << all.size() << std::fixed << std::setprecision(1)
+      << '\t' << at(0.5) << '\t' << at(0.9) << '\t' << at(0.99) << '\t' << all.back()
+      << '\t' << std::setprecision(0) << all.size() / seconds << std::endl;
+  }
+  kill(child, SIGTERM);
+  waitpid(child, nullptr, 0);
+  return status;
+}
+
+// 大きなdata fileを読むのにかかる時間を、textのreadとFASL(fasl.hpp)で比べる。
+// dataはmake_data_textの木をmb MBになるまで並べたlist。どちらも読んだ物は捨てて、1回ごとにcollectする。
+int fasl_compare(Value env, int reps, std::size_t mb) {
+  auto const dir = std::filesystem::temp_directory_path();
+  std::string const text_path = (dir / "lilith_bench_data.lisp").string();
+  std::string const fasl_path = (dir / "lilith_bench_data.fasl").string();
+  {
+    std::ofstream out{text_path};
+    std::string const tree = make_data_text(12, 4);
+    std::size_t written = 1;
+    out << '(';
+    for(int i{}; written < mb << 20; ++i) {
+      // 数が全部同じにならないように、木ごとに1つ足す
+      std::string const item = "(" + std::to_string(i) + ' ' + std::to_string(i * 0.5 + 0.25) + ' ' + tree + ") ";
+      out << item;
+      written += item.size();
+    }
+    out << ')';
+  }
+  auto const time_ns = [](auto&& f) {
+    auto const start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  };
+  Value data = nil();
+  double text_ns = 1e300;
+  double write_ns = 1e300;
+  double fasl_ns = 1e300;
+  std::uint64_t conses{};
+  for(int rep{}; rep < reps; ++rep) {
+    std::uint64_t const before = alloc_stats().conses;
+    text_ns = std::min(text_ns, time_ns([&] {
+      std::ifstream in{text_path};
+      data = read(in);
+    }));
+    conses = alloc_stats().conses - before;
+    write_ns = std::min(write_ns, time_ns([&] { write_binary_file(data, fasl_path.c_str()); }));
+    Value back = nil();
+    fasl_ns = std::min(fasl_ns, time_ns([&] { back = read_binary_file(fasl_path.c_str()); }));
+    if(!equal_bool(data, back)) {
+      std::cout << "error: read-binary returned different data" << std::endl;
+      return 1;
+    }
+    data = nil();
+    env = collect(env);
+  }
+  auto const text_bytes = std::filesystem::file_size(text_path);
+  auto const fasl_bytes = std::filesystem::file_size(fasl_path);
+  std::filesystem::remove(text_path);
+  std::filesystem::remove(fasl_path);
+  std::cout << "format\tbytes\tconses\tload_ms\tMB_per_s\twrite_ms\n" << std::fixed << std::setprecision(1)
+    << "text\t" << text_bytes << '\t' << conses << '\t' << text_ns / 1e6 << '\t' << text_bytes / (text_ns / 1e3) << "\t-\n"
+    << "fasl\t" << fasl_bytes << '\t' << conses << '\t' << fasl_ns / 1e6 << '\t' << text_bytes / (fasl_ns / 1e3) << '\t' << write_ns / 1e6 << '\n'
+    << "speedup\t" << std::setprecision(2) << text_ns / fasl_ns << std::endl;
+  return 0;
+}
+
+// `prog --time N` (aot_runtime.cppのaot_main)が出す1回あたりのns。
+double run_aot(char const* binary, int reps) {
+  std::string const cmd = std::string{binary} + " --time " + std::to_string(reps);
+  FILE* p = popen(cmd.c_str(), "r");
+  if(p == nullptr) return 0;
+  double ns{};
+  if(std::fscanf(p, "%lf", &ns) != 1) ns = 0;
+  pclose(p);
+  return ns;
+}
+
+// defineは先に評価しておき、残りの式をまとめて1回分として測る。
+int program_compare(char const* path, char const* aot, Value env, int warmup, int reps) {
+  std::ifstream in{path};
+  if(!in) {
+    std::cerr << "cannot open " << path << std::endl;
+    return 1;
+  }
+  std::stringstream src;
+  src << in.rdbuf();
+  std::string body;
+  while(true) {
+    while(std::isspace(src.peek())) src.get();
+    if(src.peek() == EOF) break;
+    auto const start = src.tellg();
+    Value form = read(src);
+    if(!is_atom_bool(form) && car(form) == make_symbol("define")) {
+      std::tie(std::ignore, env) = eval(form, env);
+    } else {
+      body += ' ' + src.str().substr(start, src.tellg() - start);
+    }
+  }
+  env = collect(env);
+  Workload const w{"program", "", 1, eval_op, "(list" + body + ")"};
+  std::uint32_t const threshold = jit_threshold();
+  set_jit_threshold(0);
+  Result const interp = run(w, env, warmup, reps);
+  set_jit_threshold(threshold);
+  Result const jit = run(w, env, warmup, reps);
+  std::cout << "program\tinterp_ns\tjit_ns";
+  if(aot) std::cout << "\taot_ns\tinterp/aot\tjit/aot";
+  std::cout << '\n' << path << '\t' << static_cast<std::uint64_t>(interp.ns_per_op_median)
+    << '\t' << static_cast<std::uint64_t>(jit.ns_per_op_median);
+  if(aot) {
+    double const aot_ns = run_aot(aot, reps);
+    if(aot_ns <= 0) {
+      std::cout << "\terror: " << aot << " failed" << std::endl;
+      return 1;
+    }
+    std::cout << '\t' << static_cast<std::uint64_t>(aot_ns) << std::fixed << std::setprecision(2)
+      << '\t' << interp.ns_per_op_median / aot_ns << '\t' << jit.ns_per_op_median / aot_ns;
+  }
+  std::cout << std::endl;
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  int warmup = 2;
+  int reps = 10;
+  bool compare = false;
+  bool opt_compare_mode = false;
+  bool hash_cons_mode = false;
+  bool cdr_compare_mode = false;
+  bool footprint_mode = false;
+  bool numeric_mode = false;
+  bool pmap_mode = false;
+  bool fasl_mode = false;
+  bool lazy_mode = false;
+  bool escape_mode = false;
+  bool macro_mode = false;
+  bool memo_mode = false;
+  bool array_mode = false;
+  std::size_t array_n = 1'000'000;
+  bool heap_profile_mode = false;
+  bool server_mode = false;
+  std::size_t server_requests = 200;
+  std::size_t lazy_n = 10'000'000;
+  std::size_t fasl_mb = 100;
+  char const* program = nullptr;
+  char const* aot = nullptr;
+  std::vector<std::string> filter;
+  for(int i = 1; i < argc; ++i) {
+    if(std::strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+      reps = std::max(1, std::atoi(argv[++i]));
+    } else if(std::strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      warmup = std::max(0, std::atoi(argv[++i]));
+    } else if(std::strcmp(argv[i], "--no-jit") == 0) {
+      set_jit_threshold(0);
+    } else if(std::strcmp(argv[i], "--no-opt") == 0) {
+      set_optimize(false);
+    } else if(std::strcmp(argv[i], "--hash-cons") == 0) {
+      set_hash_consing(true);
+    } else if(std::strcmp(argv[i], "--hash-cons-compare") == 0) {
+      hash_cons_mode = true;
+    } else if(std::strcmp(argv[i], "--no-cdr-coding") == 0) {
+      set_cdr_coding(false);
+    } else if(std::strcmp(argv[i], "--footprint") == 0) {
+      footprint_mode = true;
+    } else if(std::strcmp(argv[i], "--numeric") == 0) {
+      numeric_mode = true;
+    } else if(std::strcmp(argv[i], "--pmap-scaling") == 0) {
+      pmap_mode = true;
+    } else if(std::strcmp(argv[i], "--lazy") == 0) {
+      lazy_mode = true;
+    } else if(std::strcmp(argv[i], "--lazy-n") == 0 && i + 1 < argc) {
+      lazy_n = std::max(1, std::atoi(argv[++i]));
+    } else if(std::strcmp(argv[i], "--escape") == 0) {
+      escape_mode = true;
+    } else if(std::strcmp(argv[i], "--macro") == 0) {
+      macro_mode = true;
+    } else if(std::strcmp(argv[i], "--memo") == 0) {
+      memo_mode = true;
+    } else if(std::strcmp(argv[i], "--arrays") == 0) {
+      array_mode = true;
+    } else if(std::strcmp(argv[i], "--array-n") == 0 && i + 1 < argc) {
+      array_n = std::max(1, std::atoi(argv[++i]));
+    } else if(std::strcmp(argv[i], "--heap-profile") == 0) {
+      heap_profile_mode = true;
+    } else if(std::strcmp(argv[i], "--server") == 0) {
+      server_mode = true;
+    } else if(std::strcmp(argv[i], "--server-requests") == 0 && i + 1 < argc) {
+      server_requests = std::max(1, std::atoi(argv[++i]));
+    } else if(std::strcmp(argv[i], "--fasl") == 0) {
+      fasl_mode = true;
+    } else if(std::strcmp(argv[i], "--fasl-mb") == 0 && i + 1 < argc) {
+      fasl_mb = std::max(1, std::atoi(argv[++i]));
+    } else if(std::strcmp(argv[i], "--cdr-compare") == 0) {
+      cdr_compare_mode = true;
+    } else if(std::strcmp(argv[i], "--opt-compare") == 0) {
+      opt_compare_mode = true;
+    } else if(std::strcmp(argv[i], "--jit-compare") == 0) {
+      compare = true;
+    } else if(std::strcmp(argv[i], "--program") == 0 && i + 1 < argc) {
+      program = argv[++i];
+    } else if(std::strcmp(argv[i], "--aot") == 0 && i + 1 < argc) {
+      aot = argv[++i];
+    } else {
+      filter.push_back(argv[i]);
+    }
+  }
+
+  Value env = initial_env();
+  env = eval_source(common_defines, env);
+  if(compare) return jit_compare(env, warmup, reps);
+  if(opt_compare_mode) return opt_compare(env, warmup, reps);
+  if(hash_cons_mode) return hash_cons_compare(env, warmup, reps);
+  if(cdr_compare_mode) return cdr_compare(env, warmup, reps);
+  if(footprint_mode) return footprint(env, warmup, reps);
+  if(numeric_mode) return numeric(env, warmup, reps);
+  if(pmap_mode) return pmap_scaling(env, warmup, reps);
+  if(lazy_mode) return lazy_compare(env, lazy_n);
+  if(escape_mode) return escape_compare(env, warmup, reps);
+  if(macro_mode) return macro_compare(env, warmup, reps);
+  if(memo_mode) return memo_compare(env, warmup, reps);
+  if(array_mode) return array_compare(env, warmup, reps, array_n);
+  if(heap_profile_mode) return heap_profile(env, warmup, reps);
+  if(server_mode) return server_load(server_requests);
+  if(fasl_mode) return fasl_compare(env, std::min(reps, 3), fasl_mb); // 大きいので何度も読まない
+  if(program) return program_compare(program, aot, env, warmup, reps);
+
+  std::cout << "workload\treps\tops\tns_per_op\tns_per_op_min\tconses_per_op\tobjects_per_op\tobject_bytes_per_op\tgc_ns_per_op\tlive_conses\tlive_cons_bytes" << std::endl;
+  for(auto const& w: workloads()) {
+    if(!filter.empty() && std::find(begin(filter), end(filter), w.name) == end(filter)) continue;
+    try {
+      env = eval_source(w.setup, env);
+      env = collect(env);
+      Result const r = run(w, env, warmup, reps);
+      std::cout << w.name << '\t' << reps << '\t' << w.ops << std::fixed
+        << '\t' << static_cast<std::uint64_t>(r.ns_per_op_median)
+        << '\t' << static_cast<std::uint64_t>(r.ns_per_op_min)
+        << '\t' << std::setprecision(1) << r.conses_per_op
+        << '\t' << r.objects_per_op
+        << '\t' << r.object_bytes_per_op
+        << '\t' << static_cast<std::uint64_t>(r.gc_ns_per_op)
+        << '\t' << r.live_conses << '\t' << r.live_cons_bytes << std::endl;
+    } catch(char const* msg) {
+      std::cout << w.name << "\terror: " << msg << std::endl;
+      return 1;
+    }
+  }
+}
@@ -0,0 +1,110 @@
+#include "escape.hpp"
+#include "allocator.hpp"
+#include "prelude.hpp"
+
+#include <csetjmp>
+
+namespace {
+
+struct Escape;
+
+// call/ecの1回分。call/ecのC++のframeに置く。
+struct EscapePoint {
+  std::jmp_buf jump;
+  std::size_t barriers; // 入った時のbarrier_depth
+  std::size_t args; // 入った時のarg_stackの高さ
+  std::size_t const* thread; // 入ったthreadのbarrier_depth(threadの印)
+  EscapePoint* outer; // このthreadで1つ外側の、まだ戻っていないcall/ec
+  Escape* owner;
+};
+
+struct Escape {
+  Object header;
+  EscapePoint* point; // call/ecから戻ったらnullptr
+};
+
+// 間にEscapeBarrierがあった時に投げる。pointのcall/ecだけが受け取る。
+struct Escaping {
+  EscapePoint* point;
+};
+
+thread_local std::size_t barrier_depth{};
+thread_local EscapePoint* innermost = nullptr; // まだ戻っていないcall/ecの鎖
+thread_local Value escape_value; // longjmpの前に置いて、着地点で読む(setjmpしたframeの変数は書き換えない)
+bool use_longjmp = true;
+
+Escape* to_escape(Value v) {
+  return reinterpret_cast<Escape*>(to_object(v));
+}
+
+// pointのcall/ecから戻る。外側のkでlongjmpした時は内側のcall/ecのframeも一緒に消えているので、そのkも使えなくする。
+void leave(EscapePoint* point) {
+  for(EscapePoint* p = innermost; p != point->outer; p = p->outer) p->owner->point = nullptr;
+  innermost = point->outer;
+}
+
+Value primitive_call_ec(Value const* args, std::size_t) {
+  Value const f = args[0]; // argsはarg_stackを指しているかもしれないので、applyの前に読んでおく
+  auto const e = reinterpret_cast<Escape*>(alloc_object(sizeof(Escape)));
+  e->header = Object{ObjectKind::Escape, false, 0};
+  EscapePoint point;
+  point.barriers = barrier_depth;
+  point.args = arg_stack_depth();
+  point.thread = &barrier_depth;
+  point.outer = innermost;
+  point.owner = e;
+  e->point = &point;
+  innermost = &point;
+  Value const k = to_Value(&e->header, nullptr);
+  if(setjmp(point.jump) == 0) {
+    try {
+      Value const res = apply(f, &k, 1);
+      leave(&point);
+      return res;
+    } catch(Escaping const& x) {
+      if(x.point != &point) {
+        leave(&point);
+        throw;
+      }
+    } catch(...) {
+      leave(&point);
+      throw;
+    }
+  }
+  // (k v)から。longjmpで来た時は、飛び越したArgStackScopeの代わりにここで降ろす
+  leave(&point);
+  unwind_arg_stack(point.args);
+  return escape_value;
+}
+
+} // namespace
+
+bool is_escape(Value f) {
+  return is_object(f) && to_object(f)->kind == ObjectKind::Escape;
+}
+
+void escape(Value k, Value const* args, std::size_t n) {
+  if(n != 1) throw "wrong number of arguments";
+  EscapePoint* const point = to_escape(k)->point;
+  if(point == nullptr) throw "call/ec: continuation is no longer active";
+  if(point->thread != &barrier_depth) throw "call/ec: cannot escape from a future or pmap thread"; // 他のthreadのstackには飛べない
+  escape_value = args[0];
+  if(!use_longjmp || barrier_depth != point->barriers) throw Escaping{point};
+  std::longjmp(point->jump, 1);
+}
+
+EscapeBarrier::EscapeBarrier() {
+  ++barrier_depth;
+}
+EscapeBarrier::~EscapeBarrier() {
+  --barrier_depth;
+}
+
+void set_escape_longjmp(bool enable) {
+  use_longjmp = enable;
+}
+
+Value define_escape_primitives(Value env) {
+  env = define_primitive("call/ec", 1, primitive_call_ec, env);
+  return env;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstddef>
+
+// `(call/ec f)` はfを脱出用の関数kで呼ぶ。fの中(どれだけ深くても)で `(k v)` を呼ぶと、call/ecがすぐにvを返す。
+// fが普通に返ればその値。call/ecから戻った後のkはもう呼べない(errorになる)。外側のkで飛び越された内側のcall/ecのkも同じ。
+// futureやpmapのthreadから呼んでも、別のthreadのstackには戻れないのでerrorになる(こちらは別のmessage)。
+// call/ecに入る時にsetjmpしておいて、kはlongjmpで一度に戻る(途中のframeを1つずつ巻き戻さない)。
+// 飛び越すC++のframeはinterpreterのものだけで、どれも自明に破棄できる。evalが積んだarg_stackは着地点で元の高さに戻す。
+// 後始末の要るC++のframe(EscapeBarrier)を間に挟んでいる時だけは、C++の例外で戻る。
+
+// applyから呼ぶ。fが脱出用の関数なら戻らない。
+bool is_escape(Value f);
+[[noreturn]] void escape(Value k, Value const* args, std::size_t n);
+
+// Lispを呼び出す間に、longjmpで飛び越されては困る物(coroutineやstd::vector、profilerのstack)を持つ所に置く。
+class EscapeBarrier {
+public:
+  EscapeBarrier();
+  ~EscapeBarrier();
+  EscapeBarrier(EscapeBarrier const&) = delete;
+  EscapeBarrier& operator=(EscapeBarrier const&) = delete;
+};
+
+// falseなら常にC++の例外で戻る(benchで比べるため)。
+void set_escape_longjmp(bool enable);
+
+// `(call/ec f)`
+Value define_escape_primitives(Value env);
@@ -0,0 +1,319 @@
+#include "fasl.hpp"
+#include "hashcons.hpp"
+#include "prelude.hpp"
+
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr char magic[] = "LFASL";
+constexpr std::size_t magic_size = sizeof(magic) - 1;
+constexpr std::uint8_t version = 1;
+
+enum Tag : std::uint8_t {
+  Nil,
+  Fixnum,
+  Symbol,
+  Float,
+  Run,
+  Shared,
+  Ref,
+};
+
+// consごとに何か所から指されているか(2で止める)。大きなdataでも軽いように、open addressingで持つ。
+class ConsCounts {
+  std::vector<Value> keys; // 0(nil)なら空き
+  std::vector<std::uint8_t> counts;
+  std::size_t used = 0;
+
+  std::size_t index(Value v) const {
+    std::size_t i = (v * 0x9E3779B97F4A7C15ULL) >> 20;
+    while(true) {
+      i &= keys.size() - 1;
+      if(keys[i] == v || keys[i] == 0) return i;
+      ++i;
+    }
+  }
+  void grow() {
+    std::vector<Value> old_keys(keys.size() * 2);
+    std::vector<std::uint8_t> old_counts(keys.size() * 2);
+    std::swap(old_keys, keys);
+    std::swap(old_counts, counts);
+    for(std::size_t i{}; i < old_keys.size(); ++i) {
+      if(old_keys[i] == 0) continue;
+      std::size_t const j = index(old_keys[i]);
+      keys[j] = old_keys[i];
+      counts[j] = old_counts[i];
+    }
+  }
+public:
+  ConsCounts() : keys(1024), counts(1024) {}
+  // 増やした後の数
+  std::uint8_t add(Value v) {
+    if(used * 2 >= keys.size()) grow();
+    std::size_t const i = index(v);
+    if(keys[i] == 0) {
+      keys[i] = v;
+      ++used;
+    }
+    if(counts[i] < 2) ++counts[i];
+    return counts[i];
+  }
+  bool shared(Value v) const { return counts[index(v)] >= 2; }
+};
+
+class Writer {
+  std::string out;
+  ConsCounts counts;
+  std::unordered_map<Value, std::uint64_t> symbols; // symbol -> 表のindex
+  std::vector<Value> symbol_order;
+  std::unordered_map<Value, std::uint64_t> labels; // Sharedで書いたcons -> 番号
+
+  void byte(std::uint8_t b) { out += static_cast<char>(b); }
+  void varint(std::uint64_t n) {
+    while(n >= 0x80) {
+      byte(static_cast<std::uint8_t>(n | 0x80));
+      n >>= 7;
+    }
+    byte(static_cast<std::uint8_t>(n));
+  }
+
+  // 書く前に全体を辿って、symbolを集めて共有されているconsを見つけておく。長いlistで再帰しないようにstackを使う。
+  void scan(Value root) {
+    std::vector<Value> stack{root};
+    while(!stack.empty()) {
+      Value const v = stack.back();
+      stack.pop_back();
+      if(v == nil() || is_integer(v) || is_float(v)) continue;
+      if(is_symbol(v)) {
+        if(symbols.try_emplace(v, symbol_order.size()).second) symbol_order.push_back(v);
+        continue;
+      }
+      if(is_atom_bool(v)) throw "write-binary: unsupported object";
+      if(counts.add(v) == 1) {
+        stack.push_back(cdr(v));
+        stack.push_back(car(v));
+      }
+    }
+  }
+
+  void value(Value v) {
+    if(v == nil()) return byte(Nil);
+    if(is_integer(v)) {
+      std::int64_t const n = to_int(v);
+      byte(Fixnum);
+      return varint((static_cast<std::uint64_t>(n) << 1) ^ static_cast<std::uint64_t>(n >> 63)); // zigzag
+    }
+    if(is_symbol(v)) {
+      byte(Symbol);
+      return varint(symbols.at(v));
+    }
+    if(is_float(v)) {
+      byte(Float);
+      std::uint64_t const bits = std::bit_cast<std::uint64_t>(to_double(v));
+      for(int i{}; i < 8; ++i) byte(static_cast<std::uint8_t>(bits >> (i * 8)));
+      return;
+    }
+    if(counts.shared(v)) {
+      if(auto const it = labels.find(v); it != end(labels)) {
+        byte(Ref);
+        return varint(it->second);
+      }
+      labels.emplace(v, labels.size());
+      byte(Shared);
+      value(car(v));
+      return value(cdr(v));
+    }
+    // 共有されていないconsが続く所までを1つのRunにする。
+    std::uint64_t n{};
+    Value tail = v;
+    for(; !is_atom_bool(tail) && (n == 0 || !counts.shared(tail)); tail = cdr(tail)) ++n;
+    byte(Run);
+    varint(n);
+    for(; v != tail; v = cdr(v)) value(car(v));
+    value(tail);
+  }
+
+public:
+  std::string const& write(Value root) {
+    scan(root);
+    out.append(magic, magic_size);
+    byte(version);
+    varint(symbol_order.size());
+    for(Value s: symbol_order) {
+      std::string const name = show(s);
+      varint(name.size());
+      out += name;
+    }
+    value(root);
+    return out;
+  }
+};
+
+class Reader {
+  std::uint8_t const* p;
+  std::uint8_t const* const end;
+  std::vector<Value> symbols;
+  std::vector<Value> labels;
+  std::vector<bool> ready; // hash-consingの間は、carとcdrを読み終えるまでSharedのconsを作れない
+
+  std::uint8_t byte() {
+    if(p == end) throw "read-binary: truncated file";
+    return *p++;
+  }
+  std::uint64_t varint() {
+    std::uint64_t n{};
+    for(unsigned shift{}; shift < 64; shift += 7) {
+      std::uint8_t const b = byte();
+      n |= std::uint64_t{b & 0x7Fu} << shift;
+      if(!(b & 0x80)) return n;
+    }
+    throw "read-binary: broken varint";
+  }
+
+  Value value() {
+    switch(byte()) {
+    case Nil:
+      return nil();
+    case Fixnum: {
+      std::uint64_t const z = varint();
+      return to_Value(static_cast<std::int64_t>(z >> 1) ^ -static_cast<std::int64_t>(z & 1));
+    }
+    case Symbol: {
+      std::uint64_t const i = varint();
+      if(i >= symbols.size()) throw "read-binary: broken symbol index";
+      return symbols[i];
+    }
+    case Float: {
+      std::uint64_t bits{};
+      for(int i{}; i < 8; ++i) bits |= std::uint64_t{byte()} << (i * 8);
+      return make_float(std::bit_cast<double>(bits));
+    }
+    case Run: {
+      std::uint64_t const n = varint();
+      if(n == 0 || n > static_cast<std::uint64_t>(end - p)) throw "read-binary: broken run";
+      std::vector<Value> items; // readの途中でcollectはしないので、ここに置いておいても動かない
+      items.reserve(n);
+      for(std::uint64_t i{}; i < n; ++i) items.push_back(value());
+      Value const tail = value();
+      return make_list(items.data(), items.size(), tail);
+    }
+    case Shared: {
+      std::size_t const id = labels.size();
+      if(hash_consing()) {
+        labels.push_back(nil());
+        ready.push_back(false);
+        Value const a = value();
+        Value const d = value();
+        labels[id] = make_cons(a, d);
+        ready[id] = true;
+        return labels[id];
+      }
+      Value const cell = make_cons(nil(), nil());
+      labels.push_back(cell);
+      ready.push_back(true);
+      set_car(cell, value());
+      set_cdr(cell, value());
+      return cell;
+    }
+    case Ref: {
+      std::uint64_t const i = varint();
+      if(i >= labels.size()) throw "read-binary: broken reference";
+      if(!ready[i]) throw "read-binary: circular structure while hash-consing";
+      return labels[i];
+    }
+    default:
+      throw "read-binary: unknown tag";
+    }
+  }
+
+public:
+  Reader(char const* data, std::size_t size)
+    : p{reinterpret_cast<std::uint8_t const*>(data)}, end{p + size} {}
+
+  Value read() {
+    if(static_cast<std::size_t>(end - p) < magic_size + 1 || std::memcmp(p, magic, magic_size) != 0) throw "read-binary: not a fasl file";
+    p += magic_size;
+    if(byte() != version) throw "read-binary: unsupported version";
+    std::uint64_t const n = varint();
+    std::string name;
+    for(std::uint64_t i{}; i < n; ++i) {
+      std::uint64_t const len = varint();
+      if(len > static_cast<std::uint64_t>(end - p)) throw "read-binary: truncated file";
+      name.assign(reinterpret_cast<char const*>(p), len);
+      p += len;
+      symbols.push_back(make_symbol(name.c_str()));
+    }
+    return value();
+  }
+};
+
+std::string path_of(Value v) {
+  if(!is_symbol(v)) throw "path must be a symbol";
+  return show(v);
+}
+
+Value primitive_write_binary(Value const* args, std::size_t) {
+  write_binary_file(args[0], path_of(args[1]).c_str());
+  return args[1];
+}
+Value primitive_read_binary(Value const* args, std::size_t) {
+  return read_binary_file(path_of(args[0]).c_str());
+}
+
+} // namespace
+
+void write_binary(Value v, std::ostream& os) {
+  Writer w;
+  std::string const& out = w.write(v);
+  os.write(out.data(), static_cast<std::streamsize>(out.size()));
+}
+
+Value read_binary(char const* data, std::size_t size) {
+  return Reader{data, size}.read();
+}
+
+void write_binary_file(Value v, char const* path) {
+  std::ofstream os{path, std::ios::binary};
+  if(!os) throw "write-binary: cannot open file";
+  write_binary(v, os);
+  if(!os) throw "write-binary: write failed";
+}
+
+Value read_binary_file(char const* path) {
+  int const fd = open(path, O_RDONLY);
+  if(fd < 0) throw "read-binary: cannot open file";
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    throw "read-binary: not a fasl file";
+  }
+  std::size_t const size = static_cast<std::size_t>(st.st_size);
+  void* const data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) throw "read-binary: cannot map file";
+  madvise(data, size, MADV_SEQUENTIAL);
+  try {
+    Value const res = read_binary(static_cast<char const*>(data), size);
+    munmap(data, size);
+    return res;
+  } catch(...) {
+    munmap(data, size);
+    throw;
+  }
+}
+
+Value define_fasl_primitives(Value env) {
+  env = define_primitive("write-binary", 2, primitive_write_binary, env);
+  env = define_primitive("read-binary", 1, primitive_read_binary, env);
+  return env;
+}
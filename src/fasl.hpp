@@ -0,0 +1,28 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+
+// consとatom(fixnum、symbol、double)でできたdataのbinary形式(FASL)。`read` で文字列を解釈するより速く読める。
+//   "LFASL" version(1byte)
+//   symbolの表: 数(varint)、それぞれ長さ(varint)と名前のbyte列
+//   値(前順)。先頭の1byteが種類:
+//     Nil
+//     Fixnum  zigzagしたvarint
+//     Symbol  表のindex(varint)
+//     Float   doubleの8byte(little endian)
+//     Run     数n(varint)、n個のcar、最後のcdr。共有されていないconsが続く所で、cdr-codedなlistとして一度に確保する
+//     Shared  2か所以上から指されるcons。出てきた順に番号をつけ、car、cdrが続く(その中から自分を指してもよい)
+//     Ref     Sharedの番号(varint)
+// closureなどのobjectは書けない。
+void write_binary(Value v, std::ostream& os);
+// 全体をmmapして、その上からそのまま読む。
+Value read_binary(char const* data, std::size_t size);
+
+void write_binary_file(Value v, char const* path);
+Value read_binary_file(char const* path);
+
+// `(write-binary obj path)`, `(read-binary path)`。pathはsymbolの名前
+Value define_fasl_primitives(Value env);
@@ -0,0 +1,310 @@
+#include "future.hpp"
+#include "allocator.hpp"
+#include "hashcons.hpp"
+#include "prelude.hpp"
+#include "escape.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+enum FutureState : std::uint32_t {
+  Pending,
+  Done,
+  Failed,
+};
+struct Future {
+  Object header;
+  Value thunk;
+  Value value;
+  std::uint32_t state; // FutureState。threadをまたいで読み書きするのでatomic_refを通す
+  char const* error; // Failedの時のmessage
+};
+
+thread_local int worker_index = -1; // poolのthreadなら自分のWorkerの番号
+
+// threadごとに仕事のdequeを持ち、自分のは後ろから、空なら他のthreadのを前から取る(work-stealing)。
+class Pool {
+  struct Worker {
+    std::mutex m;
+    std::deque<std::function<void()>> jobs;
+  };
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::mutex m; // 下のcondition_variable用
+  std::condition_variable work_cv; // 仕事が積まれた
+  std::condition_variable done_cv; // 仕事が終わった
+  std::atomic<std::size_t> queued{0};
+  std::atomic<std::size_t> outstanding{0}; // 積まれてまだ終わっていない仕事
+  std::atomic<std::size_t> next{0}; // main threadから積む先
+  std::atomic<bool> stopping{false};
+  std::mutex regions_m;
+  std::vector<Region*> finished; // 終わった仕事のRegion。main threadがadoptする
+
+  bool pop(std::size_t self, std::function<void()>& job) {
+    for(std::size_t i{}; i < workers.size(); ++i) {
+      Worker& w = *workers[(self + i) % workers.size()];
+      std::lock_guard lk{w.m};
+      if(w.jobs.empty()) continue;
+      if(i == 0) {
+        job = std::move(w.jobs.back());
+        w.jobs.pop_back();
+      } else {
+        job = std::move(w.jobs.front());
+        w.jobs.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+  bool run_one(std::size_t self) {
+    std::function<void()> job;
+    if(!pop(self, job)) return false;
+    --queued;
+    Region* const outer = use_region(new_region()); // touchの中で手伝う時は、外の仕事のRegionに戻す
+    job();
+    Region* const region = use_region(outer);
+    {
+      std::lock_guard lk{regions_m};
+      finished.push_back(region);
+    }
+    --outstanding;
+    notify(done_cv);
+    return true;
+  }
+  void loop(std::size_t self) {
+    worker_index = static_cast<int>(self);
+    while(true) {
+      if(!stopping && run_one(self)) continue;
+      std::unique_lock lk{m};
+      work_cv.wait(lk, [&] { return queued > 0 || stopping; });
+      if(stopping) return;
+    }
+  }
+  // atomicを書き換えてから、待っている側がpredicateを見ている間をまたがないようにmを通す。
+  void notify(std::condition_variable& cv) {
+    { std::lock_guard lk{m}; }
+    cv.notify_all();
+  }
+public:
+  std::size_t size() const { return workers.size(); }
+  void resize(std::size_t n) {
+    if(n == workers.size()) return;
+    wait_until([&] { return outstanding == 0; });
+    {
+      std::lock_guard lk{m};
+      stopping = true;
+    }
+    work_cv.notify_all();
+    for(auto& t: threads) t.join();
+    threads.clear();
+    workers.clear();
+    stopping = false;
+    for(std::size_t i{}; i < n; ++i) workers.push_back(std::make_unique<Worker>());
+    for(std::size_t i{}; i < n; ++i) threads.emplace_back([this, i] { loop(i); });
+  }
+  void submit(std::function<void()> job) {
+    ++outstanding;
+    ++queued;
+    std::size_t const i = worker_index >= 0 ? static_cast<std::size_t>(worker_index) : next++ % workers.size();
+    {
+      std::lock_guard lk{workers[i]->m};
+      workers[i]->jobs.push_back(std::move(job));
+    }
+    notify(work_cv);
+    done_cv.notify_all(); // touchで待っているthreadも手伝える
+  }
+  // predが成り立つまで待つ。poolのthreadなら、待っている間に他の仕事をする。
+  template<class Pred>
+  void wait_until(Pred pred) {
+    while(!pred()) {
+      if(worker_index >= 0 && run_one(static_cast<std::size_t>(worker_index))) continue;
+      std::unique_lock lk{m};
+      done_cv.wait(lk, [&] { return pred() || (worker_index >= 0 && queued > 0); });
+    }
+  }
+  bool idle() const { return outstanding == 0; }
+  // 新しい仕事は始めずに、今している仕事(とその中でtouchしているもの)が終わったthreadから止めて、全部joinする。
+  void shutdown() {
+    {
+      std::lock_guard lk{m};
+      stopping = true;
+    }
+    work_cv.notify_all();
+    for(auto& t: threads) t.join();
+    threads.clear();
+  }
+  std::vector<Region*> take_finished() {
+    std::lock_guard lk{regions_m};
+    return std::exchange(finished, {});
+  }
+};
+
+#ifdef LILITH_COMPRESSED_REFS
+std::size_t wanted_threads = 0; // Regionが使えない
+#else
+std::size_t wanted_threads = std::thread::hardware_concurrency();
+#endif
+
+// 積まれたままの仕事は終了する時に捨てるので、Pool自体は壊さずに置いておく。
+// threadは、allocatorなどのglobalが壊される前にatexitで止める(最初にpoolを作ったのはそれらの初期化より後なので、先に呼ばれる)。
+Pool* started = nullptr;
+void stop_pool() {
+  started->shutdown();
+}
+Pool& pool() {
+  if(started == nullptr) {
+    started = new Pool;
+    std::atexit(stop_pool);
+  }
+  if(worker_index < 0) started->resize(wanted_threads);
+  return *started;
+}
+
+bool parallel() {
+  return wanted_threads > 0 && !hash_consing(); // hash-consの表は共有なので
+}
+
+void run_future(Future* f) {
+  FutureState state = Done;
+  EscapeBarrier barrier; // その場で評価している時も、外のcall/ecへはerrorとして返る
+  std::size_t const depth = arg_stack_depth(); // touchの中でその場で評価していると、呼んだ側のevalの引数が下にある
+  try {
+    f->value = apply(f->thunk, nullptr, 0);
+  } catch(char const* msg) {
+    f->error = msg;
+    state = Failed;
+  } catch(...) {
+    f->error = "error in future";
+    state = Failed;
+  }
+  unwind_arg_stack(depth);
+  std::atomic_ref{f->state}.store(state, std::memory_order_release);
+}
+
+Future* to_future(Value v) {
+  if(!is_object(v) || to_object(v)->kind != ObjectKind::Future) return nullptr;
+  return reinterpret_cast<Future*>(to_object(v));
+}
+
+Value primitive_touch(Value const* args, std::size_t) { return touch(args[0]); }
+Value primitive_pmap(Value const* args, std::size_t) { return pmap(args[0], args[1]); }
+
+bool const adopt_before_collect = (add_before_collect(wait_for_futures), true);
+
+} // namespace
+
+Value make_future(Value thunk) {
+  auto const f = reinterpret_cast<Future*>(alloc_object(sizeof(Future)));
+  f->header = Object{ObjectKind::Future, false, 2};
+  f->thunk = thunk;
+  f->value = nil();
+  f->state = Pending;
+  f->error = nullptr;
+  if(parallel()) {
+    pool().submit([f] { run_future(f); });
+  } else {
+    run_future(f);
+  }
+  return to_Value(&f->header, nullptr);
+}
+
+Value touch(Value v) {
+  Future* const f = to_future(v);
+  if(f == nullptr) return v;
+  std::atomic_ref const state{f->state};
+  if(state.load(std::memory_order_acquire) == Pending) {
+    pool().wait_until([&] { return state.load(std::memory_order_acquire) != Pending; });
+  }
+  if(state.load(std::memory_order_acquire) == Failed) throw f->error;
+  return f->value;
+}
+
+// 要素をthreadの数の4倍くらいに分けて、分けたものを1つの仕事にする。
+Value pmap(Value f, Value list) {
+  EscapeBarrier barrier;
+  std::vector<Value> items;
+  for(; !is_atom_bool(list); list = cdr(list)) items.push_back(car(list));
+  std::size_t const n = items.size();
+  std::vector<Value> results(n);
+  std::size_t const chunks = parallel() ? std::min(n, pool().size() * 4) : 0;
+  if(chunks < 2) {
+    for(std::size_t i{}; i < n; ++i) results[i] = apply(f, &items[i], 1);
+    return make_list(results.data(), n);
+  }
+  std::atomic<std::size_t> remaining{chunks};
+  std::atomic<char const*> error{nullptr};
+  for(std::size_t c{}; c < chunks; ++c) {
+    std::size_t const begin = n * c / chunks;
+    std::size_t const end = n * (c + 1) / chunks;
+    pool().submit([&, begin, end] {
+      char const* msg = nullptr;
+      std::size_t const depth = arg_stack_depth();
+      try {
+        for(std::size_t i = begin; i < end; ++i) results[i] = apply(f, &items[i], 1);
+      } catch(char const* e) {
+        msg = e;
+      } catch(...) {
+        msg = "error in pmap";
+      }
+      unwind_arg_stack(depth);
+      char const* none = nullptr;
+      if(msg) error.compare_exchange_strong(none, msg);
+      --remaining;
+    });
+  }
+  pool().wait_until([&] { return remaining == 0; });
+  if(char const* msg = error.load()) throw msg;
+  return make_list(results.data(), n);
+}
+
+void submit_job(std::function<void()> job) {
+  if(parallel()) {
+    pool().submit(std::move(job));
+  } else {
+    job();
+  }
+}
+
+bool on_worker_thread() {
+  return worker_index >= 0;
+}
+
+bool futures_running() {
+  return started != nullptr && !started->idle();
+}
+
+void wait_for_futures() {
+  if(started == nullptr || on_worker_thread()) return;
+  Pool& p = *started;
+  p.wait_until([&] { return p.idle(); });
+  for(Region* region: p.take_finished()) adopt_region(region);
+}
+
+void set_future_threads(std::size_t n) {
+#ifndef LILITH_COMPRESSED_REFS
+  wanted_threads = n;
+#else
+  (void)n;
+#endif
+}
+
+std::size_t future_threads() {
+  return wanted_threads;
+}
+
+Value define_future_primitives(Value env) {
+  env = define_primitive("touch", 1, primitive_touch, env);
+  env = define_primitive("pmap", 2, primitive_pmap, env);
+  return env;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstddef>
+#include <functional>
+
+// `(future exp)` はexpを別threadで評価し始めてすぐにfutureを返す。`(touch f)` はその値を待つ(futureでなければそのまま)。
+// `(pmap f list)` は `(f x)` をいくつかに分けて別threadで評価したlist。
+// threadはwork-stealingのpoolで、仕事ごとに自分のRegion(allocator.hpp)にallocateする。
+// 終わった仕事のRegionは、collectとトップレベルのdefineの前に全部を待ってから共有のheapに入れる。
+// 別threadではJITとprofilerを使わず、トップレベルのdefineはerrorになる。
+// LILITH_COMPRESSED_REFSのbuildとhash-consingの間は、呼んだthreadでその場で評価する。
+
+// evalの `(future exp)`。thunkは `(lambda () exp)` のclosure。
+Value make_future(Value thunk);
+Value touch(Value v);
+Value pmap(Value f, Value list);
+
+// futureと同じくpoolのthreadで走らせる(server.cpp)。jobは自分のRegionにallocateするので、作った値は
+// wait_for_futuresまでは外から見えるValueに繋ぐだけにして、jobの外のC++の変数には持ち出さないこと。
+// poolを使わない時はその場で実行する。
+void submit_job(std::function<void()> job);
+
+bool on_worker_thread();
+// poolのthreadがまだ仕事をしている(共有のformを読んでいるかもしれない)。main threadから。
+bool futures_running();
+// 全部の仕事が終わるのを待って、そのRegionを共有のheapに入れる(main threadで)。
+void wait_for_futures();
+
+// poolのthreadの数。0ならpoolを使わない。起動した時はstd::thread::hardware_concurrency()
+void set_future_threads(std::size_t n);
+std::size_t future_threads();
+
+// `(touch f)`, `(pmap f list)`
+Value define_future_primitives(Value env);
@@ -0,0 +1,84 @@
+#include "hashcons.hpp"
+#include "allocator.hpp"
+
+#include <bit>
+#include <unordered_map>
+
+bool hash_consing_enabled = false;
+
+namespace {
+
+// boxしたdouble(Flonum)は確保するたびに別のobjectになるので、equal?と同じようにbitの並びで比べる。
+// そうしないと同じ数を入れたlistが別のcellになり、canonical同士は違う形だというequal?の近道が外れる。
+bool is_boxed_float(Value v) {
+  return is_object(v) && is_float(v);
+}
+std::uint64_t identity(Value v) {
+  return is_boxed_float(v) ? std::bit_cast<std::uint64_t>(to_double(v)) : v;
+}
+bool same(Value lhs, Value rhs) {
+  return lhs == rhs || (is_boxed_float(lhs) && is_boxed_float(rhs) && identity(lhs) == identity(rhs));
+}
+
+struct Key {
+  Value car;
+  Value cdr;
+  bool operator==(Key const& rhs) const {
+    return same(car, rhs.car) && same(cdr, rhs.cdr);
+  }
+};
+struct KeyHash {
+  std::size_t operator()(Key const& k) const {
+    return std::hash<Value>{}(identity(k.car) * 0x9E3779B97F4A7C15ULL ^ identity(k.cdr));
+  }
+};
+using Table = std::unordered_map<Key, Value, KeyHash>;
+
+Table table;
+HashConsStats stats{};
+
+// collectの後に、生き残ったcellだけで表を作り直す。carやcdrも引越ししているのでkeyも作り直す。
+bool const registered = (add_weak_roots([](WeakVisitor const& survive) {
+  Table live;
+  live.reserve(table.size());
+  for(auto [key, cons]: table) {
+    if(survive(cons)) live.emplace(Key{car(cons), cdr(cons)}, cons);
+  }
+  table = std::move(live);
+  stats.table_size = table.size();
+  // unordered_mapのnodeは次へのポインタとhash値も持つ
+  stats.table_bytes = table.bucket_count() * sizeof(void*) + table.size() * (sizeof(Table::value_type) + sizeof(void*) + sizeof(std::size_t));
+}), true);
+
+} // namespace
+
+void set_hash_consing(bool enabled) {
+  hash_consing_enabled = enabled;
+}
+
+Value const* find_hash_consed(Value car, Value cdr) {
+  auto const it = table.find(Key{car, cdr});
+  if(it == end(table)) {
+    ++stats.misses;
+    return nullptr;
+  }
+  ++stats.hits;
+  return &it->second;
+}
+
+void register_hash_consed(Value cons) {
+  if(is_canonical(car(cons)) && is_canonical(cdr(cons))) {
+    table.emplace(Key{car(cons), cdr(cons)}, cons);
+  }
+}
+
+bool is_canonical(Value v) {
+  if(is_atom_bool(v)) return true;
+  if(table.empty()) return false;
+  auto const it = table.find(Key{car(v), cdr(v)});
+  return it != end(table) && it->second == v;
+}
+
+HashConsStats const& hash_cons_stats() {
+  return stats;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstdint>
+
+// hash-consing: 有効にしている間、make_consは同じ(car, cdr)のconsを1つのcellにまとめる。
+// (car, cdr) -> consの表は弱い参照で、collectのたびに死んだcellを消し、引越し先に書き換える。
+// 子もhash-consされている(canonicalな)cellだけを表に入れるので、canonicalなcell同士は
+// 形が同じならポインタも同じになる。equal?はこれを使う。boxしたdoubleはbitの並びが同じなら同じ物として扱う。
+// 共有されるので、hash-consしたcellを書き換えてはいけない(set_carはerrorにする)。
+
+extern bool hash_consing_enabled;
+inline bool hash_consing() { return hash_consing_enabled; }
+void set_hash_consing(bool enabled);
+
+// for impl make_cons
+Value const* find_hash_consed(Value car, Value cdr);
+void register_hash_consed(Value cons);
+
+// atomか、表に入っているcons
+bool is_canonical(Value v);
+
+struct HashConsStats {
+  std::uint64_t hits; // 既にあるcellを返した回数
+  std::uint64_t misses;
+  std::uint64_t table_size; // 最後のcollectの後に残っていた数
+  std::uint64_t table_bytes; // その時の表の大きさ(だいたい)
+};
+HashConsStats const& hash_cons_stats();
@@ -0,0 +1,583 @@
+#include "jit.hpp"
+#include "prelude.hpp"
+#include "allocator.hpp"
+#include "macro.hpp"
+
+#include <array>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define LILITH_JIT 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define LILITH_JIT 0
+#endif
+
+namespace {
+
+std::uint32_t threshold = 100;
+JitStats stats{};
+
+} // namespace
+
+void set_jit_threshold(std::uint32_t calls) {
+  threshold = calls;
+}
+std::uint32_t jit_threshold() {
+  return threshold;
+}
+JitStats const& jit_stats() {
+  return stats;
+}
+
+#if LILITH_JIT
+
+using NativeFn = Value (*)(Value const* args);
+
+struct JitCode {
+  NativeFn fn;
+  std::uint64_t epoch; // このcodeが前提にしているトップレベルの定義
+  std::size_t len; // arenaの中で使っているbyte数(pageの倍数)
+  std::deque<Value> constants; // quoteされたconsなど、GCで動くかもしれない定数の置き場所。native codeはここから読む
+};
+
+namespace {
+
+JitCode rejected{nullptr, 0, 0, {}}; // 対象外だったclosureの印
+
+// slotを32bitに縮めている時は、car/cdrは展開せずにprimitiveを呼ぶ。
+#ifdef LILITH_COMPRESSED_REFS
+constexpr bool compressed_refs = true;
+#else
+constexpr bool compressed_refs = false;
+#endif
+
+// helperが例外を受け取ったらpendingにしまってこれを返す。native codeはそのまま抜けて、jit_applyが投げ直す。
+// (native codeのframeにはunwind情報が無いので、C++の例外に通らせない)
+// 下位3bitはshort symbolと同じ011だが、short symbolの下位1byteは0b11だけなので普通の値とは被らない。
+// (0b110は0.0になった。value.hppのmake_float)
+Value const bailout = 0b1011;
+std::exception_ptr pending;
+
+// 今あるnative code。定数はclosureが死ぬまでrootにしておく。
+std::unordered_set<JitCode*> codes;
+// 作り直して使わなくなったcode。まだstackの上で走っているかもしれないので、collectの前(トップレベル)まで待って解放する。
+std::vector<JitCode*> retired;
+bool const constants_are_roots = (add_roots([](RootVisitor const& visit) {
+  for(JitCode* c: codes) {
+    for(auto& v: c->constants) visit(v);
+  }
+}), true);
+
+Value helper_global(Value name) {
+  try {
+    return find(name, nil());
+  } catch(...) {
+    pending = std::current_exception();
+    return bailout;
+  }
+}
+Value helper_apply(Value f, Value const* args, std::size_t n) {
+  try {
+    return apply(f, args, n);
+  } catch(...) {
+    pending = std::current_exception();
+    return bailout;
+  }
+}
+Value helper_prim1(Value prim, Value arg) {
+  return helper_apply(prim, &arg, 1);
+}
+Value helper_cons(Value car, Value cdr) {
+  try {
+    return make_cons(car, cdr);
+  } catch(...) {
+    pending = std::current_exception();
+    return bailout;
+  }
+}
+
+// ---- stencil ----
+// 機械語の断片と、後から埋める穴の位置。穴の値はemitの時に渡す(Rel32にはlabelを渡す)。
+
+enum class Hole : std::uint8_t {
+  Imm32,
+  Imm64,
+  Rel32,
+};
+struct Patch {
+  std::uint8_t offset;
+  Hole kind;
+};
+template<std::size_t N, std::size_t H>
+struct Stencil {
+  std::array<std::uint8_t, N> code;
+  std::array<Patch, H> holes;
+};
+
+// push rbp; mov rbp, rsp; push rbx; sub rsp, imm32
+constexpr Stencil<12, 1> prologue{{0x55, 0x48, 0x89, 0xE5, 0x53, 0x48, 0x81, 0xEC, 0, 0, 0, 0}, {{{8, Hole::Imm32}}}};
+// mov rax, [rdi + imm32]; mov [rsp + imm32], rax
+constexpr Stencil<15, 2> copy_arg{{0x48, 0x8B, 0x87, 0, 0, 0, 0, 0x48, 0x89, 0x84, 0x24, 0, 0, 0, 0}, {{{3, Hole::Imm32}, {11, Hole::Imm32}}}};
+// mov rbx, rsp
+constexpr Stencil<3, 0> set_frame{{0x48, 0x89, 0xE3}, {}};
+// mov rbx, [rbp - 8]; leave; ret
+constexpr Stencil<6, 0> epilogue{{0x48, 0x8B, 0x5D, 0xF8, 0xC9, 0xC3}, {}};
+// mov rax, [rbx + imm32]
+constexpr Stencil<7, 1> load_arg{{0x48, 0x8B, 0x83, 0, 0, 0, 0}, {{{3, Hole::Imm32}}}};
+// mov rax, imm64
+constexpr Stencil<10, 1> load_const{{0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0}, {{{2, Hole::Imm64}}}};
+// mov rax, [imm64]
+constexpr Stencil<10, 1> load_slot{{0x48, 0xA1, 0, 0, 0, 0, 0, 0, 0, 0}, {{{2, Hole::Imm64}}}};
+// test rax, rax; jz rel32
+constexpr Stencil<9, 1> jump_if_nil{{0x48, 0x85, 0xC0, 0x0F, 0x84, 0, 0, 0, 0}, {{{5, Hole::Rel32}}}};
+// jmp rel32
+constexpr Stencil<5, 1> jump{{0xE9, 0, 0, 0, 0}, {{{1, Hole::Rel32}}}};
+// push rax
+constexpr Stencil<1, 0> push_value{{0x50}, {}};
+// pop rcx; cmp rax, rcx; mov rax, imm64(#t); mov edx, 0(nil); cmovne rax, rdx
+constexpr Stencil<23, 1> eq_values{{0x59, 0x48, 0x39, 0xC8, 0x48, 0xB8, 0, 0, 0, 0, 0, 0, 0, 0, 0xBA, 0, 0, 0, 0, 0x48, 0x0F, 0x45, 0xC2}, {{{6, Hole::Imm64}}}};
+// mov rcx, rax; and ecx, 3; cmp ecx, 1; jne rel32(fixnumでない)
+constexpr Stencil<15, 1> guard_fixnum{{0x48, 0x89, 0xC1, 0x83, 0xE1, 0x03, 0x83, 0xF9, 0x01, 0x0F, 0x85, 0, 0, 0, 0}, {{{11, Hole::Rel32}}}};
+// tagを付けたまま足し引きする。溢れたらraxをそのままにしてslow。mov rcx, rax; add rcx, 4; jo rel32; mov rax, rcx
+constexpr Stencil<16, 1> succ_fixnum{{0x48, 0x89, 0xC1, 0x48, 0x83, 0xC1, 0x04, 0x0F, 0x80, 0, 0, 0, 0, 0x48, 0x89, 0xC8}, {{{9, Hole::Rel32}}}};
+// mov rcx, rax; sub rcx, 4; jo rel32; mov rax, rcx
+constexpr Stencil<16, 1> pred_fixnum{{0x48, 0x89, 0xC1, 0x48, 0x83, 0xE9, 0x04, 0x0F, 0x80, 0, 0, 0, 0, 0x48, 0x89, 0xC8}, {{{9, Hole::Rel32}}}};
+// test al, 7; jnz rel32(consでない); test rax, rax; jz rel32(nil)
+constexpr Stencil<17, 2> guard_cons{{0xA8, 0x07, 0x0F, 0x85, 0, 0, 0, 0, 0x48, 0x85, 0xC0, 0x0F, 0x84, 0, 0, 0, 0}, {{{4, Hole::Rel32}, {13, Hole::Rel32}}}};
+// mov rax, [rax]
+constexpr Stencil<3, 0> load_car{{0x48, 0x8B, 0x00}, {}};
+// raxのconsのcdr-code(allocator.hppのcdr_code)をedxに。rcx, r8も使う。
+// mov rdx, rax; shr rdx, 3; mov ecx, edx; and ecx, 3; add ecx, ecx; and edx, slots-1; shr edx, 2;
+// mov r8, rax; and r8, -page_bytes; movzx edx, byte [r8 + rdx]; shr edx, cl; and edx, 3
+constexpr Stencil<43, 0> load_cdr_code{{0x48, 0x89, 0xC2, 0x48, 0xC1, 0xEA, 0x03, 0x89, 0xD1, 0x83, 0xE1, 0x03, 0x01, 0xC9,
+  0x81, 0xE2, 0xFF, 0x1F, 0x00, 0x00, 0xC1, 0xEA, 0x02, 0x49, 0x89, 0xC0, 0x49, 0x81, 0xE0, 0x00, 0x00, 0xFF, 0xFF,
+  0x41, 0x0F, 0xB6, 0x14, 0x10, 0xD3, 0xEA, 0x83, 0xE2, 0x03}, {}};
+// Normalなら次のslot、Nextなら次のslotのアドレス、Nilならnil。Splitはslowへ。
+// test edx, edx; jnz +6; mov rax, [rax + 8]; jmp +22; cmp edx, 3; je rel32;
+// lea rcx, [rax + 8]; xor eax, eax; cmp edx, 1; cmove rax, rcx
+constexpr Stencil<32, 1> load_cdr{{0x85, 0xD2, 0x75, 0x06, 0x48, 0x8B, 0x40, 0x08, 0xEB, 0x16, 0x83, 0xFA, 0x03, 0x0F, 0x84, 0, 0, 0, 0,
+  0x48, 0x8D, 0x48, 0x08, 0x31, 0xC0, 0x83, 0xFA, 0x01, 0x48, 0x0F, 0x44, 0xC1}, {{{15, Hole::Rel32}}}};
+// test al, 3; jnz rel32(atom); test rax, rax; jz rel32(nilもatom)
+constexpr Stencil<17, 2> test_atom{{0xA8, 0x03, 0x0F, 0x85, 0, 0, 0, 0, 0x48, 0x85, 0xC0, 0x0F, 0x84, 0, 0, 0, 0}, {{{4, Hole::Rel32}, {13, Hole::Rel32}}}};
+// xor eax, eax
+constexpr Stencil<2, 0> load_nil{{0x31, 0xC0}, {}};
+// mov rsi, rax; mov rdi, imm64
+constexpr Stencil<13, 1> prim1_args{{0x48, 0x89, 0xC6, 0x48, 0xBF, 0, 0, 0, 0, 0, 0, 0, 0}, {{{5, Hole::Imm64}}}};
+// mov rdi, imm64
+constexpr Stencil<10, 1> set_arg0{{0x48, 0xBF, 0, 0, 0, 0, 0, 0, 0, 0}, {{{2, Hole::Imm64}}}};
+// mov rsi, rax; pop rdi
+constexpr Stencil<4, 0> pair_args{{0x48, 0x89, 0xC6, 0x5F}, {}};
+// mov rdi, [rsp]; lea rsi, [rsp + 8]; mov edx, imm32
+constexpr Stencil<14, 1> apply_args{{0x48, 0x8B, 0x3C, 0x24, 0x48, 0x8D, 0x74, 0x24, 0x08, 0xBA, 0, 0, 0, 0}, {{{10, Hole::Imm32}}}};
+// mov r11, imm64; call r11
+constexpr Stencil<13, 1> call_abs{{0x49, 0xBB, 0, 0, 0, 0, 0, 0, 0, 0, 0x41, 0xFF, 0xD3}, {{{2, Hole::Imm64}}}};
+// cmp rax, 11(bailout); je rel32
+constexpr Stencil<10, 1> check_bailout{{0x48, 0x83, 0xF8, 0x0B, 0x0F, 0x84, 0, 0, 0, 0}, {{{6, Hole::Rel32}}}};
+// sub rsp, imm32
+constexpr Stencil<7, 1> reserve{{0x48, 0x81, 0xEC, 0, 0, 0, 0}, {{{3, Hole::Imm32}}}};
+// add rsp, imm32
+constexpr Stencil<7, 1> release{{0x48, 0x81, 0xC4, 0, 0, 0, 0}, {{{3, Hole::Imm32}}}};
+// mov [rsp + imm32], rax
+constexpr Stencil<8, 1> store_slot{{0x48, 0x89, 0x84, 0x24, 0, 0, 0, 0}, {{{4, Hole::Imm32}}}};
+
+static_assert(bailout == 11, "check_bailout compares with 11");
+static_assert(cons_page_bytes == 0x10000, "load_cdr_code masks with 64KiB pages");
+static_assert(static_cast<int>(CdrCode::Normal) == 0 && static_cast<int>(CdrCode::Next) == 1 && static_cast<int>(CdrCode::Split) == 3, "load_cdr");
+
+class Emitter {
+  std::vector<std::uint8_t> code;
+  std::vector<std::size_t> labels; // bindされた位置
+  std::vector<std::pair<std::size_t, int>> fixups; // (rel32の位置, label)
+
+  void write(std::size_t at, std::uint64_t v, std::size_t bytes) {
+    std::memcpy(code.data() + at, &v, bytes); // x86-64はlittle endian
+  }
+public:
+  int label() {
+    labels.push_back(SIZE_MAX);
+    return static_cast<int>(labels.size() - 1);
+  }
+  void bind(int l) {
+    labels[l] = code.size();
+  }
+  template<std::size_t N, std::size_t H>
+  void emit(Stencil<N, H> const& s, std::array<std::uint64_t, H> const& args = {}) {
+    std::size_t const base = code.size();
+    code.insert(end(code), begin(s.code), end(s.code));
+    for(std::size_t i{}; i < H; ++i) {
+      std::size_t const at = base + s.holes[i].offset;
+      switch(s.holes[i].kind) {
+      case Hole::Imm32:
+        write(at, args[i], 4);
+        break;
+      case Hole::Imm64:
+        write(at, args[i], 8);
+        break;
+      case Hole::Rel32:
+        fixups.emplace_back(at, static_cast<int>(args[i]));
+        break;
+      }
+    }
+  }
+  std::vector<std::uint8_t> finish() {
+    for(auto [at, l]: fixups) {
+      std::int64_t const rel = static_cast<std::int64_t>(labels[l]) - static_cast<std::int64_t>(at + 4);
+      write(at, static_cast<std::uint32_t>(static_cast<std::int32_t>(rel)), 4);
+    }
+    return std::move(code);
+  }
+};
+
+// 書き終わったpageから実行専用にしていく(W^X)。実行中のpageに書き込むことはない。
+// 解放されたpageは物理memoryを返して空きにしておき、次のinstallで書き込めるようにして使い直す。
+class CodeArena {
+  std::uint8_t* chunk = nullptr;
+  std::size_t used = 0;
+  std::size_t size = 0;
+  std::map<std::uint8_t*, std::size_t> free_ranges; // 先頭 -> byte数。隣り合うものはまとめておく
+
+  std::uint8_t* take_free(std::size_t len) {
+    for(auto it = begin(free_ranges); it != end(free_ranges); ++it) {
+      if(it->second < len) continue;
+      auto const [p, n] = *it;
+      free_ranges.erase(it);
+      if(n > len) free_ranges.emplace(p + len, n - len);
+      return p;
+    }
+    return nullptr;
+  }
+public:
+  NativeFn install(std::vector<std::uint8_t> const& code, std::size_t& len) {
+    std::size_t const page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    len = (code.size() + page - 1) / page * page;
+    std::uint8_t* dest = take_free(len);
+    if(dest == nullptr) {
+      if(chunk == nullptr || used + len > size) {
+        size = std::max(len, page * 256);
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(p == MAP_FAILED) return nullptr;
+        chunk = static_cast<std::uint8_t*>(p);
+        used = 0;
+      }
+      dest = chunk + used;
+      used += len;
+    } else if(mprotect(dest, len, PROT_READ | PROT_WRITE) != 0) {
+      return nullptr;
+    }
+    std::memcpy(dest, code.data(), code.size());
+    if(mprotect(dest, len, PROT_READ | PROT_EXEC) != 0) return nullptr;
+    stats.code_bytes += code.size();
+    return reinterpret_cast<NativeFn>(dest);
+  }
+  void release(NativeFn fn, std::size_t len) {
+    auto p = reinterpret_cast<std::uint8_t*>(fn);
+    madvise(p, len, MADV_DONTNEED);
+    stats.released_bytes += len;
+    auto next = free_ranges.lower_bound(p);
+    if(next != end(free_ranges) && p + len == next->first) {
+      len += next->second;
+      next = free_ranges.erase(next);
+    }
+    if(next != begin(free_ranges)) {
+      auto const prev = std::prev(next);
+      if(prev->first + prev->second == p) {
+        prev->second += len;
+        return;
+      }
+    }
+    free_ranges.emplace(p, len);
+  }
+} arena;
+
+void release_code(JitCode* code) {
+  if(code == nullptr || code == &rejected) return;
+  codes.erase(code);
+  arena.release(code->fn, code->len);
+  delete code;
+}
+
+// GCはトップレベルでしか走らないので、ここではどのnative codeも走っていない。
+bool const closure_finalizer = (set_finalizer(ObjectKind::Closure, [](Object* obj) {
+  release_code(reinterpret_cast<Closure*>(obj)->jit);
+}), true);
+bool const release_retired = (add_before_collect([] {
+  for(JitCode* code: retired) release_code(code);
+  retired.clear();
+}), true);
+
+std::uint64_t address(auto* p) {
+  return reinterpret_cast<std::uint64_t>(p);
+}
+
+class Compiler {
+  Emitter e;
+  std::deque<Value>& constants; // 作っているJitCodeのもの
+  Value params;
+  std::int64_t depth; // prologueの後に積んだ8byteの数。helperを呼ぶ前に16byte境界にそろえる。
+  int bail;
+
+  bool is_tagged(Value v, char const* tag) {
+    return !is_atom_bool(v) && car(v) == make_symbol(tag);
+  }
+  std::int64_t param_index(Value name) {
+    std::int64_t i{};
+    for(Value p = params; p != nil(); p = cdr(p), ++i) {
+      if(car(p) == name) return i;
+    }
+    return -1;
+  }
+  std::int64_t length(Value list) {
+    std::int64_t n{};
+    for(; !is_atom_bool(list); list = cdr(list)) ++n;
+    return list == nil() ? n : -1;
+  }
+  // 今のトップレベルの定義。無ければnil(実行時にhelperで探してerrorにする)。
+  Value global_value(Value name, bool& bound) {
+    try {
+      bound = true;
+      return find(name, nil());
+    } catch(char const*) {
+      bound = false;
+      return nil();
+    }
+  }
+
+  void call_helper(std::uint64_t fn) {
+    bool const pad = depth % 2 != 0;
+    if(pad) e.emit(reserve, {8});
+    e.emit(call_abs, {fn});
+    if(pad) e.emit(release, {8});
+    e.emit(check_bailout, {static_cast<std::uint64_t>(bail)});
+  }
+  void constant(Value v) {
+    if(!is_atom_bool(v)) { // consはGCで動くので、rootにしてある置き場所から読む
+      constants.push_back(v);
+      e.emit(load_slot, {address(&constants.back())});
+      return;
+    }
+    e.emit(load_const, {v});
+  }
+  void slow_path(Value prim, int slow, int done) {
+    e.emit(jump, {static_cast<std::uint64_t>(done)});
+    e.bind(slow);
+    e.emit(prim1_args, {prim});
+    call_helper(address(helper_prim1));
+    e.bind(done);
+  }
+
+  bool variable(Value name) {
+    std::int64_t const i = param_index(name);
+    if(i >= 0) {
+      e.emit(load_arg, {static_cast<std::uint64_t>(8 * i)});
+      return true;
+    }
+    bool bound;
+    Value const v = global_value(name, bound);
+    if(bound && is_atom_bool(v)) { // 上書きされたらepochが変わってcompileし直す
+      constant(v);
+      return true;
+    }
+    e.emit(set_arg0, {name});
+    call_helper(address(helper_global));
+    return true;
+  }
+
+  bool branch(Value v) {
+    if(length(v) != 4) return false;
+    int const alter = e.label();
+    int const done = e.label();
+    if(!expr(car(cdr(v)))) return false;
+    e.emit(jump_if_nil, {static_cast<std::uint64_t>(alter)});
+    if(!expr(car(cdr(cdr(v))))) return false;
+    e.emit(jump, {static_cast<std::uint64_t>(done)});
+    e.bind(alter);
+    if(!expr(car(cdr(cdr(cdr(v)))))) return false;
+    e.bind(done);
+    return true;
+  }
+
+  // car/cdr/succ/pred/eq/atom/consならその場に展開する。
+  bool inline_primitive(Value prim, Value operands, bool& done) {
+    done = false;
+    PrimitiveFn const fn = to_primitive(prim)->fn;
+    std::int64_t const n = length(operands);
+    if(n != to_primitive(prim)->arity) return true; // 引数の数のerrorは普通の呼び出しに任せる
+    int const slow = e.label();
+    int const end = e.label();
+    if(fn == primitive_succ || fn == primitive_pred) {
+      if(!expr(car(operands))) return false;
+      e.emit(guard_fixnum, {static_cast<std::uint64_t>(slow)});
+      e.emit(fn == primitive_succ ? succ_fixnum : pred_fixnum, {static_cast<std::uint64_t>(slow)});
+      slow_path(prim, slow, end);
+    } else if((fn == primitive_car || fn == primitive_cdr) && !compressed_refs) {
+      if(!expr(car(operands))) return false;
+      e.emit(guard_cons, {static_cast<std::uint64_t>(slow), static_cast<std::uint64_t>(slow)});
+      if(fn == primitive_car) {
+        e.emit(load_car);
+      } else {
+        e.emit(load_cdr_code);
+        e.emit(load_cdr, {static_cast<std::uint64_t>(slow)});
+      }
+      slow_path(prim, slow, end);
+    } else if(fn == primitive_atom) {
+      if(!expr(car(operands))) return false;
+      e.emit(test_atom, {static_cast<std::uint64_t>(slow), static_cast<std::uint64_t>(slow)});
+      e.emit(load_nil);
+      e.emit(jump, {static_cast<std::uint64_t>(end)});
+      e.bind(slow);
+      e.emit(load_const, {t()});
+      e.bind(end);
+    } else if(fn == primitive_eq || fn == primitive_cons) {
+      if(!expr(car(operands))) return false;
+      e.emit(push_value);
+      ++depth;
+      if(!expr(car(cdr(operands)))) return false;
+      --depth;
+      if(fn == primitive_eq) {
+        e.emit(eq_values, {t()}); // symbolはinternしてあるので、eqはbitの比較だけ
+      } else {
+        e.emit(pair_args);
+        call_helper(address(helper_cons));
+      }
+    } else {
+      return true;
+    }
+    done = true;
+    return true;
+  }
+
+  bool application(Value v) {
+    Value const op = car(v);
+    Value const operands = cdr(v);
+    std::int64_t const n = length(operands);
+    if(n < 0) return false;
+    if(is_symbol(op) && param_index(op) < 0) {
+      bool bound;
+      Value const f = global_value(op, bound);
+      if(bound && is_macro(f)) { // 展開したものをcompileする。展開はformに覚えておく
+        if(!macro_caching()) return false;
+        try {
+          return expr(expand_macro(v, f));
+        } catch(char const*) {
+          return false;
+        }
+      }
+      if(bound && is_primitive(f)) {
+        bool done;
+        if(!inline_primitive(f, operands, done)) return false;
+        if(done) return true;
+      }
+    }
+    // 関数と引数を積んだ領域を作ってhelper経由でapplyする。
+    std::int64_t slots = n + 1;
+    if((depth + slots) % 2 != 0) ++slots;
+    e.emit(reserve, {static_cast<std::uint64_t>(8 * slots)});
+    depth += slots;
+    if(!expr(op)) return false;
+    e.emit(store_slot, {0});
+    std::int64_t i = 1;
+    for(Value o = operands; o != nil(); o = cdr(o), ++i) {
+      if(!expr(car(o))) return false;
+      e.emit(store_slot, {static_cast<std::uint64_t>(8 * i)});
+    }
+    e.emit(apply_args, {static_cast<std::uint64_t>(n)});
+    call_helper(address(helper_apply));
+    e.emit(release, {static_cast<std::uint64_t>(8 * slots)});
+    depth -= slots;
+    return true;
+  }
+
+  bool expr(Value v) {
+    if(is_self_eval(v)) {
+      e.emit(load_const, {v});
+      return true;
+    }
+    if(is_symbol(v)) return variable(v);
+    if(is_atom_bool(v)) return false;
+    if(is_expansion(car(v))) return expr(current_expansion(v, nil()));
+    if(is_tagged(v, "quote")) {
+      constant(car(cdr(v)));
+      return true;
+    }
+    if(is_tagged(v, "if")) return branch(v);
+    if(is_tagged(v, "define") || is_tagged(v, "lambda") || is_tagged(v, "future") || is_tagged(v, "delay") || is_tagged(v, "defmacro")) return false; // frameが要る
+    return application(v);
+  }
+
+public:
+  explicit Compiler(std::deque<Value>& constants) : e{}, constants{constants}, params{nil()}, depth{}, bail{} {}
+
+  NativeFn function(Value f, std::size_t& len) {
+    if(closure_env(f) != nil() || closure_arity(f) < 0) return nullptr;
+    params = closure_params(f);
+    std::int64_t const n = closure_arity(f);
+    std::int64_t const slots = n | 1; // push rbxと合わせて16byte境界になるように奇数個
+    e.emit(prologue, {static_cast<std::uint64_t>(8 * slots)});
+    for(std::int64_t i{}; i < n; ++i) { // 呼び出し元の引数の並びは後で動くかもしれないので、手元に写しておく
+      e.emit(copy_arg, {static_cast<std::uint64_t>(8 * i), static_cast<std::uint64_t>(8 * i)});
+    }
+    e.emit(set_frame);
+    bail = e.label();
+    Value body = closure_body(f);
+    if(body == nil()) return nullptr;
+    for(; body != nil(); body = cdr(body)) {
+      if(!expr(car(body))) return nullptr;
+    }
+    e.bind(bail);
+    e.emit(epilogue);
+    return arena.install(e.finish(), len);
+  }
+};
+
+JitCode* compile(Value f) {
+  auto code = std::make_unique<JitCode>(JitCode{nullptr, global_epoch(), 0, {}});
+  code->fn = Compiler{code->constants}.function(f, code->len);
+  if(code->fn == nullptr) {
+    ++stats.rejected;
+    return &rejected;
+  }
+  ++stats.compiled;
+  codes.insert(code.get());
+  return code.release();
+}
+
+} // namespace
+
+bool jit_apply(Value f, Value const* args, std::size_t n, Value& result) {
+  if(threshold == 0) return false;
+  Closure* c = reinterpret_cast<Closure*>(to_object(f));
+  if(c->jit == nullptr) {
+    if(++c->calls < threshold) return false;
+    c->jit = compile(f);
+  } else if(c->jit != &rejected && c->jit->epoch != global_epoch()) {
+    retired.push_back(c->jit);
+    c->jit = compile(f);
+  }
+  if(c->jit == &rejected) return false;
+  if(static_cast<std::int64_t>(n) != c->arity) return false; // errorはinterpreterに任せる
+  ++stats.native_calls;
+  Value const res = c->jit->fn(args);
+  if(res == bailout) {
+    std::exception_ptr e = pending;
+    pending = nullptr;
+    std::rethrow_exception(e);
+  }
+  result = res;
+  return true;
+}
+
+#else
+
+bool jit_apply(Value, Value const*, std::size_t, Value&) {
+  return false;
+}
+
+#endif
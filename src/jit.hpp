@@ -0,0 +1,27 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstdint>
+
+// 何度も呼ばれたclosureをx86-64のnative codeにするJIT(Linuxのみ)。
+// 機械語の断片(stencil)を並べて、即値や飛び先の穴を埋めていくcopy-and-patch方式。
+// トップレベルで定義された、本体が変数・定数・if・関数呼び出しだけのclosureが対象で、
+// car/cdr/succ/pred/eq/atomはその場に展開する。型が合わない時はinterpreterのprimitiveを呼ぶ。
+
+// この回数呼ばれたらJITする。0ならJITしない。
+void set_jit_threshold(std::uint32_t calls);
+std::uint32_t jit_threshold();
+
+// applyから呼ぶ。fのnative codeがあれば(なければ必要に応じて作って)実行してresultに入れ、trueを返す。
+// falseならinterpreterで実行すること。
+bool jit_apply(Value f, Value const* args, std::size_t n, Value& result);
+
+struct JitStats {
+  std::uint64_t compiled; // native codeにできたclosure
+  std::uint64_t rejected; // 対象外だったclosure
+  std::uint64_t native_calls;
+  std::uint64_t code_bytes;
+  std::uint64_t released_bytes; // closureが死んだか作り直した時に返したpage
+};
+JitStats const& jit_stats();
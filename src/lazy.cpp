@@ -0,0 +1,212 @@
+#include "lazy.hpp"
+#include "allocator.hpp"
+#include "prelude.hpp"
+#include "escape.hpp"
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Promise {
+  Object header;
+  Value thunk; // forceしたらnilにして、closureの環境を手放す
+  Value value;
+  bool forced;
+};
+
+Promise* to_promise(Value v) {
+  if(!is_object(v) || to_object(v)->kind != ObjectKind::Promise) return nullptr;
+  return reinterpret_cast<Promise*>(to_object(v));
+}
+
+// generatorの本体。co_yieldで止まる時の値はGenerator::valueに置いてあって、coroutineは何も持たない。
+struct Body {
+  struct promise_type {
+    std::exception_ptr error;
+    Body get_return_object() { return Body{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_always final_suspend() noexcept { return {}; }
+    std::suspend_always yield_value(bool) noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+  std::coroutine_handle<promise_type> handle;
+};
+
+struct Generator {
+  Object header;
+  Value value; // 最後に作った値
+  Value source; // 元のgeneratorかlist
+  Value f;
+  Value state; // takeの残りの数、unfoldの次の種
+  std::coroutine_handle<Body::promise_type> body;
+  bool running;
+};
+
+Generator* to_generator(Value v) {
+  if(!is_object(v) || to_object(v)->kind != ObjectKind::Generator) throw "not a generator";
+  return reinterpret_cast<Generator*>(to_object(v));
+}
+
+bool is_generator(Value v) {
+  return is_object(v) && to_object(v)->kind == ObjectKind::Generator;
+}
+
+// 次の値をoutに入れる。終わっていればfalse。本体で投げられたerrorはここで投げ直す。
+bool next(Generator* g, Value& out) {
+  if(g->body.done()) return false;
+  if(g->running) throw "generator is already running";
+  EscapeBarrier barrier; // coroutineの中からは、longjmpで飛び出さない
+  g->running = true;
+  g->body.resume();
+  g->running = false;
+  if(std::exception_ptr const error = std::exchange(g->body.promise().error, nullptr)) std::rethrow_exception(error);
+  if(g->body.done()) return false;
+  out = g->value;
+  return true;
+}
+
+Body unfold_body(Generator* self) {
+  while(true) {
+    self->value = self->state;
+    co_yield true;
+    Value const seed = self->state;
+    self->state = apply(self->f, &seed, 1);
+  }
+}
+
+Body list_body(Generator* self) {
+  while(!is_atom_bool(self->state)) {
+    self->value = car(self->state);
+    self->state = cdr(self->state);
+    co_yield true;
+  }
+}
+
+Body map_body(Generator* self) {
+  Value v;
+  while(next(to_generator(self->source), v)) {
+    self->value = apply(self->f, &v, 1);
+    co_yield true;
+  }
+}
+
+Body filter_body(Generator* self) {
+  Value v;
+  while(next(to_generator(self->source), v)) {
+    if(apply(self->f, &v, 1) == nil()) continue;
+    self->value = v;
+    co_yield true;
+  }
+}
+
+Body take_body(Generator* self) {
+  Value v;
+  // 数えきったら元のgeneratorからはもう取らない(無限のものでも止まる)
+  while(to_int(self->state) > 0 && next(to_generator(self->source), v)) {
+    self->state = pred(self->state);
+    self->value = v;
+    co_yield true;
+  }
+}
+
+Value make_generator(Body (*body)(Generator*), Value source, Value f, Value state) {
+  auto const g = reinterpret_cast<Generator*>(alloc_object(sizeof(Generator)));
+  g->header = Object{ObjectKind::Generator, false, 4};
+  g->value = nil();
+  g->source = source;
+  g->f = f;
+  g->state = state;
+  g->running = false;
+  g->body = body(g).handle;
+  return to_Value(&g->header, nullptr);
+}
+
+bool const finalizer_registered = (set_finalizer(ObjectKind::Generator, [](Object* obj) {
+  reinterpret_cast<Generator*>(obj)->body.destroy();
+}), true);
+
+Value primitive_force(Value const* args, std::size_t) { return force(args[0]); }
+Value primitive_promise_p(Value const* args, std::size_t) { return from_bool(to_promise(args[0]) != nullptr); }
+Value primitive_generator_p(Value const* args, std::size_t) { return from_bool(is_generator(args[0])); }
+Value primitive_gen_unfold(Value const* args, std::size_t) {
+  return make_generator(unfold_body, nil(), args[0], args[1]);
+}
+Value primitive_list_to_gen(Value const* args, std::size_t) {
+  return make_generator(list_body, nil(), nil(), args[0]);
+}
+Value primitive_gen_map(Value const* args, std::size_t) {
+  to_generator(args[1]);
+  return make_generator(map_body, args[1], args[0], nil());
+}
+Value primitive_gen_filter(Value const* args, std::size_t) {
+  to_generator(args[1]);
+  return make_generator(filter_body, args[1], args[0], nil());
+}
+Value primitive_gen_take(Value const* args, std::size_t) {
+  if(!is_integer(args[0])) throw "gen-take: count must be a fixnum";
+  to_generator(args[1]);
+  return make_generator(take_body, args[1], nil(), args[0]);
+}
+Value primitive_gen_next(Value const* args, std::size_t) { return next_value(args[0], args[1]); }
+Value primitive_gen_fold(Value const* args, std::size_t) {
+  Value const f = args[0]; // argsはarg_stackを指しているかもしれないので、applyの前に読んでおく
+  Generator* const g = to_generator(args[2]);
+  Value call[2] = {args[1], nil()};
+  while(next(g, call[1])) call[0] = apply(f, call, 2);
+  return call[0];
+}
+Value primitive_gen_to_list(Value const* args, std::size_t) {
+  Generator* const g = to_generator(args[0]);
+  std::vector<Value> items; // 途中でcollectはしないので、ここに置いておいても動かない
+  EscapeBarrier barrier;
+  for(Value v; next(g, v);) items.push_back(v);
+  return make_list(items.data(), items.size());
+}
+
+} // namespace
+
+Value make_promise(Value thunk) {
+  auto const p = reinterpret_cast<Promise*>(alloc_object(sizeof(Promise)));
+  p->header = Object{ObjectKind::Promise, false, 2};
+  p->thunk = thunk;
+  p->value = nil();
+  p->forced = false;
+  return to_Value(&p->header, nullptr);
+}
+
+Value force(Value v) {
+  Promise* const p = to_promise(v);
+  if(p == nullptr) return v;
+  if(p->forced) return p->value;
+  Value const res = apply(p->thunk, nullptr, 0);
+  if(!p->forced) { // thunkの中で同じpromiseがforceされていたら、先に決まった方を使う
+    p->value = res;
+    p->forced = true;
+    p->thunk = nil();
+  }
+  return p->value;
+}
+
+Value next_value(Value g, Value default_value) {
+  Value v;
+  return next(to_generator(g), v) ? v : default_value;
+}
+
+Value define_lazy_primitives(Value env) {
+  env = define_primitive("force", 1, primitive_force, env);
+  env = define_primitive("promise?", 1, primitive_promise_p, env);
+  env = define_primitive("generator?", 1, primitive_generator_p, env);
+  env = define_primitive("gen-unfold", 2, primitive_gen_unfold, env);
+  env = define_primitive("list->gen", 1, primitive_list_to_gen, env);
+  env = define_primitive("gen-map", 2, primitive_gen_map, env);
+  env = define_primitive("gen-filter", 2, primitive_gen_filter, env);
+  env = define_primitive("gen-take", 2, primitive_gen_take, env);
+  env = define_primitive("gen-next", 2, primitive_gen_next, env);
+  env = define_primitive("gen-fold", 3, primitive_gen_fold, env);
+  env = define_primitive("gen->list", 1, primitive_gen_to_list, env);
+  return env;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "value.hpp"
+
+// `(delay exp)` はexpを評価せずにpromiseを返す。`(force p)` は最初の1回だけ評価して値を覚えておく(promiseでなければそのまま)。
+// evalの `(delay exp)`。thunkは `(lambda () exp)` のclosure。
+Value make_promise(Value thunk);
+Value force(Value v);
+
+// generatorは値を1つずつ作るC++20のcoroutineで、listを作らずにmap/filter/takeを繋げる。
+//   (gen-unfold f seed)  seed, (f seed), (f (f seed)), ... と無限に
+//   (list->gen list)     listの要素を順に
+//   (gen-map f g) (gen-filter p g) (gen-take n g)
+//   (gen-next g default) 次の値。終わっていたらdefault
+//   (gen-fold f init g)  (f (f init x0) x1) ... 最後まで
+//   (gen->list g)
+// coroutineは値を返すたびに止まり、次に呼ばれるまでの間にcollectが走ることがある。なので止まっている間に要る値は
+// generatorのobjectのfieldに置いて、coroutineのframeの変数には持ち越さない。
+Value next_value(Value g, Value default_value);
+
+// `(force p)`, `(promise? x)`, `(generator? x)` とgen-の関数
+Value define_lazy_primitives(Value env);
@@ -1,6 +1,203 @@
 #include "lisp_prelude.hpp"
+#include "allocator.hpp"
 
+#include <array>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#ifndef LILITH_COMPRESSED_REFS
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+constexpr std::array<char const*, 7> sources = {
+  "(define id (lambda (x) x))",
+  "(define + (lambda (x y) (if (eq y 0) x (+ (succ x) (pred y)))))",
+  "(define * (lambda (x y) (if (eq y 0) 0 (+ (* x (pred y)) x))))",
+  "(define list (lambda x x))",
+  "(define null? (lambda (x) (eq nil x)))",
+  "(define not (lambda (x) (if x nil #t)))",
+  "(define length (lambda (x) (if x (succ (length (cdr x))) 0)))",
+};
+
+#ifndef LILITH_COMPRESSED_REFS
+// preludeはcompileの時にconstexprのreaderで読んで、consのページ1枚(allocator.hpp)の形にしてプログラムに埋め込む。
+// 起動した時にはページの中のconsへのポインタと長いsymbolを付け直す(relocate)だけで、readもallocateもしない。
+// ページの番号の所はimmortal_pageなので、collectは中を見ずに飛ばす。付け直した後は読み出し専用にする。
+// 32bitの参照のbuildではページを4GiBの領域の外に置けないので、今まで通り起動時に読む。
+
+constexpr std::size_t page_words = cons_page_bytes / sizeof(Value);
+constexpr std::size_t header_words = cons_page_header / sizeof(Value);
+
+// 埋め込んだ値。Consはページの先頭からのbyte数、Longは長いsymbolの名前の番号で、起動時に本当のValueにする。
+struct Item {
+  enum Kind : std::uint8_t { Plain, Cons, Long } kind;
+  Value v;
+};
+struct Fixup {
+  std::size_t word;
+  Item item;
+};
+struct StaticDefine {
+  Item name;
+  Item lambda;
+};
+
+struct Image {
+  std::array<Value, page_words> words{};
+  std::size_t used = header_words;
+  std::array<Fixup, 512> fixups{};
+  std::size_t fixup_count{};
+  std::array<std::string_view, 64> long_names{};
+  std::size_t long_count{};
+  std::array<StaticDefine, sources.size()> defines{};
+};
+
+constexpr bool is_digit(char c) {
+  return '0' <= c && c <= '9';
+}
+// prelude.cppのreaderと同じ文字
+constexpr bool is_identifier_start(char c) {
+  return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || std::string_view{"*_-+/#?<>="}.find(c) != std::string_view::npos;
+}
+
+class Builder {
+  Image& image;
+  std::string_view src;
+  std::size_t pos;
+
+  constexpr void skip_spaces() {
+    while(pos < src.size() && (src[pos] == ' ' || src[pos] == '\n')) ++pos;
+  }
+  constexpr void store(std::size_t word, Item item) {
+    image.words[word] = item.v;
+    if(item.kind == Item::Plain) return;
+    if(image.fixup_count == image.fixups.size()) throw "static prelude: too many pointers";
+    image.fixups[image.fixup_count++] = Fixup{word, item};
+  }
+  constexpr void set_code(std::size_t slot, CdrCode code) {
+    std::size_t const byte = slot / 4;
+    image.words[byte / 8] |= Value{static_cast<std::uint8_t>(code)} << (byte % 8 * 8 + slot % 4 * 2);
+  }
+  constexpr Item symbol(std::string_view name) {
+    if(name.size() <= 7) { // value.cppのmake_symbolと同じshort string
+      Value res{0b11};
+      for(std::size_t i{}; i < name.size(); ++i) res |= static_cast<Value>(name[i]) << (7 * 8 - i * 8);
+      return Item{Item::Plain, res};
+    }
+    for(std::size_t i{}; i < image.long_count; ++i) {
+      if(image.long_names[i] == name) return Item{Item::Long, i};
+    }
+    if(image.long_count == image.long_names.size()) throw "static prelude: too many long symbols";
+    image.long_names[image.long_count] = name;
+    return Item{Item::Long, image.long_count++};
+  }
+  // '('の後から')'まで。要素は先に読んでおいて、cdr-codedなrunとして並べる。
+  constexpr Item list() {
+    std::array<Item, 32> items{};
+    std::size_t n{};
+    while(true) {
+      skip_spaces();
+      if(pos == src.size()) throw "static prelude: unterminated list";
+      if(src[pos] == ')') break;
+      if(n == items.size()) throw "static prelude: list too long";
+      items[n++] = read();
+    }
+    ++pos;
+    if(n == 0) return Item{Item::Plain, nil()};
+    if(image.used + n > page_words) throw "static prelude: does not fit in a page";
+    std::size_t const start = image.used;
+    image.used += n;
+    for(std::size_t i{}; i < n; ++i) {
+      store(start + i, items[i]);
+      set_code(start + i, i + 1 < n ? CdrCode::Next : CdrCode::Nil);
+    }
+    return Item{Item::Cons, start * sizeof(Value)};
+  }
+public:
+  constexpr Builder(Image& image, std::string_view src) : image{image}, src{src}, pos{} {}
+  constexpr Item read() {
+    skip_spaces();
+    if(pos == src.size()) throw "static prelude: unexpected end";
+    char const c = src[pos];
+    if(c == '(') {
+      ++pos;
+      return list();
+    }
+    if(is_digit(c)) {
+      std::int64_t n{};
+      while(pos < src.size() && is_digit(src[pos])) n = n * 10 + (src[pos++] - '0');
+      return Item{Item::Plain, to_Value(n)};
+    }
+    if(is_identifier_start(c)) {
+      std::size_t const begin = pos;
+      while(pos < src.size() && (is_identifier_start(src[pos]) || is_digit(src[pos]))) ++pos;
+      return symbol(src.substr(begin, pos - begin));
+    }
+    throw "static prelude: unsupported syntax";
+  }
+  // `(define name (lambda ...))` の形だけ。define自体のlistはどこからも指されないので置かない。
+  constexpr StaticDefine define() {
+    skip_spaces();
+    if(src.substr(pos, 8) != "(define ") throw "static prelude: expected (define name (lambda ...))";
+    pos += 8;
+    Item const name = read();
+    skip_spaces();
+    if(src.substr(pos, 8) != "(lambda ") throw "static prelude: expected (define name (lambda ...))";
+    Item const lambda = read();
+    skip_spaces();
+    if(pos == src.size() || src[pos] != ')') throw "static prelude: expected (define name (lambda ...))";
+    return StaticDefine{name, lambda};
+  }
+};
+
+constexpr Image build_image() {
+  Image image{};
+  image.words[0] = immortal_page; // ページの番号の所
+  for(std::size_t i{}; i < sources.size(); ++i) image.defines[i] = Builder{image, sources[i]}.define();
+  return image;
+}
+
+constexpr Image image = build_image();
+alignas(cons_page_bytes) constinit std::array<Value, page_words> static_page = image.words;
+Closure static_closures[sources.size()];
+
+Value resolve(Item item) {
+  switch(item.kind) {
+  case Item::Cons:
+    return reinterpret_cast<Value>(static_page.data()) + item.v;
+  case Item::Long:
+    return make_symbol(std::string{image.long_names[item.v]}.c_str());
+  case Item::Plain:
+  default:
+    return item.v;
+  }
+}
+
+// 一度だけ。closureも埋め込んだものを使い、markされたままにしておく(sweepのlistには入らないので、collectは中を見ない)。
+// 最適化した本体などはheapに作られるので、closureのfieldはrootとして登録する。
+bool install() {
+  for(std::size_t i{}; i < image.fixup_count; ++i) static_page[image.fixups[i].word] = resolve(image.fixups[i].item);
+  mprotect(static_page.data(), cons_page_bytes, PROT_READ);
+  for(std::size_t i{}; i < sources.size(); ++i) {
+    Closure* const c = &static_closures[i];
+    Value const lambda = resolve(image.defines[i].lambda);
+    init_closure(c, car(cdr(lambda)), cdr(cdr(lambda)), nil());
+    c->header.marked = true;
+    c->name = resolve(image.defines[i].name);
+  }
+  add_roots([](RootVisitor const& visit) {
+    for(Closure& c: static_closures) {
+      for(Value* field: {&c.params, &c.body, &c.env, &c.name, &c.source}) visit(*field);
+    }
+  });
+  return true;
+}
+#endif
+
+} // namespace
 
 Value to_Lisp(char const* code) {
   std::stringstream ss{code};
@@ -11,18 +208,20 @@ Value operator""_lisp(char const* code, size_t) {
   return to_Lisp(code);
 }
 
+std::vector<char const*> const& prelude_lisp_sources() {
+  static std::vector<char const*> const defines(begin(sources), end(sources));
+  return defines;
+}
+
 Value prelude_lisp_defines(Value env) {
-  std::array defines = {
-    "(define id (lambda (x) x))",
-    "(define + (lambda (x y) (if (eq y 0) x (+ (succ x) (pred y)))))",
-    "(define * (lambda (x y) (if (eq y 0) 0 (+ (* x (pred y)) x))))",
-    "(define list (lambda x x))",
-    "(define null? (lambda (x) (eq nil x)))",
-    "(define not (lambda (x) (if x nil #t)))",
-    "(define length (lambda (x) (if x (succ (length (cdr x))) 0)))",
-  };
-  for(auto v: defines) {
+#ifndef LILITH_COMPRESSED_REFS
+  static bool const installed = install();
+  (void)installed;
+  for(Closure& c: static_closures) env = define_variable(c.name, to_Value(&c.header, nullptr), env);
+#else
+  for(auto v: prelude_lisp_sources()) {
     std::tie(std::ignore, env) = eval_define(to_Lisp(v), env);
   }
+#endif
   return env;
 }
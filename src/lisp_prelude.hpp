@@ -2,4 +2,8 @@
 
 #include "prelude.hpp"
 
+#include <vector>
+
 Value prelude_lisp_defines(Value env);
+// preludeの `(define ...)` のsource。`lilith compile` も同じものを翻訳する。
+std::vector<char const*> const& prelude_lisp_sources();
@@ -0,0 +1,116 @@
+#include "macro.hpp"
+#include "allocator.hpp"
+#include "escape.hpp"
+#include "future.hpp"
+#include "hashcons.hpp"
+#include "prelude.hpp"
+
+#include <atomic>
+#include <vector>
+
+namespace {
+
+struct Macro {
+  Object header;
+  Value expander; // `(lambda params body...)` のclosure
+};
+
+struct Expansion {
+  Object header;
+  Value form;
+  Value macro; // 展開したmacro。名前が今もこれを指しているなら使える
+  std::uint64_t epoch; // 最後に確かめた時のglobal_epoch
+};
+
+bool caching = true;
+std::atomic<std::uint64_t> expansions{};
+
+Macro* to_macro(Value v) {
+  return reinterpret_cast<Macro*>(to_object(v));
+}
+
+Expansion* to_expansion(Value v) {
+  return reinterpret_cast<Expansion*>(to_object(v));
+}
+
+Value make_expansion(Value form, Value macro) {
+  auto const e = reinterpret_cast<Expansion*>(alloc_object(sizeof(Expansion)));
+  e->header = Object{ObjectKind::Expansion, false, 2};
+  e->form = form;
+  e->macro = macro;
+  e->epoch = global_epoch();
+  return to_Value(&e->header, nullptr);
+}
+
+Value macro_name(Value macro) {
+  return closure_name(to_macro(macro)->expander);
+}
+
+// futureのthreadが同じformを読んでいるかもしれない間は書き換えない
+bool can_rewrite(Value form) {
+  return caching && !on_worker_thread() && !futures_running() && !is_immortal(form) && is_canonical(form) == false;
+}
+
+} // namespace
+
+Value define_macro(Value v, Value env) {
+  Value const name = car(cdr(v));
+  if(!is_symbol(name)) throw "defmacro: name must be a symbol";
+  Value const rest = cdr(cdr(v));
+  if(is_atom_bool(rest) || cdr(rest) == nil()) throw "defmacro: missing body";
+  auto const m = reinterpret_cast<Macro*>(alloc_object(sizeof(Macro)));
+  m->header = Object{ObjectKind::Macro, false, 1};
+  m->expander = lambda(car(rest), cdr(rest), env);
+  set_closure_name(m->expander, name);
+  define_variable(name, to_Value(&m->header, nullptr), env);
+  return name;
+}
+
+bool is_macro(Value v) {
+  return is_object(v) && to_object(v)->kind == ObjectKind::Macro;
+}
+
+Value expand_macro(Value form, Value macro) {
+  // 引数や別名で渡されたmacroは、JITしたcodeからは展開できないので、どこでも呼べないことにする
+  if(car(form) != macro_name(macro)) throw "cannot apply a macro";
+  std::vector<Value> args; // 展開の途中でcollectはしないので、ここに置いておいても動かない
+  for(Value a = cdr(form); !is_atom_bool(a); a = cdr(a)) args.push_back(car(a));
+  EscapeBarrier barrier; // 展開の中から外のcall/ecへ出る時も、argsを壊してから戻る
+  Value const expansion = apply(to_macro(macro)->expander, args.data(), args.size());
+  expansions.fetch_add(1, std::memory_order_relaxed);
+  if(can_rewrite(form)) set_car(form, make_expansion(expansion, macro));
+  return expansion;
+}
+
+Value current_expansion(Value form, Value env) {
+  Expansion* const e = to_expansion(car(form));
+  if(e->epoch == global_epoch()) [[likely]] return e->form;
+  Value const name = macro_name(e->macro);
+  Value now = nil();
+  try {
+    now = find(name, env);
+  } catch(char const*) {
+  }
+  if(now == e->macro) {
+    if(!on_worker_thread()) e->epoch = global_epoch();
+    return e->form;
+  }
+  if(on_worker_thread() || futures_running()) return make_cons(name, cdr(form)); // 覚えた展開はそのままにして、その場だけ
+  set_car(form, name);
+  return form;
+}
+
+bool is_expansion(Value v) {
+  return is_object(v) && to_object(v)->kind == ObjectKind::Expansion;
+}
+
+
+void set_macro_caching(bool enable) {
+  caching = enable;
+}
+bool macro_caching() {
+  return caching;
+}
+std::uint64_t macro_expansions() {
+  return expansions.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstdint>
+
+// `(defmacro name params body...)` はnameをmacroとして定義する。`(name args...)` はargsを評価せずに
+// `(lambda params body...)` に渡し、返ってきた式を元の式の代わりに評価する。
+// 展開は呼び出しの場所ごとに一度だけ。展開した式は呼び出しのconsのcarに #<expansion> として置いておき
+// (cdrは書き換えないので、cdr-codedなlistもそのまま)、次からはevalもoptimizerもJITもそれを使う。
+// optimizerは最適化する時に展開まで済ませるので、最適化した本体は手で書いたものと同じになる。
+// 書き換えられないcons(preludeの読み出し専用のページ、hash-consしたcell)と、futureなどの別threadでは、覚えずに毎回展開する。
+// poolのthreadが動いている間も、同じformを読んでいるかもしれないので書き換えない。
+// macroを定義し直したら、覚えた展開は次に使う時に捨てて展開し直す。
+// macroはdefmacroした名前で呼ぶものなので、関数として値を渡したり、別の名前やapplyで呼んだりはできない。
+
+Value define_macro(Value v, Value env); // evalの `(defmacro ...)`
+bool is_macro(Value v);
+// `(name args...)` を展開した式。覚えられるならformのcarに置く。
+Value expand_macro(Value form, Value macro);
+
+// 展開済みの呼び出しのcar
+bool is_expansion(Value v);
+// 展開済みの呼び出し `(#<expansion> args...)` の代わりに評価する式。普通は覚えた展開。
+// 名前がもう展開した時のmacroを指していなければ(定義し直されていたら)、carを名前に戻した呼び出しを返すので、
+// 呼んだ側は普通の呼び出しと同じように扱う(macroならそこで展開し直す)。envはトップレベルならnil。
+Value current_expansion(Value form, Value env);
+
+// falseなら展開を覚えずに毎回展開し、optimizerも展開しない(benchで比べるため)。
+void set_macro_caching(bool enable);
+bool macro_caching();
+std::uint64_t macro_expansions(); // expanderを呼んだ回数
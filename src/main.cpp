@@ -1,11 +1,73 @@
+#include <fstream>
 #include <iostream>
+#include <cstring>
 #include "prelude.hpp"
+#include "profiler.hpp"
+#include "jit.hpp"
+#include "aot.hpp"
+#include "optimizer.hpp"
+#include "hashcons.hpp"
+#include "future.hpp"
+#include "server.hpp"
 
 int main(int argc, char** argv) {
   if(argc >= 2) {
     std::string cmd{argv[1]};
     if(cmd == "repl") {
+      // lilith repl [--profile[=sample|heap]] [--heap-sample=BYTES] [--profile-out=FILE] [--jit-threshold=N] [--no-opt] [--hash-cons] [--no-cdr-coding] [--threads=N]
+      for(int i = 2; i < argc; ++i) {
+        if(std::strcmp(argv[i], "--profile") == 0) profile_start(ProfileMode::Trace);
+        if(std::strcmp(argv[i], "--profile=sample") == 0) profile_start(ProfileMode::Sample);
+        if(std::strcmp(argv[i], "--profile=heap") == 0) profile_start(ProfileMode::Heap);
+        if(std::strncmp(argv[i], "--heap-sample=", 14) == 0) set_heap_sample_interval(std::atoi(argv[i] + 14));
+        if(std::strncmp(argv[i], "--profile-out=", 14) == 0) set_profile_output(argv[i] + 14);
+        if(std::strncmp(argv[i], "--jit-threshold=", 16) == 0) set_jit_threshold(std::atoi(argv[i] + 16));
+        if(std::strcmp(argv[i], "--no-opt") == 0) set_optimize(false);
+        if(std::strcmp(argv[i], "--hash-cons") == 0) set_hash_consing(true);
+        if(std::strcmp(argv[i], "--no-cdr-coding") == 0) set_cdr_coding(false);
+        if(std::strncmp(argv[i], "--threads=", 10) == 0) set_future_threads(std::atoi(argv[i] + 10));
+      }
       repl(std::cin);
+      profile_stop();
+      return 0;
+    }
+    if(cmd == "serve" && argc >= 3) {
+      // lilith serve path [--load=FILE] [--threads=N] [--collect-every=N] [--jit-threshold=N] [--no-opt]
+      initial_env();
+      std::size_t collect_every = 256;
+      try {
+        for(int i = 3; i < argc; ++i) {
+          if(std::strncmp(argv[i], "--load=", 7) == 0) preload(argv[i] + 7);
+          if(std::strncmp(argv[i], "--threads=", 10) == 0) set_future_threads(std::atoi(argv[i] + 10));
+          if(std::strncmp(argv[i], "--collect-every=", 16) == 0) collect_every = std::atoi(argv[i] + 16);
+          if(std::strncmp(argv[i], "--jit-threshold=", 16) == 0) set_jit_threshold(std::atoi(argv[i] + 16));
+          if(std::strcmp(argv[i], "--no-opt") == 0) set_optimize(false);
+        }
+        serve(argv[2], collect_every);
+      } catch(char const* msg) {
+        std::cerr << msg << std::endl;
+        return 1;
+      }
+      return 0;
+    }
+    if(cmd == "compile") {
+      // lilith compile prog.lisp -o prog.cpp
+      if(argc != 5 || std::strcmp(argv[3], "-o") != 0) {
+        std::cerr << "usage: " << argv[0] << " compile prog.lisp -o prog.cpp" << std::endl;
+        return 2;
+      }
+      std::ifstream in{argv[2]};
+      if(!in) {
+        std::cerr << "cannot open " << argv[2] << std::endl;
+        return 1;
+      }
+      std::ofstream out{argv[4]};
+      try {
+        compile_program(in, out);
+      } catch(char const* msg) {
+        std::cerr << msg << std::endl;
+        return 1;
+      }
       return 0;
     }
     if(cmd == "str") {
@@ -0,0 +1,200 @@
+#include "memo.hpp"
+#include "allocator.hpp"
+#include "escape.hpp"
+#include "future.hpp"
+#include "prelude.hpp"
+
+#include <array>
+#include <bit>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+constexpr std::size_t max_key_args = 4; // これより多い引数の呼び出しは覚えない
+constexpr std::size_t default_capacity = 4096;
+constexpr std::size_t max_hash_nodes = 32; // equal?のhashで見るconsの数。同じ形なら同じ所までで同じhashになる
+
+struct Key {
+  std::array<Value, max_key_args> args;
+  std::size_t n;
+};
+
+std::size_t mix(std::size_t h, std::size_t x) {
+  return (h ^ x) * 0x9E3779B97F4A7C15ULL;
+}
+
+// equal_boolで等しいものは同じhashになるように。
+std::size_t structural_hash(Value v, std::size_t& budget) {
+  std::size_t h = 0;
+  while(!is_atom_bool(v)) {
+    if(budget == 0) return h;
+    --budget;
+    h = mix(h, structural_hash(car(v), budget));
+    v = cdr(v);
+  }
+  if(is_float(v)) return mix(h, std::bit_cast<std::uint64_t>(to_double(v)));
+  return mix(h, v);
+}
+
+struct KeyHash {
+  bool structural;
+  std::size_t operator()(Key const& k) const {
+    std::size_t h = k.n;
+    std::size_t budget = max_hash_nodes;
+    for(std::size_t i{}; i < k.n; ++i) h = mix(h, structural ? structural_hash(k.args[i], budget) : k.args[i]);
+    return h;
+  }
+};
+struct KeyEqual {
+  bool structural;
+  bool operator()(Key const& lhs, Key const& rhs) const {
+    if(lhs.n != rhs.n) return false;
+    for(std::size_t i{}; i < lhs.n; ++i) {
+      if(structural ? !equal_bool(lhs.args[i], rhs.args[i]) : lhs.args[i] != rhs.args[i]) return false;
+    }
+    return true;
+  }
+};
+
+struct Entry {
+  Key key;
+  Value result;
+};
+struct Cache {
+  std::size_t capacity;
+  std::list<Entry> lru; // 先頭が最後に使ったもの
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash, KeyEqual> index;
+
+  Cache(std::size_t capacity, bool structural)
+    : capacity{capacity}, lru{}, index{16, KeyHash{structural}, KeyEqual{structural}} {}
+};
+
+struct Memo {
+  Object header;
+  Value f;
+  Cache* cache;
+};
+
+MemoStats stats{};
+std::mutex memos_m; // memoizeはfutureのthreadからも呼ばれる
+std::unordered_set<Memo*> memos; // collectで表を作り直すために
+
+Memo* to_memo(Value v) {
+  if(!is_memo(v)) throw "not a memo";
+  return reinterpret_cast<Memo*>(to_object(v));
+}
+
+bool const finalizer_registered = (set_finalizer(ObjectKind::Memo, [](Object* obj) {
+  auto const m = reinterpret_cast<Memo*>(obj);
+  {
+    std::lock_guard lk{memos_m};
+    memos.erase(m);
+  }
+  delete m->cache;
+}), true);
+
+// 結果は引数が全部生きている間だけ生かす(ephemeron)。引数が死ぬまでは、結果が他から見えなくても忘れない。
+// markの途中で生き返ったmemoもあるので、markされているかはその都度見る。
+bool const ephemerons_registered = (add_ephemerons([](EphemeronVisitor const& visit) {
+  std::lock_guard lk{memos_m};
+  for(Memo* m: memos) {
+    if(!m->header.marked) continue;
+    for(Entry const& e: m->cache->lru) visit(e.key.args.data(), e.key.n, e.result);
+  }
+}), true);
+
+// 引数が死んだ組を捨てて、残りを引越し先に書き換える。死んだmemoはこの後のsweepでfinalizeされるので触らない。
+bool const weak_registered = (add_weak_roots([](WeakVisitor const& survive) {
+  std::lock_guard lk{memos_m};
+  for(Memo* m: memos) {
+    if(!m->header.marked) continue;
+    Cache& c = *m->cache;
+    c.index.clear();
+    for(auto it = begin(c.lru); it != end(c.lru);) {
+      bool live = survive(it->result);
+      for(std::size_t i{}; i < it->key.n; ++i) live = survive(it->key.args[i]) && live;
+      if(!live) {
+        ++stats.dropped;
+        it = c.lru.erase(it);
+        continue;
+      }
+      c.index.emplace(it->key, it);
+      ++it;
+    }
+  }
+}), true);
+
+Value make_memo(Value f, std::size_t capacity, bool structural) {
+  auto const m = reinterpret_cast<Memo*>(alloc_object(sizeof(Memo)));
+  m->header = Object{ObjectKind::Memo, false, 1};
+  m->f = f;
+  m->cache = new Cache{capacity, structural};
+  std::lock_guard lk{memos_m};
+  memos.insert(m);
+  return to_Value(&m->header, nullptr);
+}
+
+Value primitive_memoize(Value const* args, std::size_t n) {
+  if(n < 1 || n > 3) throw "wrong number of arguments";
+  if(!is_closure(args[0]) && !is_primitive(args[0]) && !is_memo(args[0])) throw "memoize: not a function";
+  std::size_t capacity = default_capacity;
+  if(n >= 2) {
+    if(!is_integer(args[1]) || to_int(args[1]) < 1) throw "memoize: capacity must be a positive fixnum";
+    capacity = static_cast<std::size_t>(to_int(args[1]));
+  }
+  return make_memo(args[0], capacity, n == 3 && args[2] != nil());
+}
+
+} // namespace
+
+bool is_memo(Value f) {
+  return is_object(f) && to_object(f)->kind == ObjectKind::Memo;
+}
+
+Value apply_memo(Value f, Value const* args, std::size_t n) {
+  Memo* const m = to_memo(f);
+  if(n > max_key_args || on_worker_thread()) return apply(m->f, args, n);
+  Key key{};
+  key.n = n;
+  std::copy(args, args + n, begin(key.args));
+  Cache& c = *m->cache;
+  if(auto const it = c.index.find(key); it != end(c.index)) {
+    ++stats.hits;
+    c.lru.splice(begin(c.lru), c.lru, it->second);
+    return it->second->result;
+  }
+  ++stats.misses;
+  EscapeBarrier barrier; // fの中から外のcall/ecへ出る時は、ここを例外で抜ける(表の途中で止まらない)
+  // fの中で同じmemoが呼ばれて表が変わるので、iteratorは持ち越さない
+  Value const result = apply(m->f, key.args.data(), n);
+  if(auto const it = c.index.find(key); it != end(c.index)) {
+    it->second->result = result;
+    c.lru.splice(begin(c.lru), c.lru, it->second);
+    return result;
+  }
+  c.lru.push_front(Entry{key, result});
+  c.index.emplace(key, begin(c.lru));
+  if(c.lru.size() > c.capacity) {
+    ++stats.evictions;
+    c.index.erase(c.lru.back().key);
+    c.lru.pop_back();
+  }
+  return result;
+}
+
+void clear_memo(Value f) {
+  Cache& c = *to_memo(f)->cache;
+  c.index.clear();
+  c.lru.clear();
+}
+
+MemoStats const& memo_stats() {
+  return stats;
+}
+
+Value define_memo_primitives(Value env) {
+  return define_primitive("memoize", -1, primitive_memoize, env);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// `(memoize f)` はfと同じように呼べて、同じ引数で呼ばれたら前の結果を返す関数(#<memo>)を作る。
+// `(memoize f capacity)` は覚えておく数(4096)。溢れたら一番長く使われていない結果から忘れる(LRU)。
+// `(memoize f capacity #t)` は引数をequal?で比べる。普通はeqで、fixnumとsymbolは値、consは同じcellかどうか。
+// 引数は弱く持つ。collectで引数のどれかが死んでいたら、その結果は忘れる(cacheのせいで引数が生き延びない)。
+// 結果は引数が全部生きている間は生かしておく(ephemeron)。fixnumやsymbolの引数なら、memoが生きている限り覚えている。
+// consは引越すので、collectの後に生き残ったものでhashを作り直す。
+// futureなどの別threadからの呼び出しは、cacheを見ずにそのままfを呼ぶ。
+
+bool is_memo(Value f);
+Value apply_memo(Value f, Value const* args, std::size_t n); // applyから
+void clear_memo(Value f);
+
+struct MemoStats {
+  std::uint64_t hits;
+  std::uint64_t misses;
+  std::uint64_t evictions; // LRUで忘れた数
+  std::uint64_t dropped; // collectで引数が死んで忘れた数
+};
+MemoStats const& memo_stats();
+
+// `(memoize f [capacity [equal]])`
+Value define_memo_primitives(Value env);
@@ -0,0 +1,299 @@
+#include "optimizer.hpp"
+#include "prelude.hpp"
+#include "macro.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+bool enabled = true;
+OptimizeStats stats{};
+
+std::size_t const max_inline_size = 16; // 本体のatomの数
+int const max_inline_depth = 4; // 展開した本体の中でさらに展開する深さ
+
+bool is_tagged(Value v, char const* tag) {
+  return !is_atom_bool(v) && car(v) == make_symbol(tag);
+}
+bool is_defmacro(Value v) {
+  static Value const defmacro = make_symbol("defmacro");
+  return !is_atom_bool(v) && car(v) == defmacro;
+}
+
+// evalが展開を覚えた呼び出し `(#<expansion> args...)` は、展開した式として見る。
+Value unwrap(Value v) {
+  while(!is_atom_bool(v) && is_expansion(car(v))) v = current_expansion(v, nil());
+  return v;
+}
+
+// 中身が変わらなかった所は元のconsをそのまま使う。
+template<class F>
+Value map_list(Value list, F&& f) {
+  if(is_atom_bool(list)) return list;
+  Value const head = f(car(list));
+  Value const tail = map_list(cdr(list), f);
+  if(head == car(list) && tail == cdr(list)) return list;
+  return make_cons(head, tail);
+}
+
+// lambda(とfuture、delay)とquoteの中は見ない。
+bool contains_define(Value v) {
+  v = unwrap(v);
+  if(is_defmacro(v)) return true;
+  if(is_atom_bool(v) || is_tagged(v, "quote") || is_tagged(v, "lambda") || is_tagged(v, "future") || is_tagged(v, "delay")) return false;
+  if(is_tagged(v, "define")) return true;
+  for(; !is_atom_bool(v); v = cdr(v)) {
+    if(contains_define(car(v))) return true;
+  }
+  return false;
+}
+
+std::size_t size_of(Value v) {
+  v = unwrap(v);
+  if(is_atom_bool(v) || is_tagged(v, "quote")) return 1;
+  std::size_t n{};
+  for(; !is_atom_bool(v); v = cdr(v)) n += size_of(car(v));
+  return n;
+}
+
+Value literal(Value c) {
+  if(is_self_eval(c)) return c;
+  return quote(c);
+}
+
+bool is_foldable(PrimitiveFn fn) {
+  return fn == primitive_succ || fn == primitive_pred || fn == primitive_eq
+    || fn == primitive_atom || fn == primitive_car || fn == primitive_cdr;
+}
+
+class Optimizer {
+  std::vector<Value> scope; // local変数
+
+  bool is_local(Value name) const {
+    return std::find(begin(scope), end(scope), name) != end(scope);
+  }
+  Value const* global(Value name) const {
+    if(!is_symbol(name) || is_local(name)) return nullptr;
+    return lookup_global(name);
+  }
+  // 何度評価しても、評価しなくても結果が変わらない式。未定義の変数はerrorになるので入れない。
+  bool is_trivial(Value v) const {
+    if(is_symbol(v)) return is_local(v) || global(v);
+    return is_atom_bool(v) || is_tagged(v, "quote");
+  }
+
+  // 式の値が今わかるならcに入れる。
+  bool constant(Value v, Value& c) const {
+    if(is_self_eval(v)) {
+      c = v;
+      return true;
+    }
+    if(is_tagged(v, "quote")) {
+      c = car(cdr(v));
+      return true;
+    }
+    if(v == t() || v == make_symbol("nil")) { // 上書きされていなければ `#t` と `nil`
+      Value const* g = global(v);
+      if(g && *g == (v == t() ? t() : nil())) {
+        c = *g;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // `(succ 3)` -> 4。引数の型がprimitiveの前提と合わない時は実行時に任せる。
+  bool fold(Primitive* prim, Value args, Value& result) const {
+    Value values[2];
+    std::size_t n{};
+    for(; args != nil(); args = cdr(args), ++n) {
+      if(n == 2 || !constant(car(args), values[n])) return false;
+    }
+    if(static_cast<std::int64_t>(n) != prim->arity) return false;
+    if((prim->fn == primitive_succ || prim->fn == primitive_pred) && !is_integer(values[0])) return false;
+    if((prim->fn == primitive_car || prim->fn == primitive_cdr) && (values[0] == nil() || is_atom_bool(values[0]))) return false;
+    try {
+      result = prim->fn(values, n);
+    } catch(char const*) { // fixnumが溢れるなど。errorは実行した時に出す
+      return false;
+    }
+    return true;
+  }
+
+  // 本体の中で引数が評価される順番。条件付きで評価される所(ifの枝)はconditionalにする。
+  struct Use {
+    std::size_t param;
+    bool conditional;
+  };
+  static void uses(Value v, Value params, bool conditional, std::vector<Use>& res) {
+    if(is_symbol(v)) {
+      std::size_t i{};
+      for(Value p = params; p != nil(); p = cdr(p), ++i) {
+        if(car(p) == v) res.push_back(Use{i, conditional});
+      }
+      return;
+    }
+    v = unwrap(v);
+    if(is_atom_bool(v) || is_tagged(v, "quote")) return;
+    if(is_tagged(v, "if")) {
+      Value const rest = cdr(v);
+      uses(car(rest), params, conditional, res);
+      for(Value b = cdr(rest); !is_atom_bool(b); b = cdr(b)) uses(car(b), params, true, res);
+      return;
+    }
+    for(; !is_atom_bool(v); v = cdr(v)) uses(car(v), params, conditional, res);
+  }
+
+  // 本体が参照しているトップレベルの名前が、呼び出し側のlocal変数に隠されていないか
+  bool free_names_visible(Value v, Value params, Value self) const {
+    if(is_symbol(v)) {
+      for(Value p = params; p != nil(); p = cdr(p)) {
+        if(car(p) == v) return true;
+      }
+      return v != self && !is_local(v);
+    }
+    v = unwrap(v);
+    if(is_atom_bool(v) || is_tagged(v, "quote")) return true;
+    if(is_tagged(v, "lambda") || is_tagged(v, "define") || is_tagged(v, "future") || is_tagged(v, "delay") || is_defmacro(v)) return false;
+    if(Value const* g = global(car(v)); g && is_macro(*g)) return false; // 引数は式ではないので置き換えられない
+    if(is_tagged(v, "if")) v = cdr(v);
+    for(; !is_atom_bool(v); v = cdr(v)) {
+      if(!free_names_visible(car(v), params, self)) return false;
+    }
+    return true;
+  }
+
+  static Value substitute(Value v, Value params, Value args) {
+    if(is_symbol(v)) {
+      for(Value p = params, a = args; p != nil(); p = cdr(p), a = cdr(a)) {
+        if(car(p) == v) return car(a);
+      }
+      return v;
+    }
+    v = unwrap(v);
+    if(is_atom_bool(v) || is_tagged(v, "quote")) return v;
+    return map_list(v, [&](Value x) { return substitute(x, params, args); });
+  }
+
+  // `(f a b)` のfが小さいトップレベルのlambdaなら、本体のparamsをargsで置き換えたもの。
+  bool inline_call(Value name, Value f, Value args, Value& result) const {
+    if(closure_env(f) != nil() || closure_arity(f) < 0) return false;
+    Value const params = closure_params(f);
+    Value const body = closure_source(f);
+    if(cdr(body) != nil()) return false;
+    Value const exp = car(body);
+    std::int64_t n{};
+    bool trivial = true;
+    for(Value a = args; a != nil(); a = cdr(a), ++n) trivial = trivial && is_trivial(car(a));
+    if(n != closure_arity(f)) return false;
+    if(size_of(exp) > max_inline_size || !free_names_visible(exp, params, name)) return false;
+    if(!trivial) {
+      // 引数の式を本体に埋め込んでも、評価される回数(1回)と順番が変わらない時だけ
+      std::vector<Use> order;
+      uses(exp, params, false, order);
+      if(order.size() != static_cast<std::size_t>(n)) return false;
+      for(std::size_t i{}; i < order.size(); ++i) {
+        if(order[i].param != i || order[i].conditional) return false;
+      }
+    }
+    result = substitute(exp, params, args);
+    return true;
+  }
+
+  Value application(Value v, int depth) {
+    if(Value const* g = global(car(v)); g && is_macro(*g)) {
+      if(!macro_caching()) return v;
+      Value expanded;
+      try {
+        expanded = expand_macro(v, *g);
+      } catch(char const*) { // errorは実行した時に出す
+        return v;
+      }
+      return expr(expanded, depth);
+    }
+    Value const op = is_symbol(car(v)) ? car(v) : expr(car(v), depth);
+    Value const args = map_list(cdr(v), [&](Value x) { return expr(x, depth); });
+    if(Value const* g = global(op)) {
+      Value result;
+      if(is_primitive(*g) && is_foldable(to_primitive(*g)->fn) && fold(to_primitive(*g), args, result)) {
+        ++stats.folded;
+        return literal(result);
+      }
+      if(depth < max_inline_depth && is_closure(*g) && inline_call(op, *g, args, result)) {
+        ++stats.inlined;
+        return expr(result, depth + 1);
+      }
+    }
+    if(op == car(v) && args == cdr(v)) return v;
+    return make_cons(op, args);
+  }
+
+public:
+  explicit Optimizer(Value params) : scope{} {
+    if(is_symbol(params)) {
+      scope.push_back(params);
+      return;
+    }
+    for(; !is_atom_bool(params); params = cdr(params)) scope.push_back(car(params));
+  }
+
+  Value expr(Value v, int depth) {
+    v = unwrap(v);
+    if(is_atom_bool(v) || is_tagged(v, "quote") || is_tagged(v, "lambda") || is_tagged(v, "define") || is_tagged(v, "future")
+       || is_tagged(v, "delay") || is_defmacro(v)) {
+      return v;
+    }
+    if(is_tagged(v, "if")) {
+      Value const rest = cdr(v);
+      if(is_atom_bool(cdr(rest)) || is_atom_bool(cdr(cdr(rest))) || cdr(cdr(cdr(rest))) != nil()) return v;
+      Value const test = expr(car(rest), depth);
+      Value c;
+      if(constant(test, c)) {
+        ++stats.pruned;
+        return expr(c != nil() ? car(cdr(rest)) : car(cdr(cdr(rest))), depth);
+      }
+      Value const consequent = expr(car(cdr(rest)), depth);
+      Value const alternative = expr(car(cdr(cdr(rest))), depth);
+      if(test == car(rest) && consequent == car(cdr(rest)) && alternative == car(cdr(cdr(rest)))) return v;
+      return list("if", test, consequent, alternative);
+    }
+    return application(v, depth);
+  }
+};
+
+} // namespace
+
+void set_optimize(bool on) {
+  enabled = on;
+}
+bool optimizing() {
+  return enabled;
+}
+std::uint64_t optimizer_stamp() {
+  return global_epoch() * 2 + (enabled ? 1 : 0);
+}
+
+Value optimize(Value form) {
+  if(!enabled) return form;
+  Optimizer opt{nil()};
+  if(is_tagged(form, "define")) { // `(define x exp)` のexpだけ
+    Value const exp = cdr(cdr(form));
+    if(is_atom_bool(exp)) return form;
+    Value const optimized = opt.expr(car(exp), 0);
+    if(optimized == car(exp)) return form;
+    return list("define", car(cdr(form)), optimized);
+  }
+  return opt.expr(form, 0);
+}
+
+Value optimize_body(Value f) {
+  Value const body = closure_source(f);
+  if(contains_define(body)) return body; // 本体の中のdefineがトップレベルの名前を隠すかもしれない
+  Optimizer opt{closure_params(f)};
+  return map_list(body, [&](Value x) { return opt.expr(x, 0); });
+}
+
+OptimizeStats const& optimize_stats() {
+  return stats;
+}
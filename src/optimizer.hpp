@@ -0,0 +1,29 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstdint>
+
+// readとevalの間に入れる、s式からs式への最適化。
+//   - 小さくて自分を呼ばないトップレベルのlambdaの呼び出しを、その本体で置き換える(inline展開)
+//   - 引数が全部定数のsucc/pred/eq/atom/car/cdrを計算しておく(定数畳み込み)
+//   - 条件が定数のifの、通らない方の枝を消す
+//   - トップレベルのmacroの呼び出しを展開しておく(macro.hpp)
+// トップレベルの式はevalの前に、トップレベルで定義したclosureの本体は呼ばれた時に最適化する。
+// トップレベルの定義が上書きされたら、closureの本体は元の本体(closure_source)から作り直す。
+// 入れ子のlambdaの中には手を付けない。
+
+void set_optimize(bool enabled);
+bool optimizing();
+// closureの本体がこれと違う値で最適化されていたら作り直す。トップレベルの定義かon/offが変わると変わる。
+std::uint64_t optimizer_stamp();
+
+Value optimize(Value form); // トップレベルの式
+Value optimize_body(Value f); // トップレベルのclosureの元の本体を最適化したもの
+
+struct OptimizeStats {
+  std::uint64_t inlined; // inline展開した呼び出し
+  std::uint64_t folded; // 計算しておいたprimitiveの呼び出し
+  std::uint64_t pruned; // 消したifの枝
+};
+OptimizeStats const& optimize_stats();
@@ -1,14 +1,28 @@
 #include "prelude.hpp"
 #include "allocator.hpp"
 #include "lisp_prelude.hpp"
+#include "profiler.hpp"
+#include "future.hpp"
+#include "fasl.hpp"
+#include "lazy.hpp"
+#include "escape.hpp"
+#include "macro.hpp"
+#include "memo.hpp"
+#include "typed_array.hpp"
+#include "jit.hpp"
+#include "optimizer.hpp"
 
 #include <array>
+#include <charconv>
 #include <set>
 #include <sstream>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 #include <cassert>
 
 std::tuple<Value, Value> eval_define(Value v, Value env);
-Value apply(Value f, Value args);
+Value apply(Value f, Value const* args, std::size_t n);
 
 Value t() {
   static Value t = make_symbol("#t");
@@ -39,43 +53,127 @@ Value unquote(Value v) {
   return car(cdr(v));
 }
 
-Value expand_env(Value env) {
-  return make_cons(make_symbol("env"), make_cons(nil(), env));
-}
+// トップレベルでdefineされたもの。frameを辿りきった(envがnilになった)らここを探す。
+class GlobalTable {
+  std::unordered_map<Value, Value> table;
+  std::uint64_t epoch;
+public:
+  GlobalTable() : table{}, epoch{} {
+    add_roots([this](RootVisitor const& visit) {
+      for(auto& e: table) visit(e.second);
+    });
+  }
+  void define(Value name, Value def) {
+    auto const [it, inserted] = table.try_emplace(name, def);
+    if(!inserted) {
+      it->second = def;
+      ++epoch; // 古い定義を前提にしたJITのcodeはもう使えない
+    }
+  }
+  std::uint64_t current_epoch() const { return epoch; }
+  Value const* lookup(Value name) const {
+    auto const it = table.find(name);
+    if(it == end(table)) return nullptr;
+    return &it->second;
+  }
+  std::unordered_map<Value, Value> const& entries() const { return table; }
+} globals;
 
-Value get_assoc(Value env) {
-  assert(to_bool(eq(car(env), make_symbol("env"))));
-  return car(cdr(env));
+std::uint64_t global_epoch() {
+  return globals.current_epoch();
 }
-Value get_parent(Value env) {
-  assert(to_bool(eq(car(env), make_symbol("env"))));
-  return cdr(cdr(env));
+
+Value const* lookup_global(Value name) {
+  return globals.lookup(name);
 }
 
 Value define_variable(Value name, Value def, Value env) {
-  assert(to_bool(eq(car(env), make_symbol("env"))));
-  Value assoc = get_assoc(env);
+  if(env == nil()) {
+    if(on_worker_thread()) throw "cannot define a global in a future";
+    wait_for_futures(); // 動いているfutureが見ているtableを書き換えないように
+    globals.define(name, def);
+    return env;
+  }
+  Frame* frame = to_frame(env);
   Value pair = make_cons(name, def);
-  Value new_assoc = make_cons(pair, assoc); // assocの先頭につっこんでおけば更新もできるし、追加もできる。
-  set_car(cdr(env), new_assoc);
+  frame->defined = make_cons(pair, frame->defined); // 先頭につっこんでおけば更新もできるし、追加もできる。
   return env;
 }
 
+Value define_primitive(char const* name, std::int64_t arity, PrimitiveFn fn, Value env) {
+  return define_variable(make_symbol(name), make_primitive(name, arity, fn), env);
+}
+
+Value primitive_cons(Value const* args, std::size_t) { return make_cons(args[0], args[1]); }
+// nil(0)もtypeはConsなので、is_atom_boolで見る。JITのslow pathもここに来る。
+Value primitive_car(Value const* args, std::size_t) {
+  if(is_atom_bool(args[0])) throw "car: not a cons";
+  return car(args[0]);
+}
+Value primitive_cdr(Value const* args, std::size_t) {
+  if(is_atom_bool(args[0])) throw "cdr: not a cons";
+  return cdr(args[0]);
+}
+Value primitive_atom(Value const* args, std::size_t) { return atom(args[0]); }
+Value primitive_eq(Value const* args, std::size_t) { return eq(args[0], args[1]); }
+Value primitive_equal(Value const* args, std::size_t) { return equal(args[0], args[1]); }
+Value primitive_succ(Value const* args, std::size_t) {
+  if(!is_integer(args[0])) throw "succ: not a fixnum";
+  return succ(args[0]);
+}
+Value primitive_pred(Value const* args, std::size_t) {
+  if(!is_integer(args[0])) throw "pred: not a fixnum";
+  return pred(args[0]);
+}
+Value primitive_fl_add(Value const* args, std::size_t) { return fl_add(args[0], args[1]); }
+Value primitive_fl_sub(Value const* args, std::size_t) { return fl_sub(args[0], args[1]); }
+Value primitive_fl_mul(Value const* args, std::size_t) { return fl_mul(args[0], args[1]); }
+Value primitive_fl_div(Value const* args, std::size_t) { return fl_div(args[0], args[1]); }
+Value primitive_fl_less(Value const* args, std::size_t) { return fl_less(args[0], args[1]); }
+Value primitive_fl_equal(Value const* args, std::size_t) { return fl_equal(args[0], args[1]); }
+Value primitive_flonum_p(Value const* args, std::size_t) { return flonum_p(args[0]); }
+Value primitive_to_flonum(Value const* args, std::size_t) { return to_flonum(args[0]); }
+Value primitive_to_fixnum(Value const* args, std::size_t) { return to_fixnum(args[0]); }
+Value primitive_apply(Value const* args, std::size_t n) {
+  if(n < 1) throw "wrong number of arguments";
+  return apply(args[0], args + 1, n - 1);
+}
+
 Value define_primitives(Value env) {
-  std::array prims = {"cons", "car", "cdr", "atom", "eq", "succ", "pred", "apply"};
-  for(auto e: prims) {
-    env = define_variable(make_symbol(e), list("prim", e), env);
-  }
+  env = define_primitive("cons", 2, primitive_cons, env);
+  env = define_primitive("car", 1, primitive_car, env);
+  env = define_primitive("cdr", 1, primitive_cdr, env);
+  env = define_primitive("atom", 1, primitive_atom, env);
+  env = define_primitive("eq", 2, primitive_eq, env);
+  env = define_primitive("equal?", 2, primitive_equal, env);
+  env = define_primitive("succ", 1, primitive_succ, env);
+  env = define_primitive("pred", 1, primitive_pred, env);
+  env = define_primitive("fl+", 2, primitive_fl_add, env);
+  env = define_primitive("fl-", 2, primitive_fl_sub, env);
+  env = define_primitive("fl*", 2, primitive_fl_mul, env);
+  env = define_primitive("fl/", 2, primitive_fl_div, env);
+  env = define_primitive("fl<?", 2, primitive_fl_less, env);
+  env = define_primitive("fl=?", 2, primitive_fl_equal, env);
+  env = define_primitive("flonum?", 1, primitive_flonum_p, env);
+  env = define_primitive("fixnum->flonum", 1, primitive_to_flonum, env);
+  env = define_primitive("flonum->fixnum", 1, primitive_to_fixnum, env);
+  env = define_primitive("apply", -1, primitive_apply, env);
+  env = define_profiler_primitives(env);
+  env = define_future_primitives(env);
+  env = define_fasl_primitives(env);
+  env = define_lazy_primitives(env);
+  env = define_escape_primitives(env);
+  env = define_memo_primitives(env);
+  env = define_typed_array_primitives(env);
   return env;
 }
 
 Value initial_env() {
-  Value env = make_cons(make_symbol("env"), make_cons(nil(), nil()));
+  Value env = nil();
   env = define_variable(t(), t(), env);
   env = define_variable(make_symbol("nil"), nil(), env);
   env = define_primitives(env);
   env = prelude_lisp_defines(env);
-  env = expand_env(env);
 
   return env;
 }
@@ -94,18 +192,20 @@ Value lookup(Value name, Value list) {
 }
 
 Value find(Value name, Value env) {
-  assert(to_bool(eq(car(env), make_symbol("env"))));
-  if(env != nil()) {
-    Value assoc = get_assoc(env);
-    Value parent = get_parent(env);
-
-    Value res = lookup(name, assoc);
+  while(env != nil()) {
+    Frame* frame = to_frame(env);
+    Value res = lookup(name, frame->defined);
     if(res != nil()) {
       return cdr(res);
     }
-    if(parent != nil()) {
-      return find(name, parent);
+    Value const* slots = frame_slots(frame);
+    for(std::size_t i{}, size = frame_size(frame); i < size; ++i) {
+      if(slots[2 * i] == name) return slots[2 * i + 1]; // symbolはinternしてあるので比較するだけ
     }
+    env = frame->parent;
+  }
+  if(auto res = globals.lookup(name)) {
+    return *res;
   }
 
   throw c_str(name);
@@ -115,12 +215,32 @@ bool is_application(Value v) {
   return !is_atom_bool(v);
 }
 
-Value list_of_values(Value values, Value env) {
-  if(values == nil()) return nil();
+// applicationの引数を積んでおく場所。呼び出しのたびに引数のlistをconsしないで済むようにする。
+// 積み増しでvectorが伸びると引数を指すポインタは無効になるので、受け取った側は次のevalまでに読み終えること。
+// collectはトップレベルの式の間でしか走らず、その時は空なのでrootには入れていない。futureのthreadはそれぞれ持つ。
+thread_local std::vector<Value> arg_stack;
+
+// 積んだ引数は、普通に戻る時にpopで降ろす。call/ecのlongjmpが飛び越すので、destructorは持たせない。
+// 例外で抜けた時は積んだまま残り、例外を受け止めて評価を続ける所(repl、future、call/ecの着地点など)がunwind_arg_stackで降ろす。
+struct ArgStackScope {
+  std::size_t const base;
+  ArgStackScope() : base{arg_stack.size()} {}
+  Value const* args() const { return arg_stack.data() + base; }
+  std::size_t count() const { return arg_stack.size() - base; }
+  void pop() const { arg_stack.resize(base); }
+};
+static_assert(std::is_trivially_destructible_v<ArgStackScope>);
 
-  Value head = car(values);
-  std::tie(head, env) = eval(head, env);
-  return make_cons(head, list_of_values(cdr(values), env));
+std::size_t arg_stack_depth() {
+  return arg_stack.size();
+}
+void unwind_arg_stack(std::size_t depth) {
+  arg_stack.resize(depth);
+}
+
+// 引数のlistが本当に必要な時(`(lambda xs xs)`)だけ作る。
+Value materialize_args(Value const* args, std::size_t n) {
+  return make_list(args, n);
 }
 
 Value len(Value list) {
@@ -130,40 +250,10 @@ Value len(Value list) {
   return succ(len(cdr(list)));
 }
 
-bool is_primitive_bool(Value v) {
-  return is_tagged_list_bool(v, make_symbol("prim"));
-}
-
-Value primitive_cons(Value args) {
-  assert(len(args) == 2_i);
-  Value car_ = car(args);
-  Value cdr_ = car(cdr(args));
-  return make_cons(car_, cdr_);
-}
-Value primitive_eq(Value args) {
-  assert(len(args) == 2_i);
-  Value car_ = car(args);
-  Value cdr_ = car(cdr(args));
-  return eq(car_, cdr_);
-}
-Value primitive_succ(Value arg, bool plus) {
-  assert(is_integer(arg));
-  if(plus) {
-    return succ(arg);
-  }
-  return pred(arg);
-}
-
-Value apply_primitive(Value name, Value args) {
-  if(eq_bool(name, make_symbol("cons"))) return primitive_cons(args);
-  if(eq_bool(name, make_symbol("car"))) return car(car(args)); // argに来るのはlistです。
-  if(eq_bool(name, make_symbol("cdr"))) return cdr(car(args));
-  if(eq_bool(name, make_symbol("eq"))) return primitive_eq(args);
-  if(eq_bool(name, make_symbol("atom"))) return atom(car(args));
-  if(eq_bool(name, make_symbol("succ"))) return primitive_succ(car(args), true);
-  if(eq_bool(name, make_symbol("pred"))) return primitive_succ(car(args), false);
-  if(eq_bool(name, make_symbol("apply"))) return apply(car(args), cdr(args));
-  throw "unknown primitive";
+Value call_primitive(Value f, Value const* args, std::size_t n) {
+  Primitive* prim = to_primitive(f);
+  if(prim->arity >= 0 && n != static_cast<std::size_t>(prim->arity)) throw "wrong number of arguments";
+  return prim->fn(args, n);
 }
 
 bool is_quoted_bool(Value v) {
@@ -178,33 +268,35 @@ bool is_define_bool(Value v) {
 bool is_lambda_bool(Value v) {
   return is_tagged_list_bool(v, make_symbol("lambda"));
 }
-bool is_procedure_bool(Value v) {
-  return is_tagged_list_bool(v, make_symbol("proced"));
-}
-
-Value procedure_args(Value f) {
-  assert(len(f) == 4_i);
-  return car(cdr(f));
-}
-Value procedure_body(Value f) {
-  assert(len(f) == 4_i);
-  return car(cdr(cdr(f)));
-}
-Value procedure_env(Value f) {
-  assert(len(f) == 4_i);
-  return car(cdr(cdr(cdr(f))));
-}
-
-Value bind_args(Value params, Value args, Value env) {
-  if(is_atom_bool(params)) { // `(lambda xs xs)`
-    return define_variable(params, args, env);
+bool is_future_bool(Value v) {
+  return is_tagged_list_bool(v, make_symbol("future"));
+}
+bool is_delay_bool(Value v) {
+  return is_tagged_list_bool(v, make_symbol("delay"));
+}
+bool is_defmacro_bool(Value v) {
+  static Value const defmacro = make_symbol("defmacro"); // 8文字なので毎回internしない
+  return is_tagged_list_bool(v, defmacro);
+}
+// 呼び出し1回分のframeを一度に確保して引数を詰める。
+Value bind_args(Value f, Value const* args, std::size_t n) {
+  Value params = closure_params(f);
+  std::int64_t const arity = closure_arity(f);
+  if(arity < 0) { // `(lambda xs xs)`
+    Value env = make_frame(closure_env(f), 1);
+    Value* slots = frame_slots(to_frame(env));
+    slots[0] = params;
+    slots[1] = materialize_args(args, n);
+    return env;
   }
   // `(lambda (x) x)`
-  assert(len(params) == len(args));
-  while(params != nil()) {
-    env = define_variable(car(params), car(args), env);
-    params = cdr(params);
-    args = cdr(args);
+  if(n < static_cast<std::size_t>(arity)) throw "too few arguments";
+  if(n > static_cast<std::size_t>(arity)) throw "too many arguments";
+  Value env = make_frame(closure_env(f), arity);
+  Value* slots = frame_slots(to_frame(env));
+  for(; params != nil(); params = cdr(params)) {
+    *slots++ = car(params);
+    *slots++ = *args++;
   }
   return env;
 }
@@ -223,16 +315,54 @@ std::tuple<Value, Value> eval_sequence(Value exps, Value env) {
   return eval_sequence(cdr(exps), env);
 }
 
-Value apply(Value f, Value args) {
-  if(is_primitive_bool(f)) {
-    Value name = car(cdr(f));
-    return apply_primitive(name, args);
+thread_local std::uint64_t closure_calls{};
+std::uint64_t closure_call_count() {
+  return closure_calls;
+}
+
+// 最適化した本体の前提(トップレベルの定義、optimizerのon/off)が変わっていたら、元の本体から作り直す。
+// futureのthreadはclosureを書き換えず、古ければ元の本体をそのまま評価する。評価する本体を返す。
+Value refresh_body(Value f) {
+  Closure* c = reinterpret_cast<Closure*>(to_object(f));
+  std::uint64_t const stamp = optimizer_stamp();
+  if(c->opt_stamp == stamp) [[likely]] return c->body;
+  if(on_worker_thread()) return c->env != nil() ? c->body : c->source;
+  c->opt_stamp = stamp;
+  if(c->env != nil()) return c->body; // 入れ子のlambdaは最適化しない(前提が変わっても作り直せないので)
+  c->body = optimizing() ? optimize_body(f) : c->source;
+  return c->body;
+}
+
+Value apply(Value f, Value const* args, std::size_t n) {
+  if(is_primitive(f)) {
+    return call_primitive(f, args, n);
   }
-  if(is_procedure_bool(f)) {
-    Value env = expand_env(procedure_env(f));
-    env = bind_args(procedure_args(f), args, env);
-    return std::get<0>(eval_sequence(procedure_body(f), env));
+  if(is_closure(f)) {
+    ++closure_calls;
+    Value const body = refresh_body(f);
+    if(on_worker_thread()) [[unlikely]] { // JITのcacheとprofilerはmain threadだけのもの
+      return std::get<0>(eval_sequence(body, bind_args(f, args, n)));
+    }
+    Value res;
+    if(profiling()) [[unlikely]] {
+      EscapeBarrier barrier;
+      if(profile_mode == ProfileMode::Heap) {
+        // heapは時間を測らないので、JITしたcodeのままで(中の呼び出しもhelper経由でここを通る)
+        HeapProfileScope scope{closure_name(f)};
+        if(jit_apply(f, args, n, res)) return res;
+        return std::get<0>(eval_sequence(body, bind_args(f, args, n)));
+      }
+      ProfileScope scope{closure_name(f)};
+      return std::get<0>(eval_sequence(body, bind_args(f, args, n)));
+    }
+    if(jit_apply(f, args, n, res)) {
+      return res;
+    }
+    return std::get<0>(eval_sequence(body, bind_args(f, args, n)));
   }
+  if(is_memo(f)) return apply_memo(f, args, n);
+  if(is_escape(f)) escape(f, args, n);
+  if(is_macro(f)) throw "cannot apply a macro";
   throw "ha?(apply)";
 }
 
@@ -253,6 +383,9 @@ std::tuple<Value, Value> eval_define(Value v, Value env) {
   if(is_atom_bool(names)) { // `(define x 42)`
     assert(is_symbol(names));
     std::tie(bodies, env) = eval(bodies, env);
+    if(is_closure(bodies) && closure_name(bodies) == nil()) {
+      set_closure_name(bodies, names); // profilerなどで表示する名前
+    }
     env = define_variable(names, bodies, env);
     return std::make_tuple(names, env);
   }
@@ -260,12 +393,26 @@ std::tuple<Value, Value> eval_define(Value v, Value env) {
   throw "unimpled yet...";
 }
 
-Value make_procedure(Value lambda, Value env) {
-  Value args = car(cdr(lambda));
-  Value body = cdr(cdr(lambda));
+// 引数の数が決まっているprimitiveは、引数をその場で評価してfnを直接呼ぶ。arg_stackも通さない。
+std::int64_t const max_direct_args = 3;
+std::tuple<Value, Value> eval_primitive_call(Value f, Value operands, Value env) {
+  Primitive* prim = to_primitive(f);
+  Value args[max_direct_args];
+  std::int64_t n{};
+  for(; operands != nil(); operands = cdr(operands), ++n) {
+    if(n == prim->arity) throw "wrong number of arguments";
+    std::tie(args[n], env) = eval(car(operands), env);
+  }
+  if(n != prim->arity) throw "wrong number of arguments";
+  return std::make_tuple(prim->fn(args, n), env);
+}
+
+Value make_procedure(Value exp, Value env) {
+  Value args = car(cdr(exp));
+  Value body = cdr(cdr(exp));
   // (lambda (x) x)
   // (lambda list list)
-  return list("proced", args, body, env);
+  return lambda(args, body, env);
 }
 
 std::tuple<Value, Value> eval(Value v, Value env) {
@@ -275,12 +422,26 @@ std::tuple<Value, Value> eval(Value v, Value env) {
   if(is_if_bool(v)) return eval_if(v, env);
   if(is_define_bool(v)) return eval_define(v, env);
   if(is_lambda_bool(v)) return std::make_tuple(make_procedure(v, env), env);
+  if(is_future_bool(v)) return std::make_tuple(make_future(lambda(nil(), cdr(v), env)), env); // `(future exp)`
+  if(is_delay_bool(v)) return std::make_tuple(make_promise(lambda(nil(), cdr(v), env)), env); // `(delay exp)`
+  if(is_defmacro_bool(v)) return std::make_tuple(define_macro(v, env), env);
   if(is_application(v)) {
     Value op = car(v);
+    if(is_expansion(op)) [[unlikely]] return eval(current_expansion(v, env), env); // 展開済みのmacroの呼び出し
     std::tie(op, env) = eval(op, env);
-    Value operands = cdr(v);
-    operands = list_of_values(operands, env);
-    return std::make_tuple(apply(op, operands), env);
+    if(is_primitive(op) && 0 <= to_primitive(op)->arity && to_primitive(op)->arity <= max_direct_args) {
+      return eval_primitive_call(op, cdr(v), env);
+    }
+    if(is_macro(op)) [[unlikely]] return eval(expand_macro(v, op), env);
+    ArgStackScope scope;
+    for(Value operands = cdr(v); operands != nil(); operands = cdr(operands)) {
+      Value arg;
+      std::tie(arg, env) = eval(car(operands), env);
+      arg_stack.push_back(arg);
+    }
+    Value const res = apply(op, scope.args(), scope.count());
+    scope.pop();
+    return std::make_tuple(res, env);
   }
   throw "pie";
 }
@@ -302,36 +463,47 @@ void skip_spaces(std::istream& is) {
   }
 }
 
+// `12` はfixnum、`1.5` `2e10` `1.5e-3` はdouble。
 Value read_number(std::istream& is) {
-  int peek;
-  std::int64_t res{};
-  while(peek = is.peek(), is_digit(peek)) {
-    res = res * 10 + peek - '0';
-    is.get();
+  std::string text;
+  auto const digits = [&] {
+    while(is_digit(is.peek())) text += static_cast<char>(is.get());
+  };
+  digits();
+  bool fractional = false;
+  if(is.peek() == '.') {
+    fractional = true;
+    text += static_cast<char>(is.get());
+    digits();
+  }
+  if(is.peek() == 'e') {
+    fractional = true;
+    text += static_cast<char>(is.get());
+    if(is.peek() == '-' || is.peek() == '+') text += static_cast<char>(is.get());
+    digits();
+  }
+  if(fractional) {
+    double d;
+    auto const [end, ec] = std::from_chars(text.data(), text.data() + text.size(), d);
+    if(ec != std::errc{} || end != text.data() + text.size()) throw "read fail";
+    return make_float(d);
   }
+  std::int64_t res{};
+  for(char c: text) res = res * 10 + c - '0';
   return to_Value(res);
 }
 
-Value reverse_impl(Value list, Value res) {
-  if(list == nil()) return res;
-  return reverse_impl(cdr(list), make_cons(car(list), res));
-}
-Value reverse(Value list) {
-  return reverse_impl(list, nil());
-}
-
 Value read_list(std::istream& is) {
   is.get(); // '('
   skip_spaces(is);
-  Value l = nil();
+  std::vector<Value> items; // readの途中でcollectはしないので、ここに置いておいても動かない
   while(is.peek() != ')') {
-    Value v = read(is);
-    l = make_cons(v, l);
+    items.push_back(read(is));
     skip_spaces(is);
   }
   char c = is.get(); // ')'
   assert(c == ')');
-  return reverse(l);
+  return make_list(items.data(), items.size());
 }
 
 bool is_alpha(char c) {
@@ -346,7 +518,7 @@ bool contains(std::set<T> const& s, T const& v) {
 }
 
 bool is_identifier_start(char c) {
-  std::set const s = {'*', '_', '-', '+', '/', '#', '?', '<', '>'};
+  std::set const s = {'*', '_', '-', '+', '/', '#', '?', '<', '>', '='};
   return is_alpha(c) || contains(s, c);
 }
 
@@ -391,40 +563,49 @@ Value read(std::istream& is) {
 bool const rethrow(false); // for debug, set true
 bool const showenv(true);
 
-[[noreturn]] void repl(std::istream& is) {
+void repl(std::istream& is) {
   Value env = initial_env();
   Value res;
+  std::size_t const depth = arg_stack_depth();
   while(true) {
     try{
       std::cout << "> ";
       Value input = read(is);
       std::cout << "# => " << show(input) << std::endl;
-      std::tie(res, env) = eval(input, env);
+      std::tie(res, env) = eval(optimize(input), env);
       std::cout << show(res) << std::endl;
     } catch(char const* msg) {
+      unwind_arg_stack(depth);
       std::cout << "*** catch ***" << std::endl;
       std::cout << msg << std::endl;
       if(rethrow) throw msg;
+    } catch(int) { // EOF
+      std::cout << std::endl;
+      return;
     }
     if(showenv) std::cout << "*** env:" << show_env(env) << std::endl;
     env = collect(env);
+    std::cout << alloc_stats().conses << " cons total allocations!" << std::endl;
   }
 }
 
 std::string show_env(Value env) {
-  if (!to_bool(eq(car(env), make_symbol("env")))) {
-    std::cout << "!!!!" << std::dec << car(env) << ' ' << std::hex << car(env) << std::endl;
-    std::cout << "env itself is : " << env << std::endl;
-    std::cout << show(car(env)) << std::endl;
-  }
-  assert(to_bool(eq(car(env), make_symbol("env"))));
-  Value assoc = get_assoc(env);
-  Value parent = get_parent(env);
   std::stringstream ss;
-  ss << "defined: { " << show(assoc, env) << " }";
-  if(parent != nil()) {
-    ss << ", parent: { " << show_env(parent) << " }";
+  if(env == nil()) {
+    ss << "defined: {";
+    for(auto const& [name, def]: globals.entries()) {
+      ss << " (" << show(name) << " . " << show(def) << ")";
+    }
+    ss << " }";
+    return ss.str();
+  }
+  Frame* frame = to_frame(env);
+  Value const* slots = frame_slots(frame);
+  ss << "defined: { " << show(frame->defined, env);
+  for(std::size_t i{}, size = frame_size(frame); i < size; ++i) {
+    ss << " (" << show(slots[2 * i]) << " . " << show(slots[2 * i + 1], env) << ")";
   }
+  ss << " }, parent: { " << show_env(frame->parent) << " }";
 
   return ss.str();
 }
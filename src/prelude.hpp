@@ -12,6 +12,12 @@ bool to_bool(Value v);
 
 Value initial_env();
 
+// C++で書いたprimitiveを名前をつけてenvに定義する。evalは `(name ...)` を見たらfnを直接呼ぶ。
+// arityが0以上なら引数の数はeval側で確かめてから呼ぶ。-1なら可変長。
+Value define_primitive(char const* name, std::int64_t arity, PrimitiveFn fn, Value env = nil());
+// envがnilならトップレベルのtableに入れる。
+Value define_variable(Value name, Value def, Value env);
+
 // pair of (evaled value, new env)
 std::tuple<Value, Value> eval(Value v, Value env);
 std::tuple<Value, Value> eval_define(Value v, Value env); // internai?
@@ -28,7 +34,29 @@ inline Value list(T v, Args&&...args) {
 }
 
 Value read(std::istream&);
-[[noreturn]] void repl(std::istream&);
+void repl(std::istream&); // EOFまで読んだら返る
 
 // for impl show
 std::string show_env(Value env);
+
+// for impl jit
+Value find(Value name, Value env);
+Value apply(Value f, Value const* args, std::size_t n);
+std::uint64_t global_epoch(); // 既にあるトップレベルの定義を上書きするたびに増える
+
+// for impl escape
+std::size_t arg_stack_depth(); // applicationの引数を積んでいる場所の今の高さ
+void unwind_arg_stack(std::size_t depth); // 例外やlongjmpで抜けたframeが積んだままの分を降ろす
+
+// for impl optimizer
+Value const* lookup_global(Value name); // 無ければnullptr
+std::uint64_t closure_call_count(); // applyでclosureを呼んだ回数(JITしたものも含む)
+
+// builtinのprimitive。jitやoptimizerは関数ポインタでどれなのかを見分ける。
+Value primitive_cons(Value const* args, std::size_t n);
+Value primitive_car(Value const* args, std::size_t n);
+Value primitive_cdr(Value const* args, std::size_t n);
+Value primitive_atom(Value const* args, std::size_t n);
+Value primitive_eq(Value const* args, std::size_t n);
+Value primitive_succ(Value const* args, std::size_t n);
+Value primitive_pred(Value const* args, std::size_t n);
@@ -0,0 +1,397 @@
+#include "profiler.hpp"
+#include "prelude.hpp"
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <vector>
+#include <csignal>
+#include <sys/time.h>
+
+ProfileMode profile_mode = ProfileMode::Off;
+std::vector<Value> heap_call_path;
+std::size_t heap_path_resolved{};
+
+namespace {
+
+// calling context treeの節。rootからの経路が呼び出しの経路になる。
+struct Node {
+  Value name; // closureの名前。無名ならnil
+  Node* parent;
+  std::vector<std::unique_ptr<Node>> children;
+  std::uint64_t calls{};
+  std::uint64_t total_ns{};
+  std::uint64_t self_ns{};
+  std::uint64_t total_allocs{};
+  std::uint64_t self_allocs{};
+  std::atomic<std::uint64_t> samples{}; // signal handlerから増やす
+  std::uint64_t heap_bytes{}; // Heap: ここで確保したbyte数とconsの数の見積もり
+  double heap_cells{};
+  std::uint64_t heap_hits{}; // Heap: ここで取ったsampleの数
+
+  Node(Value name, Node* parent) : name{name}, parent{parent}, children{} {}
+  Node* child(Value child_name) {
+    // 子は大抵数個しかないので線形探索
+    for(auto& c: children) {
+      if(c->name == child_name) return c.get();
+    }
+    children.push_back(std::make_unique<Node>(child_name, this));
+    return children.back().get();
+  }
+};
+
+struct Entry {
+  Node* node;
+  std::uint64_t start_ns;
+  std::uint64_t child_ns;
+  std::uint64_t start_allocs;
+  std::uint64_t child_allocs;
+};
+
+std::unique_ptr<Node> root;
+std::vector<Entry> shadow_stack;
+std::atomic<Node*> current{nullptr}; // SIGPROFのhandlerが読むのはこれだけ
+unsigned generation{};
+std::string output_path = "lilith.folded";
+
+// Heapで覚えたconsかobject。collectのたびに死んだものを捨て、生きていたものは引越し先に書き換える。
+struct HeapSample {
+  Value v;
+  Node* node;
+  std::uint64_t bytes; // このsampleが代表するbyte数
+  double cells;
+  bool survived; // collectを1度は生き延びた
+};
+std::vector<HeapSample> heap_samples;
+std::size_t heap_interval = 16 * 1024;
+bool const heap_samples_are_weak = (add_weak_roots([](WeakVisitor const& survive) {
+  std::erase_if(heap_samples, [&](HeapSample& s) {
+    if(!survive(s.v)) return true;
+    s.survived = true;
+    return false;
+  });
+}), true);
+
+// heap_call_pathの節。heap_path_resolvedまでは前のsampleで引いたものがそのまま使える。
+std::vector<Node*> heap_path_nodes;
+
+// 今の呼び出し経路の節を、前のsampleから変わった所だけ引く。
+// 自分をそのまま呼んだframeは1つにまとめる(深い再帰で経路が再帰の深さだけ伸びないように)。
+Node* heap_node() {
+  heap_path_nodes.resize(heap_call_path.size());
+  for(std::size_t i = heap_path_resolved; i < heap_call_path.size(); ++i) {
+    Node* const parent = i == 0 ? root.get() : heap_path_nodes[i - 1];
+    bool const self_call = i > 0 && heap_call_path[i] == heap_call_path[i - 1];
+    heap_path_nodes[i] = self_call ? parent : parent->child(heap_call_path[i]);
+  }
+  heap_path_resolved = heap_call_path.size();
+  return heap_call_path.empty() ? root.get() : heap_path_nodes.back();
+}
+
+void on_allocation(Value v, std::size_t bytes, std::size_t cells, std::size_t weight) {
+  Node* const node = heap_node();
+  double const c = static_cast<double>(cells) * static_cast<double>(weight) / static_cast<double>(bytes);
+  node->heap_bytes += weight;
+  node->heap_cells += c;
+  ++node->heap_hits;
+  heap_samples.push_back(HeapSample{v, node, weight, c, false});
+}
+
+std::uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::uint64_t allocations() {
+  auto const& stats = alloc_stats();
+  return stats.conses + stats.objects;
+}
+
+void on_sigprof(int) {
+  if(Node* node = current.load(std::memory_order_relaxed)) {
+    node->samples.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+std::string name_of(Value name) {
+  if(name == nil()) return "#<lambda>";
+  return show(name);
+}
+
+struct Flat {
+  std::uint64_t calls{};
+  std::uint64_t total_ns{};
+  std::uint64_t self_ns{};
+  std::uint64_t total_allocs{};
+  std::uint64_t self_allocs{};
+  std::uint64_t total_samples{};
+  std::uint64_t self_samples{};
+};
+
+std::uint64_t subtree_samples(Node const* node) {
+  std::uint64_t res = node->samples.load(std::memory_order_relaxed);
+  for(auto const& c: node->children) res += subtree_samples(c.get());
+  return res;
+}
+
+// 再帰している時にinclusiveを二重に数えないよう、経路上で最初に現れた所でだけ足す。
+void flatten(Node const* node, std::map<Value, Flat>& flat, std::vector<Value>& path) {
+  for(auto const& c: node->children) {
+    Flat& f = flat[c->name];
+    f.calls += c->calls;
+    f.self_ns += c->self_ns;
+    f.self_allocs += c->self_allocs;
+    f.self_samples += c->samples.load(std::memory_order_relaxed);
+    if(std::find(begin(path), end(path), c->name) == end(path)) {
+      f.total_ns += c->total_ns;
+      f.total_allocs += c->total_allocs;
+      f.total_samples += subtree_samples(c.get());
+    }
+    path.push_back(c->name);
+    flatten(c.get(), flat, path);
+    path.pop_back();
+  }
+}
+
+void write_folded(Node const* node, std::string const& prefix, bool sampled, std::ostream& os) {
+  for(auto const& c: node->children) {
+    std::string const path = prefix.empty() ? name_of(c->name) : prefix + ';' + name_of(c->name);
+    std::uint64_t const weight = sampled ? c->samples.load(std::memory_order_relaxed) : c->self_ns / 1000;
+    if(weight > 0) os << path << ' ' << weight << '\n';
+    write_folded(c.get(), path, sampled, os);
+  }
+}
+
+// Heapの経路ごとの、最後のcollectを生き延びたsampleの合計
+struct Retained {
+  std::uint64_t bytes{};
+  double cells{};
+};
+std::map<Node const*, Retained> retained_by_node() {
+  std::map<Node const*, Retained> res;
+  for(auto const& s: heap_samples) {
+    if(!s.survived) continue;
+    res[s.node].bytes += s.bytes;
+    res[s.node].cells += s.cells;
+  }
+  return res;
+}
+
+std::string heap_name_of(Node const* node) {
+  return node == root.get() ? "(toplevel)" : name_of(node->name);
+}
+
+void write_heap_folded(Node const* node, std::string const& prefix, std::map<Node const*, Retained> const* retained, std::ostream& os) {
+  std::string const path = node == root.get() ? heap_name_of(node) : prefix + ';' + name_of(node->name);
+  std::uint64_t weight = node->heap_bytes;
+  if(retained) {
+    auto const it = retained->find(node);
+    weight = it == end(*retained) ? 0 : it->second.bytes;
+  }
+  if(weight > 0) os << path << ' ' << weight << '\n';
+  for(auto const& c: node->children) write_heap_folded(c.get(), path, retained, os);
+}
+
+void write_heap_report(std::ostream& os) {
+  struct Row {
+    std::uint64_t samples{};
+    std::uint64_t bytes{};
+    double cells{};
+    Retained retained;
+  };
+  auto const retained = retained_by_node();
+  std::map<std::string, Row> rows;
+  auto const add = [&](auto const& self, Node const* node) -> void {
+    Row& r = rows[heap_name_of(node)];
+    r.samples += node->heap_hits;
+    r.bytes += node->heap_bytes;
+    r.cells += node->heap_cells;
+    if(auto const it = retained.find(node); it != end(retained)) {
+      r.retained.bytes += it->second.bytes;
+      r.retained.cells += it->second.cells;
+    }
+    for(auto const& c: node->children) self(self, c.get());
+  };
+  add(add, root.get());
+  std::vector<std::pair<std::string, Row>> sorted(begin(rows), end(rows));
+  std::sort(begin(sorted), end(sorted), [](auto const& lhs, auto const& rhs) {
+    if(lhs.second.retained.bytes != rhs.second.retained.bytes) return lhs.second.retained.bytes > rhs.second.retained.bytes;
+    return lhs.second.bytes > rhs.second.bytes;
+  });
+  os << std::left << std::setw(24) << "function" << std::right
+     << std::setw(12) << "samples"
+     << std::setw(14) << "alloc_kb"
+     << std::setw(14) << "alloc_cells"
+     << std::setw(14) << "retained_kb"
+     << std::setw(16) << "retained_cells" << '\n';
+  for(auto const& [name, r]: sorted) {
+    if(r.bytes == 0 && r.retained.bytes == 0) continue;
+    os << std::left << std::setw(24) << name << std::right
+       << std::setw(12) << r.samples
+       << std::setw(14) << std::fixed << std::setprecision(1) << r.bytes / 1024.0
+       << std::setw(14) << std::setprecision(0) << r.cells
+       << std::setw(14) << std::setprecision(1) << r.retained.bytes / 1024.0
+       << std::setw(16) << std::setprecision(0) << r.retained.cells << '\n';
+  }
+  os << "(one sample per " << heap_interval << " bytes; " << heap_samples.size() << " samples still live)\n";
+}
+
+void write_report(std::ostream& os, bool sampled) {
+  std::map<Value, Flat> flat;
+  std::vector<Value> path;
+  flatten(root.get(), flat, path);
+  std::vector<std::pair<Value, Flat>> rows(begin(flat), end(flat));
+  std::sort(begin(rows), end(rows), [sampled](auto const& lhs, auto const& rhs) {
+    if(sampled) return lhs.second.self_samples > rhs.second.self_samples;
+    return lhs.second.self_ns > rhs.second.self_ns;
+  });
+
+  os << std::left << std::setw(24) << "function" << std::right
+     << std::setw(12) << "calls"
+     << std::setw(12) << "incl_ms"
+     << std::setw(12) << "excl_ms"
+     << std::setw(14) << "incl_allocs"
+     << std::setw(14) << "excl_allocs";
+  if(sampled) os << std::setw(12) << "incl_smpl" << std::setw(12) << "excl_smpl";
+  os << '\n';
+  for(auto const& [name, f]: rows) {
+    os << std::left << std::setw(24) << name_of(name) << std::right
+       << std::setw(12) << f.calls
+       << std::setw(12) << std::fixed << std::setprecision(3) << f.total_ns / 1e6
+       << std::setw(12) << f.self_ns / 1e6
+       << std::setw(14) << f.total_allocs
+       << std::setw(14) << f.self_allocs;
+    if(sampled) os << std::setw(12) << f.total_samples << std::setw(12) << f.self_samples;
+    os << '\n';
+  }
+}
+
+} // namespace
+
+void profile_start(ProfileMode mode) {
+  if(profiling()) return;
+  ++generation;
+  root = std::make_unique<Node>(nil(), nullptr);
+  shadow_stack.clear();
+  current.store(root.get(), std::memory_order_relaxed);
+  profile_mode = mode;
+
+  if(mode == ProfileMode::Heap) {
+    heap_samples.clear();
+    heap_path_resolved = 0; // rootを作り直したので
+    set_allocation_sampler(heap_interval, on_allocation);
+  }
+
+  if(mode == ProfileMode::Sample) {
+    struct sigaction sa{};
+    sa.sa_handler = on_sigprof;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, nullptr);
+    itimerval timer{};
+    timer.it_interval.tv_usec = 1000; // 1ms
+    timer.it_value.tv_usec = 1000;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+  }
+}
+
+void profile_stop(std::ostream& report, char const* folded_path) {
+  if(!profiling()) return;
+  if(profile_mode == ProfileMode::Heap) {
+    set_allocation_sampler(0, nullptr);
+    profile_mode = ProfileMode::Off;
+    current.store(nullptr, std::memory_order_relaxed);
+    ++generation;
+    write_heap_report(report);
+    auto const retained = retained_by_node();
+    std::ofstream folded{folded_path};
+    write_heap_folded(root.get(), "", &retained, folded);
+    std::string const alloc_path = std::string{folded_path} + ".alloc";
+    std::ofstream alloc_folded{alloc_path};
+    write_heap_folded(root.get(), "", nullptr, alloc_folded);
+    report << "collapsed stacks (retained bytes) written to " << folded_path << ", (allocated bytes) to " << alloc_path << std::endl;
+    heap_samples.clear();
+    shadow_stack.clear();
+    return;
+  }
+  bool const sampled = profile_mode == ProfileMode::Sample;
+  if(sampled) {
+    itimerval timer{};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    std::signal(SIGPROF, SIG_IGN);
+  }
+  profile_mode = ProfileMode::Off;
+  current.store(nullptr, std::memory_order_relaxed);
+  ++generation;
+
+  write_report(report, sampled);
+  std::ofstream folded{folded_path};
+  write_folded(root.get(), "", sampled, folded);
+  report << "collapsed stacks (" << (sampled ? "samples" : "microseconds") << ") written to " << folded_path << std::endl;
+  shadow_stack.clear();
+}
+
+void profile_stop() {
+  profile_stop(std::cout, output_path.c_str());
+}
+
+void set_profile_output(char const* folded_path) {
+  output_path = folded_path;
+}
+
+void set_heap_sample_interval(std::size_t bytes) {
+  heap_interval = std::max<std::size_t>(bytes, 1);
+}
+
+ProfileScope::ProfileScope(Value name) : generation{::generation} {
+  Node* parent = shadow_stack.empty() ? root.get() : shadow_stack.back().node;
+  Node* node = parent->child(name);
+  ++node->calls;
+  std::uint64_t const start = profile_mode == ProfileMode::Trace ? now_ns() : 0;
+  shadow_stack.push_back(Entry{node, start, 0, allocations(), 0});
+  current.store(node, std::memory_order_relaxed);
+}
+
+ProfileScope::~ProfileScope() {
+  if(generation != ::generation) return;
+  Entry const e = shadow_stack.back();
+  shadow_stack.pop_back();
+  std::uint64_t const elapsed = profile_mode == ProfileMode::Trace ? now_ns() - e.start_ns : 0;
+  std::uint64_t const allocs = allocations() - e.start_allocs;
+  e.node->total_ns += elapsed;
+  e.node->self_ns += elapsed - e.child_ns;
+  e.node->total_allocs += allocs;
+  e.node->self_allocs += allocs - e.child_allocs;
+  if(shadow_stack.empty()) {
+    current.store(root.get(), std::memory_order_relaxed);
+  } else {
+    shadow_stack.back().child_ns += elapsed;
+    shadow_stack.back().child_allocs += allocs;
+    current.store(shadow_stack.back().node, std::memory_order_relaxed);
+  }
+}
+
+Value primitive_profile_start(Value const* args, std::size_t n) {
+  if(n > 1) throw "wrong number of arguments";
+  ProfileMode mode = ProfileMode::Trace;
+  if(n == 1 && args[0] == make_symbol("sample")) mode = ProfileMode::Sample;
+  if(n == 1 && args[0] == make_symbol("heap")) mode = ProfileMode::Heap;
+  profile_start(mode);
+  return t();
+}
+
+Value primitive_profile_stop(Value const*, std::size_t) {
+  profile_stop();
+  return t();
+}
+
+Value define_profiler_primitives(Value env) {
+  env = define_primitive("profile-start", -1, primitive_profile_start, env);
+  env = define_primitive("profile-stop", 0, primitive_profile_stop, env);
+  return env;
+}
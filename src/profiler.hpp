@@ -0,0 +1,62 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstddef>
+#include <iosfwd>
+#include <vector>
+
+// Lispの関数ごとのprofiler。applyがclosureに入るたびにshadow stackに積んで、
+// 呼び出し経路ごと(calling context tree)に数える(Heapは名前だけを積み、経路はsampleの時に引く)。
+//   Trace:  呼び出し回数、inclusive/exclusiveの時間とallocationを数える。
+//   Sample: SIGPROFのtimerで、その時shadow stackの一番上にいる関数を数える。
+//   Heap:   約heap_sample_interval byte確保するごとに1回、その時の呼び出し経路とconsかobjectを覚える(JITは止めない)。
+//           collectの後にも生きていたsampleを、その経路が残しているもの(retained)として数える。
+//           reportは経路ごとの確保と残っている量の見積もり(sampleの数 × 代表するbyte数)。
+//           collapsed stackは残っているbyte数で、確保したbyte数のものは `<folded_path>.alloc` に書く。
+//           自分を直接呼ぶ再帰は1段にまとめる。互いに呼び合う再帰はまとめないので、その深さだけ経路が長くなる
+//           (collapsed stackの大きさは 経路の数 × 深さ)。
+enum class ProfileMode {
+  Off,
+  Trace,
+  Sample,
+  Heap,
+};
+
+extern ProfileMode profile_mode;
+inline bool profiling() { return profile_mode != ProfileMode::Off; }
+
+void profile_start(ProfileMode mode);
+// 止めて、関数ごとのflat reportをreportに書き、collapsed stack(flamegraph.plに渡せる形式)をfolded_pathに書く。
+void profile_stop(std::ostream& report, char const* folded_path);
+// reportは標準出力に、collapsed stackはset_profile_outputで決めた先(lilith.folded)に書く。`(profile-stop)` もこれ。
+void profile_stop();
+void set_profile_output(char const* folded_path);
+void set_heap_sample_interval(std::size_t bytes); // Heapのsampleの間隔(16KiB)。1なら全部の確保
+
+// closureの本体を評価している間、shadow stackに積んでおく。
+class ProfileScope {
+  unsigned generation; // 途中でprofile-stop/startされたら降ろさない
+public:
+  explicit ProfileScope(Value name);
+  ~ProfileScope();
+  ProfileScope(ProfileScope const&) = delete;
+  ProfileScope& operator=(ProfileScope const&) = delete;
+};
+
+// Heapの時にclosureの本体を評価している間、名前だけを積んでおく。
+extern std::vector<Value> heap_call_path;
+extern std::size_t heap_path_resolved; // 先頭からこの数までは、前のsampleで節を引いたのと同じ経路
+class HeapProfileScope {
+public:
+  explicit HeapProfileScope(Value name) { heap_call_path.push_back(name); }
+  ~HeapProfileScope() {
+    heap_call_path.pop_back();
+    if(heap_path_resolved > heap_call_path.size()) heap_path_resolved = heap_call_path.size();
+  }
+  HeapProfileScope(HeapProfileScope const&) = delete;
+  HeapProfileScope& operator=(HeapProfileScope const&) = delete;
+};
+
+// `(profile-start)`, `(profile-start (quote sample))`, `(profile-start (quote heap))`, `(profile-stop)`
+Value define_profiler_primitives(Value env);
@@ -0,0 +1,300 @@
+#include "server.hpp"
+#include "allocator.hpp"
+#include "future.hpp"
+#include "optimizer.hpp"
+#include "prelude.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+struct Session {
+  int fd;
+  Value env; // このsessionのdefineが入るframe。親はnil(globals)
+  std::string in; // まだ改行が来ていない所
+  std::string out; // まだ書けていない所
+  std::deque<std::string> requests;
+  bool busy = false; // 1行をpoolで評価している
+  bool closed = false; // 相手が閉じた。busyなら終わるまで消さない
+  bool want_write = false; // EPOLLOUTを待っている
+};
+
+// epollのdataに入れる番号。sessionはfdを閉じた後も残ることがあるので、fdではなく番号で引く。
+constexpr std::uint64_t listener_id = 0;
+constexpr std::uint64_t completion_id = 1;
+constexpr std::uint64_t signal_id = 2;
+
+std::unordered_map<std::uint64_t, std::unique_ptr<Session>> sessions;
+bool const sessions_are_roots = (add_roots([](RootVisitor const& visit) {
+  for(auto& e: sessions) visit(e.second->env);
+}), true);
+
+// poolのthreadが評価し終えた行。epollのthreadにはeventfdで知らせる。
+struct Completion {
+  std::uint64_t id;
+  std::string text;
+};
+std::mutex completions_m;
+std::vector<Completion> completions;
+
+// poolのthreadで。Lispの値はenvの中にだけ残して、返すのは文字列にする。
+std::string evaluate(std::string const& line, Value env) {
+  std::stringstream ss{line};
+  Value res = nil();
+  std::size_t const depth = arg_stack_depth(); // errorで抜けたevalの引数は積んだままなので、このthreadの分を降ろす
+  try {
+    while(true) {
+      while(ss.peek() == ' ' || ss.peek() == '\t') ss.get();
+      if(ss.peek() == EOF) break;
+      std::tie(res, env) = eval(read(ss), env);
+    }
+  } catch(char const* msg) {
+    unwind_arg_stack(depth);
+    return std::string{"error: "} + msg;
+  } catch(int) { // EOF
+    unwind_arg_stack(depth);
+    return "error: unexpected end of line";
+  } catch(...) {
+    unwind_arg_stack(depth);
+    return "error: unknown error";
+  }
+  return show(res);
+}
+
+class Server {
+  int epoll;
+  int listener;
+  int completion_fd;
+  int signal_fd;
+  std::uint64_t next_id = signal_id + 1;
+  std::size_t in_flight = 0;
+  std::size_t since_collect = 0;
+  std::size_t const collect_every;
+  bool collecting = false; // 新しい行を評価せずに、今のが終わるのを待っている
+
+  void watch(int fd, std::uint64_t id, std::uint32_t events, int op = EPOLL_CTL_ADD) {
+    epoll_event ev{};
+    ev.events = events;
+    ev.data.u64 = id;
+    if(epoll_ctl(epoll, op, fd, &ev) != 0) throw "serve: epoll_ctl failed";
+  }
+
+  void accept_all() {
+    while(true) {
+      int const fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if(fd < 0) return; // EAGAIN(やEMFILE)なら次に読めるようになった時に
+      std::uint64_t const id = next_id++;
+      auto s = std::make_unique<Session>();
+      s->fd = fd;
+      s->env = make_frame(nil(), 0);
+      sessions.emplace(id, std::move(s));
+      watch(fd, id, EPOLLIN);
+    }
+  }
+
+  void close_session(std::uint64_t id, Session& s) {
+    if(!s.closed) {
+      s.closed = true;
+      close(s.fd); // epollからも外れる
+    }
+    if(!s.busy) sessions.erase(id);
+  }
+
+  void read_session(std::uint64_t id, Session& s) {
+    char buf[4096];
+    while(true) {
+      ssize_t const n = read(s.fd, buf, sizeof(buf));
+      if(n > 0) {
+        s.in.append(buf, static_cast<std::size_t>(n));
+        continue;
+      }
+      if(n < 0 && errno == EAGAIN) break;
+      return close_session(id, s); // 0(相手が閉じた)かerror
+    }
+    std::size_t start = 0;
+    for(std::size_t nl; (nl = s.in.find('\n', start)) != std::string::npos; start = nl + 1) {
+      std::size_t end = nl;
+      if(end > start && s.in[end - 1] == '\r') --end;
+      s.requests.push_back(s.in.substr(start, end - start));
+    }
+    s.in.erase(0, start);
+    dispatch(id, s);
+  }
+
+  void write_session(std::uint64_t id, Session& s) {
+    while(!s.out.empty()) {
+      ssize_t const n = send(s.fd, s.out.data(), s.out.size(), MSG_NOSIGNAL);
+      if(n < 0) {
+        if(errno == EAGAIN) break;
+        return close_session(id, s);
+      }
+      s.out.erase(0, static_cast<std::size_t>(n));
+    }
+    bool const want = !s.out.empty();
+    if(want != s.want_write) {
+      s.want_write = want;
+      watch(s.fd, id, want ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD);
+    }
+  }
+
+  void dispatch(std::uint64_t id, Session& s) {
+    if(s.busy || s.closed || collecting || s.requests.empty()) return;
+    s.busy = true;
+    ++in_flight;
+    std::string line = std::move(s.requests.front());
+    s.requests.pop_front();
+    Value const env = s.env;
+    int const fd = completion_fd;
+    submit_job([id, line = std::move(line), env, fd] {
+      std::string text = evaluate(line, env);
+      {
+        std::lock_guard lk{completions_m};
+        completions.push_back(Completion{id, std::move(text)});
+      }
+      std::uint64_t const one = 1;
+      [[maybe_unused]] ssize_t const n = write(fd, &one, sizeof(one));
+    });
+  }
+
+  void complete_all() {
+    std::uint64_t count;
+    [[maybe_unused]] ssize_t const n = read(completion_fd, &count, sizeof(count));
+    std::vector<Completion> done;
+    {
+      std::lock_guard lk{completions_m};
+      std::swap(done, completions);
+    }
+    for(Completion& c: done) {
+      --in_flight;
+      ++since_collect;
+      auto const it = sessions.find(c.id);
+      Session& s = *it->second;
+      s.busy = false;
+      if(s.closed) {
+        sessions.erase(it);
+        continue;
+      }
+      s.out += c.text;
+      s.out += '\n';
+      write_session(c.id, s);
+    }
+    if(since_collect >= collect_every) collecting = true;
+    if(collecting && in_flight == 0) {
+      collect(nil()); // sessionのenvはadd_rootsで
+      since_collect = 0;
+      collecting = false;
+    }
+    if(collecting) return;
+    for(auto& e: sessions) dispatch(e.first, *e.second);
+  }
+
+public:
+  Server(char const* path, std::size_t collect_every) : collect_every{collect_every} {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if(std::strlen(path) >= sizeof(addr.sun_path)) throw "serve: socket path is too long";
+    std::strcpy(addr.sun_path, path);
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listener < 0) throw "serve: cannot create socket";
+    unlink(path);
+    if(bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) throw "serve: cannot bind socket";
+    if(listen(listener, SOMAXCONN) != 0) throw "serve: cannot listen";
+    // poolのthreadを作る前に止めておけば、全部のthreadで止まる(signalfdだけが受け取る)
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    if(signal_fd < 0 || completion_fd < 0 || epoll < 0) throw "serve: cannot create descriptors";
+    watch(listener, listener_id, EPOLLIN);
+    watch(completion_fd, completion_id, EPOLLIN);
+    watch(signal_fd, signal_id, EPOLLIN);
+  }
+
+  void run() {
+    epoll_event events[64];
+    while(true) {
+      int const n = epoll_wait(epoll, events, 64, -1);
+      if(n < 0) {
+        if(errno == EINTR) continue;
+        throw "serve: epoll_wait failed";
+      }
+      for(int i{}; i < n; ++i) {
+        std::uint64_t const id = events[i].data.u64;
+        if(id == signal_id) return;
+        if(id == listener_id) {
+          accept_all();
+          continue;
+        }
+        if(id == completion_id) {
+          complete_all();
+          continue;
+        }
+        auto const it = sessions.find(id);
+        if(it == end(sessions) || it->second->closed) continue; // 同じepoll_waitで先に閉じた
+        Session& s = *it->second;
+        if(events[i].events & EPOLLOUT) write_session(id, s);
+        if(sessions.count(id) && !s.closed && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) read_session(id, s);
+      }
+    }
+  }
+
+  // 評価中の行を待ってから閉じる。
+  void shutdown(char const* path) {
+    wait_for_futures();
+    for(auto& e: sessions) {
+      if(!e.second->closed) close(e.second->fd);
+    }
+    sessions.clear();
+    completions.clear();
+    close(listener);
+    close(completion_fd);
+    close(signal_fd);
+    close(epoll);
+    unlink(path);
+  }
+};
+
+} // namespace
+
+void serve(char const* socket_path, std::size_t collect_every) {
+  Server server{socket_path, collect_every == 0 ? 1 : collect_every};
+  try {
+    server.run();
+  } catch(...) {
+    server.shutdown(socket_path);
+    throw;
+  }
+  server.shutdown(socket_path);
+}
+
+void preload(char const* path) {
+  std::ifstream is{path};
+  if(!is) throw "preload: cannot open file";
+  Value env = nil();
+  try {
+    while(true) std::tie(std::ignore, env) = eval(optimize(read(is)), env);
+  } catch(int) { // EOF
+  }
+  collect(env);
+}
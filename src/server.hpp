@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+
+// `lilith serve path` のdaemon。Unix domain socketで待って、接続ごとにsessionを作る。
+// preludeなどのトップレベルの定義(globals)は起動した時に一度だけ作って、全部のsessionで共有する。
+// sessionのenvは親がglobalsの空のframeで、sessionの中のdefineはそこに入る(globalsは書き換えない)。
+// 同じ名前をdefineすればそのsessionの中だけで上書きされ、他のsessionには見えない(copy-on-write)。
+//
+// 1行に式を書いて送ると、順に評価して最後の値をshowした1行を返す。errorなら `error: message` の1行。
+// 同じsessionの行は送った順に1つずつ評価する。別のsessionの行はfuture.hppのpoolのthreadで同時に評価する
+// (別threadなのでJITとprofilerは使わない)。poolを使わないbuildではepollのthreadでその場で評価する。
+// epollのthreadは接続の読み書きだけをして、collect_every行を返すごとに評価が全部終わるのを待ってcollectする。
+// SIGINTかSIGTERMでsocketのfileを消して返る。
+void serve(char const* socket_path, std::size_t collect_every = 256);
+
+// fileの式をトップレベルで順に評価する(serveの前に、共有するglobalsに定義を足しておく)。
+void preload(char const* path);
@@ -0,0 +1,587 @@
+#include "typed_array.hpp"
+#include "allocator.hpp"
+#include "prelude.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__)
+#define LILITH_SIMD 1
+#include <immintrin.h>
+#else
+#define LILITH_SIMD 0
+#endif
+
+namespace {
+
+enum class ElementType : std::uint8_t {
+  F64,
+  I64,
+};
+
+struct TypedArray {
+  Object header;
+  ElementType type;
+  std::uint64_t length;
+  // この後にlength個の要素
+};
+
+TypedArray* to_array(Value v) {
+  if(!is_typed_array(v)) throw "not an array";
+  return reinterpret_cast<TypedArray*>(to_object(v));
+}
+double* f64(TypedArray* a) { return reinterpret_cast<double*>(a + 1); }
+std::int64_t* i64(TypedArray* a) { return reinterpret_cast<std::int64_t*>(a + 1); }
+
+TypedArray* alloc_array(ElementType type, std::size_t n) {
+  auto const a = reinterpret_cast<TypedArray*>(alloc_object(sizeof(TypedArray) + n * sizeof(double)));
+  a->header = Object{ObjectKind::TypedArray, false, 0}; // 要素はValueではないのでGCは辿らない
+  a->type = type;
+  a->length = n;
+  return a;
+}
+Value to_Value(TypedArray* a) {
+  return ::to_Value(&a->header, nullptr);
+}
+
+constexpr std::int64_t fixnum_min = -(std::int64_t{1} << 61);
+constexpr std::int64_t fixnum_max = (std::int64_t{1} << 61) - 1;
+Value fixnum(std::int64_t x) {
+  if(x < fixnum_min || fixnum_max < x) throw "fixnum overflow";
+  return ::to_Value(x);
+}
+double number(Value v) {
+  if(is_integer(v)) return static_cast<double>(to_int(v));
+  if(is_float(v)) return to_double(v);
+  throw "array: not a number";
+}
+std::int64_t wrap_add(std::int64_t x, std::int64_t y) {
+  return static_cast<std::int64_t>(static_cast<std::uint64_t>(x) + static_cast<std::uint64_t>(y));
+}
+std::int64_t wrap_mul(std::int64_t x, std::int64_t y) {
+  return static_cast<std::int64_t>(static_cast<std::uint64_t>(x) * static_cast<std::uint64_t>(y));
+}
+
+// f64の和は要素iをlanes[i % 8]に足していき、最後にこの順でまとめてから余りを足す。
+constexpr std::size_t lanes = 8;
+double finish_sum(double const* l, double const* rest, std::size_t n) {
+  double s = ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+  for(std::size_t i{}; i < n; ++i) s += rest[i];
+  return s;
+}
+double finish_dot(double const* l, double const* a, double const* b, std::size_t n) {
+  double s = ((l[0] + l[1]) + (l[2] + l[3])) + ((l[4] + l[5]) + (l[6] + l[7]));
+  for(std::size_t i{}; i < n; ++i) s += a[i] * b[i];
+  return s;
+}
+
+struct Kernels {
+  double (*f64_sum)(double const* a, std::size_t n);
+  double (*f64_dot)(double const* a, double const* b, std::size_t n);
+  double (*f64_min)(double const* a, std::size_t n); // nは1以上
+  double (*f64_max)(double const* a, std::size_t n);
+  void (*f64_add)(double* out, double const* a, double const* b, std::size_t n);
+  void (*f64_scale)(double* out, double const* a, double k, std::size_t n);
+  void (*f64_select_less)(double* out, double const* a, double const* b, double const* x, double const* y, std::size_t n);
+  std::int64_t (*i64_sum)(std::int64_t const* a, std::size_t n);
+  std::int64_t (*i64_min)(std::int64_t const* a, std::size_t n);
+  std::int64_t (*i64_max)(std::int64_t const* a, std::size_t n);
+  void (*i64_add)(std::int64_t* out, std::int64_t const* a, std::int64_t const* b, std::size_t n);
+  void (*i64_select_less)(std::int64_t* out, std::int64_t const* a, std::int64_t const* b, std::int64_t const* x, std::int64_t const* y, std::size_t n);
+};
+
+// minとmaxはminpd/maxpdと同じく `a < b ? a : b` (NaNが混ざった時の結果は選んだものによる)。
+namespace scalar {
+double f64_sum(double const* a, std::size_t n) {
+  double l[lanes]{};
+  std::size_t i{};
+  for(; i + lanes <= n; i += lanes) {
+    for(std::size_t j{}; j < lanes; ++j) l[j] += a[i + j];
+  }
+  return finish_sum(l, a + i, n - i);
+}
+double f64_dot(double const* a, double const* b, std::size_t n) {
+  double l[lanes]{};
+  std::size_t i{};
+  for(; i + lanes <= n; i += lanes) {
+    for(std::size_t j{}; j < lanes; ++j) l[j] += a[i + j] * b[i + j];
+  }
+  return finish_dot(l, a + i, b + i, n - i);
+}
+double f64_min(double const* a, std::size_t n) {
+  double m = a[0];
+  for(std::size_t i = 1; i < n; ++i) m = m < a[i] ? m : a[i];
+  return m;
+}
+double f64_max(double const* a, std::size_t n) {
+  double m = a[0];
+  for(std::size_t i = 1; i < n; ++i) m = m > a[i] ? m : a[i];
+  return m;
+}
+void f64_add(double* out, double const* a, double const* b, std::size_t n) {
+  for(std::size_t i{}; i < n; ++i) out[i] = a[i] + b[i];
+}
+void f64_scale(double* out, double const* a, double k, std::size_t n) {
+  for(std::size_t i{}; i < n; ++i) out[i] = a[i] * k;
+}
+void f64_select_less(double* out, double const* a, double const* b, double const* x, double const* y, std::size_t n) {
+  for(std::size_t i{}; i < n; ++i) out[i] = a[i] < b[i] ? x[i] : y[i];
+}
+std::int64_t i64_sum(std::int64_t const* a, std::size_t n) {
+  std::int64_t s{};
+  for(std::size_t i{}; i < n; ++i) s = wrap_add(s, a[i]);
+  return s;
+}
+std::int64_t i64_min(std::int64_t const* a, std::size_t n) {
+  return *std::min_element(a, a + n);
+}
+std::int64_t i64_max(std::int64_t const* a, std::size_t n) {
+  return *std::max_element(a, a + n);
+}
+void i64_add(std::int64_t* out, std::int64_t const* a, std::int64_t const* b, std::size_t n) {
+  for(std::size_t i{}; i < n; ++i) out[i] = wrap_add(a[i], b[i]);
+}
+void i64_select_less(std::int64_t* out, std::int64_t const* a, std::int64_t const* b, std::int64_t const* x, std::int64_t const* y, std::size_t n) {
+  for(std::size_t i{}; i < n; ++i) out[i] = a[i] < b[i] ? x[i] : y[i];
+}
+} // namespace scalar
+
+constexpr Kernels scalar_kernels{
+  scalar::f64_sum, scalar::f64_dot, scalar::f64_min, scalar::f64_max, scalar::f64_add, scalar::f64_scale, scalar::f64_select_less,
+  scalar::i64_sum, scalar::i64_min, scalar::i64_max, scalar::i64_add, scalar::i64_select_less,
+};
+
+#if LILITH_SIMD
+// 2要素ずつ。lanesの8つは4本のregisterに分ける。
+namespace sse {
+#define SSE [[gnu::target("sse4.2")]]
+SSE double f64_sum(double const* a, std::size_t n) {
+  __m128d s[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+  std::size_t i{};
+  for(; i + lanes <= n; i += lanes) {
+    for(int j{}; j < 4; ++j) s[j] = _mm_add_pd(s[j], _mm_loadu_pd(a + i + 2 * j));
+  }
+  double l[lanes];
+  for(int j{}; j < 4; ++j) _mm_storeu_pd(l + 2 * j, s[j]);
+  return finish_sum(l, a + i, n - i);
+}
+SSE double f64_dot(double const* a, double const* b, std::size_t n) {
+  __m128d s[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd()};
+  std::size_t i{};
+  for(; i + lanes <= n; i += lanes) {
+    for(int j{}; j < 4; ++j) s[j] = _mm_add_pd(s[j], _mm_mul_pd(_mm_loadu_pd(a + i + 2 * j), _mm_loadu_pd(b + i + 2 * j)));
+  }
+  double l[lanes];
+  for(int j{}; j < 4; ++j) _mm_storeu_pd(l + 2 * j, s[j]);
+  return finish_dot(l, a + i, b + i, n - i);
+}
+SSE double f64_min(double const* a, std::size_t n) {
+  if(n < 2) return scalar::f64_min(a, n);
+  __m128d m = _mm_loadu_pd(a);
+  std::size_t i = 2;
+  for(; i + 2 <= n; i += 2) m = _mm_min_pd(m, _mm_loadu_pd(a + i));
+  double l[2];
+  _mm_storeu_pd(l, m);
+  double r = l[0] < l[1] ? l[0] : l[1];
+  for(; i < n; ++i) r = r < a[i] ? r : a[i];
+  return r;
+}
+SSE double f64_max(double const* a, std::size_t n) {
+  if(n < 2) return scalar::f64_max(a, n);
+  __m128d m = _mm_loadu_pd(a);
+  std::size_t i = 2;
+  for(; i + 2 <= n; i += 2) m = _mm_max_pd(m, _mm_loadu_pd(a + i));
+  double l[2];
+  _mm_storeu_pd(l, m);
+  double r = l[0] > l[1] ? l[0] : l[1];
+  for(; i < n; ++i) r = r > a[i] ? r : a[i];
+  return r;
+}
+SSE void f64_add(double* out, double const* a, double const* b, std::size_t n) {
+  std::size_t i{};
+  for(; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  scalar::f64_add(out + i, a + i, b + i, n - i);
+}
+SSE void f64_scale(double* out, double const* a, double k, std::size_t n) {
+  __m128d const kk = _mm_set1_pd(k);
+  std::size_t i{};
+  for(; i + 2 <= n; i += 2) _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(a + i), kk));
+  scalar::f64_scale(out + i, a + i, k, n - i);
+}
+SSE void f64_select_less(double* out, double const* a, double const* b, double const* x, double const* y, std::size_t n) {
+  std::size_t i{};
+  for(; i + 2 <= n; i += 2) {
+    __m128d const mask = _mm_cmplt_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+    _mm_storeu_pd(out + i, _mm_blendv_pd(_mm_loadu_pd(y + i), _mm_loadu_pd(x + i), mask));
+  }
+  scalar::f64_select_less(out + i, a + i, b + i, x + i, y + i, n - i);
+}
+SSE std::int64_t i64_sum(std::int64_t const* a, std::size_t n) {
+  __m128i s = _mm_setzero_si128();
+  std::size_t i{};
+  for(; i + 2 <= n; i += 2) s = _mm_add_epi64(s, _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i)));
+  std::int64_t l[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(l), s);
+  return wrap_add(wrap_add(l[0], l[1]), scalar::i64_sum(a + i, n - i));
+}
+SSE std::int64_t i64_min(std::int64_t const* a, std::size_t n) {
+  if(n < 2) return scalar::i64_min(a, n);
+  __m128i m = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a));
+  std::size_t i = 2;
+  for(; i + 2 <= n; i += 2) {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i));
+    m = _mm_blendv_epi8(m, v, _mm_cmpgt_epi64(m, v));
+  }
+  std::int64_t l[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(l), m);
+  std::int64_t r = std::min(l[0], l[1]);
+  return i < n ? std::min(r, a[i]) : r;
+}
+SSE std::int64_t i64_max(std::int64_t const* a, std::size_t n) {
+  if(n < 2) return scalar::i64_max(a, n);
+  __m128i m = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a));
+  std::size_t i = 2;
+  for(; i + 2 <= n; i += 2) {
+    __m128i const v = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i));
+    m = _mm_blendv_epi8(m, v, _mm_cmpgt_epi64(v, m));
+  }
+  std::int64_t l[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(l), m);
+  std::int64_t r = std::max(l[0], l[1]);
+  return i < n ? std::max(r, a[i]) : r;
+}
+SSE void i64_add(std::int64_t* out, std::int64_t const* a, std::int64_t const* b, std::size_t n) {
+  std::size_t i{};
+  for(; i + 2 <= n; i += 2) {
+    __m128i const v = _mm_add_epi64(_mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+  }
+  scalar::i64_add(out + i, a + i, b + i, n - i);
+}
+SSE void i64_select_less(std::int64_t* out, std::int64_t const* a, std::int64_t const* b, std::int64_t const* x, std::int64_t const* y, std::size_t n) {
+  std::size_t i{};
+  for(; i + 2 <= n; i += 2) {
+    __m128i const mask = _mm_cmpgt_epi64(_mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i)));
+    __m128i const v = _mm_blendv_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(y + i)), _mm_loadu_si128(reinterpret_cast<__m128i const*>(x + i)), mask);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), v);
+  }
+  scalar::i64_select_less(out + i, a + i, b + i, x + i, y + i, n - i);
+}
+#undef SSE
+} // namespace sse
+
+// 4要素ずつ。lanesの8つは2本のregisterに分ける。
+namespace avx2 {
+#define AVX2 [[gnu::target("avx2")]]
+AVX2 double f64_sum(double const* a, std::size_t n) {
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  std::size_t i{};
+  for(; i + lanes <= n; i += lanes) {
+    s0 = _mm256_add_pd(s0, _mm256_loadu_pd(a + i));
+    s1 = _mm256_add_pd(s1, _mm256_loadu_pd(a + i + 4));
+  }
+  double l[lanes];
+  _mm256_storeu_pd(l, s0);
+  _mm256_storeu_pd(l + 4, s1);
+  return finish_sum(l, a + i, n - i);
+}
+AVX2 double f64_dot(double const* a, double const* b, std::size_t n) {
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  std::size_t i{};
+  for(; i + lanes <= n; i += lanes) { // FMAは丸めが変わるので使わない
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+  }
+  double l[lanes];
+  _mm256_storeu_pd(l, s0);
+  _mm256_storeu_pd(l + 4, s1);
+  return finish_dot(l, a + i, b + i, n - i);
+}
+AVX2 double f64_min(double const* a, std::size_t n) {
+  if(n < 4) return scalar::f64_min(a, n);
+  __m256d m = _mm256_loadu_pd(a);
+  std::size_t i = 4;
+  for(; i + 4 <= n; i += 4) m = _mm256_min_pd(m, _mm256_loadu_pd(a + i));
+  double l[4];
+  _mm256_storeu_pd(l, m);
+  double r = scalar::f64_min(l, 4);
+  for(; i < n; ++i) r = r < a[i] ? r : a[i];
+  return r;
+}
+AVX2 double f64_max(double const* a, std::size_t n) {
+  if(n < 4) return scalar::f64_max(a, n);
+  __m256d m = _mm256_loadu_pd(a);
+  std::size_t i = 4;
+  for(; i + 4 <= n; i += 4) m = _mm256_max_pd(m, _mm256_loadu_pd(a + i));
+  double l[4];
+  _mm256_storeu_pd(l, m);
+  double r = scalar::f64_max(l, 4);
+  for(; i < n; ++i) r = r > a[i] ? r : a[i];
+  return r;
+}
+AVX2 void f64_add(double* out, double const* a, double const* b, std::size_t n) {
+  std::size_t i{};
+  for(; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+  scalar::f64_add(out + i, a + i, b + i, n - i);
+}
+AVX2 void f64_scale(double* out, double const* a, double k, std::size_t n) {
+  __m256d const kk = _mm256_set1_pd(k);
+  std::size_t i{};
+  for(; i + 4 <= n; i += 4) _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i), kk));
+  scalar::f64_scale(out + i, a + i, k, n - i);
+}
+AVX2 void f64_select_less(double* out, double const* a, double const* b, double const* x, double const* y, std::size_t n) {
+  std::size_t i{};
+  for(; i + 4 <= n; i += 4) {
+    __m256d const mask = _mm256_cmp_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), _CMP_LT_OQ);
+    _mm256_storeu_pd(out + i, _mm256_blendv_pd(_mm256_loadu_pd(y + i), _mm256_loadu_pd(x + i), mask));
+  }
+  scalar::f64_select_less(out + i, a + i, b + i, x + i, y + i, n - i);
+}
+AVX2 __m256i load(std::int64_t const* p) {
+  return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+}
+AVX2 std::int64_t i64_sum(std::int64_t const* a, std::size_t n) {
+  __m256i s = _mm256_setzero_si256();
+  std::size_t i{};
+  for(; i + 4 <= n; i += 4) s = _mm256_add_epi64(s, load(a + i));
+  std::int64_t l[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(l), s);
+  return wrap_add(scalar::i64_sum(l, 4), scalar::i64_sum(a + i, n - i));
+}
+AVX2 std::int64_t i64_min(std::int64_t const* a, std::size_t n) {
+  if(n < 4) return scalar::i64_min(a, n);
+  __m256i m = load(a);
+  std::size_t i = 4;
+  for(; i + 4 <= n; i += 4) {
+    __m256i const v = load(a + i);
+    m = _mm256_blendv_epi8(m, v, _mm256_cmpgt_epi64(m, v));
+  }
+  std::int64_t l[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(l), m);
+  std::int64_t const r = scalar::i64_min(l, 4);
+  return i < n ? std::min(r, scalar::i64_min(a + i, n - i)) : r;
+}
+AVX2 std::int64_t i64_max(std::int64_t const* a, std::size_t n) {
+  if(n < 4) return scalar::i64_max(a, n);
+  __m256i m = load(a);
+  std::size_t i = 4;
+  for(; i + 4 <= n; i += 4) {
+    __m256i const v = load(a + i);
+    m = _mm256_blendv_epi8(m, v, _mm256_cmpgt_epi64(v, m));
+  }
+  std::int64_t l[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(l), m);
+  std::int64_t const r = scalar::i64_max(l, 4);
+  return i < n ? std::max(r, scalar::i64_max(a + i, n - i)) : r;
+}
+AVX2 void i64_add(std::int64_t* out, std::int64_t const* a, std::int64_t const* b, std::size_t n) {
+  std::size_t i{};
+  for(; i + 4 <= n; i += 4) _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi64(load(a + i), load(b + i)));
+  scalar::i64_add(out + i, a + i, b + i, n - i);
+}
+AVX2 void i64_select_less(std::int64_t* out, std::int64_t const* a, std::int64_t const* b, std::int64_t const* x, std::int64_t const* y, std::size_t n) {
+  std::size_t i{};
+  for(; i + 4 <= n; i += 4) {
+    __m256i const mask = _mm256_cmpgt_epi64(load(b + i), load(a + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_blendv_epi8(load(y + i), load(x + i), mask));
+  }
+  scalar::i64_select_less(out + i, a + i, b + i, x + i, y + i, n - i);
+}
+#undef AVX2
+} // namespace avx2
+
+constexpr Kernels sse_kernels{
+  sse::f64_sum, sse::f64_dot, sse::f64_min, sse::f64_max, sse::f64_add, sse::f64_scale, sse::f64_select_less,
+  sse::i64_sum, sse::i64_min, sse::i64_max, sse::i64_add, sse::i64_select_less,
+};
+constexpr Kernels avx2_kernels{
+  avx2::f64_sum, avx2::f64_dot, avx2::f64_min, avx2::f64_max, avx2::f64_add, avx2::f64_scale, avx2::f64_select_less,
+  avx2::i64_sum, avx2::i64_min, avx2::i64_max, avx2::i64_add, avx2::i64_select_less,
+};
+#endif
+
+SimdLevel supported_level() {
+#if LILITH_SIMD
+  if(__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+  if(__builtin_cpu_supports("sse4.2")) return SimdLevel::Sse;
+#endif
+  return SimdLevel::Scalar;
+}
+
+SimdLevel level = supported_level();
+Kernels const* kernels_for(SimdLevel l) {
+#if LILITH_SIMD
+  if(l == SimdLevel::Avx2) return &avx2_kernels;
+  if(l == SimdLevel::Sse) return &sse_kernels;
+#endif
+  return &scalar_kernels;
+}
+Kernels const* kernels = kernels_for(level);
+
+// 二項の演算の引数。型と長さがそろっていなければerror。
+TypedArray* same_shape(Value lhs, Value rhs) {
+  TypedArray* const a = to_array(lhs);
+  TypedArray* const b = to_array(rhs);
+  if(a->type != b->type) throw "array: element types differ";
+  if(a->length != b->length) throw "array: lengths differ";
+  return a;
+}
+
+template<ElementType type>
+Value list_to_array(Value l) {
+  std::size_t n{};
+  for(Value p = l; !is_atom_bool(p); p = cdr(p)) ++n;
+  TypedArray* const a = alloc_array(type, n);
+  std::size_t i{};
+  for(Value p = l; !is_atom_bool(p); p = cdr(p), ++i) {
+    Value const x = car(p);
+    if constexpr(type == ElementType::F64) {
+      f64(a)[i] = number(x);
+    } else {
+      if(!is_integer(x)) throw "list->i64array: not a fixnum";
+      i64(a)[i] = to_int(x);
+    }
+  }
+  return to_Value(a);
+}
+
+Value element(TypedArray* a, std::size_t i) {
+  return a->type == ElementType::F64 ? make_float(f64(a)[i]) : fixnum(i64(a)[i]);
+}
+
+Value primitive_list_to_f64array(Value const* args, std::size_t) { return list_to_array<ElementType::F64>(args[0]); }
+Value primitive_list_to_i64array(Value const* args, std::size_t) { return list_to_array<ElementType::I64>(args[0]); }
+Value primitive_array_to_list(Value const* args, std::size_t) {
+  TypedArray* const a = to_array(args[0]);
+  std::vector<Value> items(a->length);
+  for(std::size_t i{}; i < a->length; ++i) items[i] = element(a, i);
+  return make_list(items.data(), items.size());
+}
+Value primitive_array_p(Value const* args, std::size_t) { return from_bool(is_typed_array(args[0])); }
+Value primitive_array_length(Value const* args, std::size_t) { return ::to_Value(static_cast<std::int64_t>(to_array(args[0])->length)); }
+Value primitive_array_ref(Value const* args, std::size_t) {
+  TypedArray* const a = to_array(args[0]);
+  if(!is_integer(args[1]) || to_int(args[1]) < 0 || static_cast<std::uint64_t>(to_int(args[1])) >= a->length) throw "array-ref: index out of range";
+  return element(a, static_cast<std::size_t>(to_int(args[1])));
+}
+Value primitive_array_sum(Value const* args, std::size_t) {
+  TypedArray* const a = to_array(args[0]);
+  if(a->type == ElementType::F64) return make_float(kernels->f64_sum(f64(a), a->length));
+  return fixnum(kernels->i64_sum(i64(a), a->length));
+}
+Value primitive_array_dot(Value const* args, std::size_t) {
+  TypedArray* const a = same_shape(args[0], args[1]);
+  TypedArray* const b = to_array(args[1]);
+  if(a->type == ElementType::F64) return make_float(kernels->f64_dot(f64(a), f64(b), a->length));
+  std::int64_t s{}; // 64bitの掛け算はAVX2にもSSEにも無い
+  for(std::size_t i{}; i < a->length; ++i) s = wrap_add(s, wrap_mul(i64(a)[i], i64(b)[i]));
+  return fixnum(s);
+}
+Value primitive_array_min(Value const* args, std::size_t) {
+  TypedArray* const a = to_array(args[0]);
+  if(a->length == 0) throw "array-min: empty array";
+  if(a->type == ElementType::F64) return make_float(kernels->f64_min(f64(a), a->length));
+  return fixnum(kernels->i64_min(i64(a), a->length));
+}
+Value primitive_array_max(Value const* args, std::size_t) {
+  TypedArray* const a = to_array(args[0]);
+  if(a->length == 0) throw "array-max: empty array";
+  if(a->type == ElementType::F64) return make_float(kernels->f64_max(f64(a), a->length));
+  return fixnum(kernels->i64_max(i64(a), a->length));
+}
+Value primitive_array_add(Value const* args, std::size_t) {
+  TypedArray* const a = same_shape(args[0], args[1]);
+  TypedArray* const b = to_array(args[1]);
+  TypedArray* const out = alloc_array(a->type, a->length);
+  if(a->type == ElementType::F64) {
+    kernels->f64_add(f64(out), f64(a), f64(b), a->length);
+  } else {
+    kernels->i64_add(i64(out), i64(a), i64(b), a->length);
+  }
+  return to_Value(out);
+}
+Value primitive_array_scale(Value const* args, std::size_t) {
+  TypedArray* const a = to_array(args[0]);
+  TypedArray* const out = alloc_array(a->type, a->length);
+  if(a->type == ElementType::F64) {
+    kernels->f64_scale(f64(out), f64(a), number(args[1]), a->length);
+  } else {
+    if(!is_integer(args[1])) throw "array-scale: i64array needs a fixnum";
+    std::int64_t const k = to_int(args[1]);
+    for(std::size_t i{}; i < a->length; ++i) i64(out)[i] = wrap_mul(i64(a)[i], k);
+  }
+  return to_Value(out);
+}
+Value primitive_array_select_less(Value const* args, std::size_t) {
+  TypedArray* const a = same_shape(args[0], args[1]);
+  same_shape(args[0], args[2]);
+  same_shape(args[0], args[3]);
+  TypedArray* const b = to_array(args[1]);
+  TypedArray* const x = to_array(args[2]);
+  TypedArray* const y = to_array(args[3]);
+  TypedArray* const out = alloc_array(a->type, a->length);
+  if(a->type == ElementType::F64) {
+    kernels->f64_select_less(f64(out), f64(a), f64(b), f64(x), f64(y), a->length);
+  } else {
+    kernels->i64_select_less(i64(out), i64(a), i64(b), i64(x), i64(y), a->length);
+  }
+  return to_Value(out);
+}
+
+} // namespace
+
+bool is_typed_array(Value v) {
+  return is_object(v) && to_object(v)->kind == ObjectKind::TypedArray;
+}
+
+Value make_f64array(double const* items, std::size_t n) {
+  TypedArray* const a = alloc_array(ElementType::F64, n);
+  if(n != 0) std::memcpy(f64(a), items, n * sizeof(double));
+  return to_Value(a);
+}
+Value make_i64array(std::int64_t const* items, std::size_t n) {
+  TypedArray* const a = alloc_array(ElementType::I64, n);
+  if(n != 0) std::memcpy(i64(a), items, n * sizeof(std::int64_t));
+  return to_Value(a);
+}
+
+SimdLevel set_simd_level(SimdLevel l) {
+  level = std::min(l, supported_level());
+  kernels = kernels_for(level);
+  return level;
+}
+SimdLevel simd_level() {
+  return level;
+}
+char const* simd_level_name(SimdLevel l) {
+  switch(l) {
+  case SimdLevel::Avx2:
+    return "avx2";
+  case SimdLevel::Sse:
+    return "sse4.2";
+  case SimdLevel::Scalar:
+  default:
+    return "scalar";
+  }
+}
+
+Value define_typed_array_primitives(Value env) {
+  env = define_primitive("list->f64array", 1, primitive_list_to_f64array, env);
+  env = define_primitive("list->i64array", 1, primitive_list_to_i64array, env);
+  env = define_primitive("array->list", 1, primitive_array_to_list, env);
+  env = define_primitive("array?", 1, primitive_array_p, env);
+  env = define_primitive("array-length", 1, primitive_array_length, env);
+  env = define_primitive("array-ref", 2, primitive_array_ref, env);
+  env = define_primitive("array-sum", 1, primitive_array_sum, env);
+  env = define_primitive("array-dot", 2, primitive_array_dot, env);
+  env = define_primitive("array-min", 1, primitive_array_min, env);
+  env = define_primitive("array-max", 1, primitive_array_max, env);
+  env = define_primitive("array-add", 2, primitive_array_add, env);
+  env = define_primitive("array-scale", 2, primitive_array_scale, env);
+  env = define_primitive("array-select<", 4, primitive_array_select_less, env);
+  return env;
+}
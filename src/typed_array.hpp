@@ -0,0 +1,32 @@
+#pragma once
+
+#include "value.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// 同じ型の数を並べた配列(#<array>。要素はdoubleかint64)。consのページではなくobjectの中に、tagを付けずにそのまま置く。
+// 一度作ったら書き換えない(futureに渡しても同じものが見える)。演算は新しい配列を返す。
+//   (list->f64array l) (list->i64array l) (array->list a) (array? a) (array-length a) (array-ref a i)
+//   (array-sum a) (array-dot a b) (array-min a) (array-max a)
+//   (array-add a b) 要素ごとの和  (array-scale a k) 要素ごとにk倍
+//   (array-select< a b x y) 要素ごとに (if (< a b) x y)
+// 二項の演算は同じ型で同じ長さの配列どうし。i64は64bitの2の補数で、溢れたら折り返す(fixnumに戻す時に62bitに収まらなければerror)。
+// ループはAVX2かSSE4.2で書いたものを、起動した時にCPUを見て選ぶ(x86-64でなければscalarだけ)。
+// f64の和と内積は8つに分けて足してから同じ順でまとめるので、どれを選んでも結果のbitは同じ。
+
+bool is_typed_array(Value v);
+Value make_f64array(double const* items, std::size_t n);
+Value make_i64array(std::int64_t const* items, std::size_t n);
+
+enum class SimdLevel {
+  Scalar,
+  Sse, // SSE4.2
+  Avx2,
+};
+// CPUが対応していない物を頼まれたら、対応している一番上のものにする。選んだものを返す(benchで比べるため)。
+SimdLevel set_simd_level(SimdLevel level);
+SimdLevel simd_level();
+char const* simd_level_name(SimdLevel level);
+
+Value define_typed_array_primitives(Value env);
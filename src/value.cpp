@@ -1,43 +1,56 @@
 #include "value.hpp"
 #include "prelude.hpp"
 #include "allocator.hpp"
+#include "hashcons.hpp"
 
 // ポインタが4byteアライメントされてるということを以下仮定。
 // https://www.gnu.org/software/libc/manual/html_node/Aligned-Memory-Blocks.html
 // glibcだと8byte保証があるらしい。
 // 下2bitが
-//   00 ポインタ(この時cons cellである)
-//   01 数字(上位bitにsigned int(最上位が1なら負))
+//   00 ポインタ(この時cons cellである)。carのslotを指す。cdrの場所はcdr-codeで決まる(allocator.hpp)
+//   01 数字(2の補数の整数を2bit左にずらしたもの。足し引きは1bitも直さずにできる)
 //   10 Symbol(上位bitをアドレスだと思って指した先にnull terminated stringで名前が入っている)
-//   11 Symbol(short string opt) 上位7byteにnull terminated(7文字なら無し)で名前が入る。
+//   11 Symbol(short string opt) 上位7byteにnull terminated(7文字なら無し)で名前が入る。下位1byteは0b11だけ。
+//  110 double(指数が真ん中あたりのもの。value.hppのmake_float)。長いsymbolの文字列は8byte境界にあるので衝突しない。
+//  111 Object(ポインタ。先頭にObject headerを持つ。closureなど)
+//      consと同じく8byte alignmentなので、下3bitを使ってもshort symbolと衝突しない。
 
 // nil以外はtruety
 
 // envとは？
-//   ("env" . (assoc . parent))
+//   Frame { header, parent, defined, name0, value0, ... } か、トップレベルを表すnil
+//   トップレベルのdefineはprelude.cppのglobal tableに入る。
 
 // lambda
-//   (params body . env)
+//   Closure { header, params, body, env, name, arity } を連続領域に置く。
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cmath>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
 #include <cassert>
 #include <cstring>
 
 Value to_Value(void* v) {
   return reinterpret_cast<Value>(v);
 }
-Value to_Value(ConsCell* v, std::nullptr_t) {
+Value to_Value(Slot* v, std::nullptr_t) {
   return reinterpret_cast<Value>(v);
 }
-ConsCell* to_ptr(Value v) {
-  return reinterpret_cast<ConsCell*>(v);
+Value to_Value(Object* v, std::nullptr_t) {
+  return reinterpret_cast<Value>(v) | 0b111;
 }
-
-
-Value nil() {
-  return 0;
+Slot* to_ptr(Value v) {
+  return reinterpret_cast<Slot*>(v);
+}
+Object* to_object(Value v) {
+  return reinterpret_cast<Object*>(v & ~Value{0b111});
 }
 
+
 Value make_symbol(char const* name) {
   size_t len = std::strlen(name);
   if(len <= 7) { // short string opt
@@ -48,22 +61,98 @@ Value make_symbol(char const* name) {
     return res;
   }
 
+  // 長い名前はinternしておいて、同じ名前なら同じValueになるようにする。futureのthreadからも呼ばれる。
+  static std::unordered_map<std::string, Value> interned;
+  static std::mutex m;
+  std::lock_guard lk{m};
+  auto const it = interned.find(name);
+  if(it != end(interned)) return it->second;
+
   char* p = static_cast<char*>(alloc(len + 1));
   std::strcpy(p, name);
-  return to_Value(p) | 0b10;
+  Value const res = to_Value(p) | 0b10;
+  interned.emplace(name, res);
+  return res;
 }
 
 Value make_cons(Value car, Value cdr) {
+  if(hash_consing()) [[unlikely]] {
+    if(Value const* shared = find_hash_consed(car, cdr)) return *shared;
+  }
   auto const region = alloc_cons();
-  region->cell[0] = car;
-  region->cell[1] = cdr;
-  return to_Value(region);
+  region[0] = compress(car);
+  region[1] = compress(cdr);
+  Value const res = to_Value(region, nullptr);
+  set_cdr_code(res, CdrCode::Normal);
+  if(hash_consing()) [[unlikely]] register_hash_consed(res);
+  return res;
+}
+
+namespace {
+
+bool cdr_coding_enabled = true;
+
+// set_cdrでcdr-codeをSplitにしたcellのcdr。cellが死んだら消し、引越ししたら書き換える。
+std::unordered_map<Value, Value> split_cdrs;
+bool const split_cdrs_registered = (add_weak_roots([](WeakVisitor const& survive) {
+  std::unordered_map<Value, Value> live;
+  for(auto const& [key, value]: split_cdrs) {
+    Value cons = key;
+    Value cdr = value;
+    if(survive(cons) && survive(cdr)) live.emplace(cons, cdr); // consが生きていればcdrも生きている
+  }
+  split_cdrs = std::move(live);
+}), true);
+
+} // namespace
+
+void set_cdr_coding(bool enabled) {
+  cdr_coding_enabled = enabled;
+}
+bool cdr_coding() {
+  return cdr_coding_enabled;
+}
+
+Value make_list(Value const* items, std::size_t n, Value tail) {
+  if(!cdr_coding_enabled || hash_consing()) {
+    while(n > 0) tail = make_cons(items[--n], tail);
+    return tail;
+  }
+  Value head = tail;
+  Slot* link = nullptr; // 前のrunの最後のcdr。最初のrunならhead
+  while(n > 0) {
+    // ページに収まらなかったら、最後の要素をNormalにして次のrunへのcdrを持たせる。
+    std::size_t const need = n + (tail == nil() ? 0 : 1);
+    std::size_t got = need;
+    Slot* slots = alloc_run(got);
+    std::size_t const m = got == need && tail == nil() ? got : got - 1; // このrunに置く要素の数
+    for(std::size_t i{}; i < m; ++i) {
+      slots[i] = compress(*items++);
+      set_cdr_code(to_Value(slots + i, nullptr), CdrCode::Next);
+    }
+    if(link) {
+      *link = compress(to_Value(slots, nullptr));
+    } else {
+      head = to_Value(slots, nullptr);
+    }
+    n -= m;
+    if(got == m) {
+      set_cdr_code(to_Value(slots + m - 1, nullptr), CdrCode::Nil);
+    } else {
+      set_cdr_code(to_Value(slots + m - 1, nullptr), CdrCode::Normal);
+      slots[m] = compress(tail);
+      link = slots + m;
+    }
+  }
+  return head;
 }
 
 enum class ValueType {
   Cons,
   Integer,
   Symbol,
+  Float,
+  Object,
 };
 
 ValueType type(Value v) {
@@ -72,28 +161,57 @@ ValueType type(Value v) {
     return ValueType::Cons;
   case 1:
     return ValueType::Integer;
+  case 3:
+    if(v & 0b100) return to_object(v)->kind == ObjectKind::Flonum ? ValueType::Float : ValueType::Object;
+    return ValueType::Symbol;
   case 2:
   default:
+    if(v & 0b100) return ValueType::Float;
     return ValueType::Symbol;
   }
 }
 
 Value car(Value cons) {
-  if (type(cons) != ValueType::Cons) {
-    std::cout << "wrong cons!!!! " << cons << std::endl;
-  }
   assert(type(cons) == ValueType::Cons);
-  return to_ptr(cons)->cell[0];
+  return decompress(*to_ptr(cons));
 }
 Value cdr(Value cons) {
   assert(type(cons) == ValueType::Cons);
-  return to_ptr(cons)->cell[1];
+  switch(cdr_code(cons)) {
+  case CdrCode::Normal:
+    return decompress(to_ptr(cons)[1]);
+  case CdrCode::Next:
+    return to_Value(to_ptr(cons) + 1, nullptr);
+  case CdrCode::Nil:
+    return nil();
+  case CdrCode::Split:
+  default:
+    return split_cdrs.at(cons);
+  }
 }
 void set_car(Value cons, Value car) {
   assert(type(cons) == ValueType::Cons);
-  to_ptr(cons)->cell[0] = car;
+  if(is_canonical(cons)) throw "cannot modify a hash-consed cell";
+  *to_ptr(cons) = compress(car);
+}
+void set_cdr(Value cons, Value cdr) {
+  assert(type(cons) == ValueType::Cons);
+  if(is_canonical(cons)) throw "cannot modify a hash-consed cell";
+  switch(cdr_code(cons)) {
+  case CdrCode::Normal:
+    to_ptr(cons)[1] = compress(cdr);
+    return;
+  case CdrCode::Next:
+  case CdrCode::Nil:
+    if(cdr == ::cdr(cons)) return;
+    // 隣のslotは他から指されているかもしれないので、そのままにしてこのcellのcdrだけ表に移す。
+    set_cdr_code(cons, CdrCode::Split);
+    [[fallthrough]];
+  case CdrCode::Split:
+  default:
+    split_cdrs[cons] = cdr;
+  }
 }
-void set_cdr(Value cons, Value car);
 
 bool is_long_str(Value v) {
   assert(type(v) == ValueType::Symbol);
@@ -113,82 +231,176 @@ char const* c_str(Value v) {
   return p;
 }
 
-bool is_atom_bool(Value v) {
-  return type(v) != ValueType::Cons || v == nil();
-}
-
 Value atom(Value v) {
   return from_bool(is_atom_bool(v));
 }
 
-bool symbol_eq_bool(Value lhs, Value rhs) {
-  if(!is_long_str(lhs)) {
-    return lhs == rhs;
-  }
-  return std::strcmp(c_str(lhs), c_str(rhs)) == 0;
+Value eq(Value lhs, Value rhs) {
+  return from_bool(eq_bool(lhs, rhs));
 }
 
-bool eq_bool(Value lhs, Value rhs) {
-  auto const t = type(lhs);
-  if(t != type(rhs)) {
-    return nil();
+bool equal_bool(Value lhs, Value rhs) {
+  while(true) {
+    if(lhs == rhs) return true;
+    if(is_float(lhs) && is_float(rhs)) return std::bit_cast<std::uint64_t>(to_double(lhs)) == std::bit_cast<std::uint64_t>(to_double(rhs));
+    if(is_atom_bool(lhs) || is_atom_bool(rhs)) return eq_bool(lhs, rhs);
+    if(is_canonical(lhs) && is_canonical(rhs)) return false; // 同じ形ならhash-consで同じcellになっているはず
+    if(!equal_bool(car(lhs), car(rhs))) return false;
+    lhs = cdr(lhs);
+    rhs = cdr(rhs);
   }
-  switch(t) {
-  case ValueType::Cons:
-  case ValueType::Integer:
-    return lhs == rhs;
-  case ValueType::Symbol:
-  default:
-    return symbol_eq_bool(lhs, rhs);
+}
+Value equal(Value lhs, Value rhs) {
+  return from_bool(equal_bool(lhs, rhs));
+}
+
+Value lambda(Value names, Value body, Value env) {
+  auto const f = reinterpret_cast<Closure*>(alloc_object(sizeof(Closure)));
+  return init_closure(f, names, body, env);
+}
+
+Value init_closure(Closure* f, Value names, Value body, Value env) {
+  std::int64_t arity{};
+  for(Value p = names; p != nil(); p = cdr(p)) {
+    if(is_atom_bool(p)) { // `(lambda xs xs)`
+      arity = -1;
+      break;
+    }
+    ++arity;
   }
+  f->header = Object{ObjectKind::Closure, false, 5};
+  f->params = names;
+  f->body = body;
+  f->env = env;
+  f->name = nil();
+  f->source = body;
+  f->arity = arity;
+  f->calls = 0;
+  f->jit = nullptr;
+  f->opt_stamp = ~std::uint64_t{}; // まだ最適化していない
+  return to_Value(&f->header, nullptr);
 }
 
-Value eq(Value lhs, Value rhs) {
-  return from_bool(eq_bool(lhs, rhs));
+bool is_closure(Value v) {
+  return is_object(v) && to_object(v)->kind == ObjectKind::Closure;
+}
+Closure* to_closure(Value f) {
+  assert(is_closure(f));
+  return reinterpret_cast<Closure*>(to_object(f));
+}
+Value closure_params(Value f) {
+  return to_closure(f)->params;
+}
+Value closure_body(Value f) {
+  return to_closure(f)->body;
+}
+Value closure_env(Value f) {
+  return to_closure(f)->env;
+}
+std::int64_t closure_arity(Value f) {
+  return to_closure(f)->arity;
+}
+Value closure_name(Value f) {
+  return to_closure(f)->name;
+}
+void set_closure_name(Value f, Value name) {
+  to_closure(f)->name = name;
+}
+Value closure_source(Value f) {
+  return to_closure(f)->source;
+}
+void set_closure_body(Value f, Value body) {
+  to_closure(f)->body = body;
 }
 
-Value lambda(Value names, Value body, Value env) {
-  Value res = make_cons(names, make_cons(body, env));
-  return res | 3;
+Value make_primitive(char const* name, std::int64_t arity, PrimitiveFn fn) {
+  auto const f = reinterpret_cast<Primitive*>(alloc_object(sizeof(Primitive)));
+  f->header = Object{ObjectKind::Primitive, false, 0};
+  f->fn = fn;
+  f->arity = arity;
+  f->name = name;
+  return to_Value(&f->header, nullptr);
+}
+bool is_primitive(Value v) {
+  return is_object(v) && to_object(v)->kind == ObjectKind::Primitive;
+}
+Primitive* to_primitive(Value v) {
+  assert(is_primitive(v));
+  return reinterpret_cast<Primitive*>(to_object(v));
 }
 
-bool is_integer(Value v) {
-  return type(v) == ValueType::Integer;
+Value make_frame(Value parent, std::size_t size) {
+  auto const frame = reinterpret_cast<Frame*>(alloc_object(sizeof(Frame) + sizeof(Value) * 2 * size));
+  frame->header = Object{ObjectKind::Frame, false, static_cast<std::uint32_t>(2 + 2 * size)};
+  frame->parent = parent;
+  frame->defined = nil();
+  std::fill_n(frame_slots(frame), 2 * size, nil());
+  return to_Value(&frame->header, nullptr);
 }
-bool is_self_eval(Value v) {
-  return is_integer(v) || v == nil();
+bool is_frame(Value v) {
+  return is_object(v) && to_object(v)->kind == ObjectKind::Frame;
 }
-bool is_symbol(Value v) {
-  return type(v) == ValueType::Symbol;
+Frame* to_frame(Value env) {
+  assert(is_frame(env));
+  return reinterpret_cast<Frame*>(to_object(env));
 }
-bool is_variable(Value v) {
-  return is_symbol(v);
+Value* frame_slots(Frame* frame) {
+  return reinterpret_cast<Value*>(frame + 1);
+}
+std::size_t frame_size(Frame* frame) {
+  return (frame->header.fields - 2) / 2;
 }
 
-std::int64_t to_int(Value v) {
-  assert(type(v) == ValueType::Integer);
-  std::int64_t res = (v << 1) >> 3; // 最上位bitを落とした値
-  if(v & (1LL << 63)) { // 最上位が1
-    res *= -1;
-  }
-  return res;
+Value* object_fields(Object* obj) {
+  return reinterpret_cast<Value*>(obj + 1);
 }
 
-Value to_Value(std::int64_t v) {
-  Value res(static_cast<std::uint64_t>(v) << 2);
-  if(v < 0) {
-    res = Value(static_cast<std::uint64_t>(-v) << 2);
-    res |= 1LL << 63; // set sign
-  }
-  res |= 1; // set type
-  return res;
+namespace {
+std::atomic<std::uint64_t> box_float_count{}; // futureやpmapのthreadのmake_floatからも増える
+} // namespace
+
+Value box_float(double d) {
+  box_float_count.fetch_add(1, std::memory_order_relaxed);
+  auto const f = reinterpret_cast<Flonum*>(alloc_object(sizeof(Flonum)));
+  f->header = Object{ObjectKind::Flonum, false, 0};
+  f->value = d;
+  return to_Value(&f->header, nullptr);
+}
+std::uint64_t boxed_floats() {
+  return box_float_count.load(std::memory_order_relaxed);
+}
+
+namespace {
+
+double number_arg(Value v) {
+  if(is_integer(v)) return static_cast<double>(to_int(v));
+  if(!is_float(v)) throw "not a number";
+  return to_double(v);
 }
 
-Value succ(Value v) {
-  return to_Value(to_int(v) + 1);
+// 読み直すと同じdoubleになる一番短い形。整数になる値にも `.0` を付けてfixnumと区別する。
+std::string show_float(double d) {
+  char buf[32];
+  auto const [end, ec] = std::to_chars(buf, buf + sizeof(buf), d);
+  std::string res(buf, end);
+  if(std::isfinite(d) && res.find_first_of(".e") == std::string::npos) res += ".0";
+  return res;
 }
-Value pred(Value v) {
-  return to_Value(to_int(v) - 1);
+
+} // namespace
+
+Value fl_add(Value lhs, Value rhs) { return make_float(number_arg(lhs) + number_arg(rhs)); }
+Value fl_sub(Value lhs, Value rhs) { return make_float(number_arg(lhs) - number_arg(rhs)); }
+Value fl_mul(Value lhs, Value rhs) { return make_float(number_arg(lhs) * number_arg(rhs)); }
+Value fl_div(Value lhs, Value rhs) { return make_float(number_arg(lhs) / number_arg(rhs)); }
+Value fl_less(Value lhs, Value rhs) { return from_bool(number_arg(lhs) < number_arg(rhs)); }
+Value fl_equal(Value lhs, Value rhs) { return from_bool(number_arg(lhs) == number_arg(rhs)); }
+Value flonum_p(Value v) { return from_bool(is_float(v)); }
+Value to_flonum(Value v) { return make_float(number_arg(v)); }
+Value to_fixnum(Value v) {
+  double const d = std::trunc(number_arg(v));
+  if(!(std::abs(d) < 0x1p61)) throw "fixnum overflow"; // nanもここ
+  return to_Value(static_cast<std::int64_t>(d));
 }
 
 std::string show(Value v, Value ignore) {
@@ -202,12 +414,6 @@ std::string show(Value v, Value ignore) {
     if(v == nil()) {
       return "()";
     }
-    if(to_bool(eq(car(v), make_symbol("env")))) {
-      return show_env(v);
-    }
-    if(to_bool(eq(car(v), make_symbol("proced")))) {
-      return "#<lambda>";
-    }
     ss << '(' << show(car(v), ignore);
     while(type(cdr(v)) == ValueType::Cons) {
       if(cdr(v) == nil()) { break; }
@@ -225,6 +431,20 @@ std::string show(Value v, Value ignore) {
   case ValueType::Integer:
     ss << to_int(v);
     return ss.str();
+  case ValueType::Float:
+    return show_float(to_double(v));
+  case ValueType::Object:
+    if(is_frame(v)) return show_env(v);
+    if(is_primitive(v)) return std::string("#<prim ") + to_primitive(v)->name + ">";
+    if(to_object(v)->kind == ObjectKind::Future) return "#<future>";
+    if(to_object(v)->kind == ObjectKind::Promise) return "#<promise>";
+    if(to_object(v)->kind == ObjectKind::Generator) return "#<generator>";
+    if(to_object(v)->kind == ObjectKind::Escape) return "#<escape>";
+    if(to_object(v)->kind == ObjectKind::Macro) return "#<macro>";
+    if(to_object(v)->kind == ObjectKind::Expansion) return "#<expansion>";
+    if(to_object(v)->kind == ObjectKind::Memo) return "#<memo>";
+    if(to_object(v)->kind == ObjectKind::TypedArray) return "#<array>";
+    return "#<lambda>";
   case ValueType::Symbol:
   default:
     return c_str(v);
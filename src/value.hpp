@@ -1,41 +1,182 @@
 #pragma once
 
+#include <bit>
 #include <string>
 #include <tuple>
+#include <cstddef>
 #include <cstdint>
 
 using Value = std::uintptr_t;
-struct ConsCell { Value cell[2]; };
+// consのslotに入っている形。LILITH_COMPRESSED_REFSでbuildすると32bitに縮める(allocator.hpp)。
+#ifdef LILITH_COMPRESSED_REFS
+using Slot = std::uint32_t;
+#else
+using Slot = Value;
+#endif
 
-Value nil();
+// cons以外のヒープオブジェクト(下3bitが111)。consのページとは別に確保する。
+enum class ObjectKind : std::uint8_t {
+  Closure,
+  Frame,
+  Primitive,
+  Flonum,
+  Future, // future.cpp
+  Promise, // lazy.cpp
+  Generator, // lazy.cpp
+  Escape, // escape.cpp
+  Macro, // macro.cpp
+  Expansion, // macro.cpp
+  Memo, // memo.cpp
+  TypedArray, // typed_array.cpp
+};
+struct Object {
+  ObjectKind kind;
+  bool marked;
+  std::uint32_t fields; // headerの直後に並んでいるValueの数。GCはここだけを辿る。
+};
+struct JitCode; // jit.cpp
+struct Closure {
+  Object header;
+  Value params;
+  Value body;
+  Value env;
+  Value name; // defineされた時の名前。無名ならnil
+  Value source; // 最適化する前の本体。bodyはここから作り直す
+  std::int64_t arity; // `(lambda xs xs)` なら-1
+  std::uint32_t calls; // JITするかどうかを決めるための呼び出し回数
+  JitCode* jit; // JITしたnative code。まだ/できなければnullptr
+  std::uint64_t opt_stamp; // bodyを最適化した時のoptimizer_stamp()
+};
+// C++で書かれた関数。argsはn個の引数の並び(listではない)。
+using PrimitiveFn = Value (*)(Value const* args, std::size_t n);
+struct Primitive {
+  Object header;
+  PrimitiveFn fn;
+  std::int64_t arity; // 可変長なら-1。それ以外ならfnを呼ぶ前に引数の数を確かめる。
+  char const* name; // 静的な文字列
+};
+// 下3bitのtagに収まらないdouble(make_float)。
+struct Flonum {
+  Object header;
+  double value;
+};
+// 関数呼び出し1回分の環境。仮引数の数だけ (name, value) の組を連続領域に並べる。
+struct Frame {
+  Object header;
+  Value parent; // nilならその先はトップレベル(global table)
+  Value defined; // 本体の中でdefineされた (name . value) の連想リスト
+  // この後ろに name0, value0, name1, value1, ... が続く
+};
+
+// 値の種類は下位bitだけで決まるので、判定はheaderに置いてinlineにする(表はvalue.cppの先頭)。
+constexpr Value nil() { return 0; }
+constexpr bool is_atom_bool(Value v) { return (v & 3) != 0 || v == nil(); }
+constexpr bool is_integer(Value v) { return (v & 3) == 1; }
+constexpr bool is_object(Value v) { return (v & 7) == 7; }
+constexpr bool is_symbol(Value v) { return (v & 7) == 2 || (v & 7) == 3; }
+constexpr bool is_small_float(Value v) { return (v & 7) == 6; }
+// tagに収まったdoubleとFlonumのどちらも(make_float)
+inline bool is_float(Value v) {
+  return is_small_float(v) || (is_object(v) && reinterpret_cast<Object const*>(v & ~Value{0b111})->kind == ObjectKind::Flonum);
+}
+inline bool is_self_eval(Value v) { return is_integer(v) || v == nil() || is_float(v); }
+constexpr bool is_variable(Value v) { return is_symbol(v); }
+// 数字もsymbolもconsも同じなら同じbit列(長い名前もinternしてある)。
+constexpr bool eq_bool(Value lhs, Value rhs) { return lhs == rhs; }
+
+// fixnumは2の補数の整数を2bit左にずらして下2bitを01にしたもの(62bit)。
+constexpr std::int64_t to_int(Value v) { return static_cast<std::int64_t>(v) >> 2; }
+constexpr Value to_Value(std::int64_t v) { return static_cast<Value>(v) << 2 | 1; }
+// tagを付けたまま4を足し引きする。62bitに収まらなければchar const*を投げる。
+inline Value succ(Value v) {
+  std::int64_t res;
+  if(__builtin_add_overflow(static_cast<std::int64_t>(v), std::int64_t{4}, &res)) [[unlikely]] throw "fixnum overflow";
+  return static_cast<Value>(res);
+}
+inline Value pred(Value v) {
+  std::int64_t res;
+  if(__builtin_sub_overflow(static_cast<std::int64_t>(v), std::int64_t{4}, &res)) [[unlikely]] throw "fixnum overflow";
+  return static_cast<Value>(res);
+}
 
 Value make_cons(Value car, Value cdr);
 Value car(Value cons);
 Value cdr(Value cons);
 Value atom(Value v);
 Value eq(Value lhs, Value rhs);
+Value equal(Value lhs, Value rhs); // 形が同じならt
 void set_car(Value cons, Value car);
-void set_cdr(Value cons, Value car);
+void set_cdr(Value cons, Value cdr); // cdr-codedなlistの途中なら、そのcellだけcdrを別に持つ(runが分かれる)
+// items[0]からitems[n-1]を並べて最後のcdrをtailにしたlist。
+// cdr-codingが有効なら、要素を連続したslotに置いてcdrを持たない(1要素8byte)。
+Value make_list(Value const* items, std::size_t n, Value tail = nil());
+void set_cdr_coding(bool enabled);
+bool cdr_coding();
 
 Value lambda(Value names, Value body, Value env);
+Value init_closure(Closure* f, Value names, Value body, Value env); // 確保済みの場所にlambdaを作る
+bool is_closure(Value v);
+Value closure_params(Value f);
+Value closure_body(Value f);
+Value closure_env(Value f);
+std::int64_t closure_arity(Value f);
+Value closure_name(Value f);
+void set_closure_name(Value f, Value name);
+Value closure_source(Value f);
+void set_closure_body(Value f, Value body);
+
+Value make_primitive(char const* name, std::int64_t arity, PrimitiveFn fn);
+bool is_primitive(Value v);
+Primitive* to_primitive(Value v);
 
-Value to_Value(ConsCell*, std::nullptr_t); // 第二引数は `to_Value(0)` でポインタバージョンが曖昧にならないように不要な引数を渡すようにする。
-Value to_Value(std::int64_t);
+Value make_frame(Value parent, std::size_t size); // slotのnameとvalueはnilで埋まっている
+bool is_frame(Value v);
+Frame* to_frame(Value env);
+Value* frame_slots(Frame* frame);
+std::size_t frame_size(Frame* frame);
+
+Value to_Value(Slot*, std::nullptr_t); // 第二引数は `to_Value(0)` でポインタバージョンが曖昧にならないように不要な引数を渡すようにする。
+Value to_Value(Object*, std::nullptr_t);
 inline Value operator""_i(unsigned long long v) { return to_Value(v); }
-Value succ(Value);
-Value pred(Value);
 std::string show(Value v, Value ignore = nil());
 
+// doubleは、指数にfloat_exponent_biasを足してから4bit左に回して、指数の上位3bitが下3bitに来るようにする。
+// それが110(長いsymbolはポインタが8byte境界なので010しか使わない)なら、そのままValueにする。
+// 絶対値が2^-127以上2^129未満の数はこれに収まる。0.0と-0.0は±2^-127の所(float_zero、bit3が符号)に置く。
+// それ以外(inf、nanも)はFlonumを確保する。
+constexpr std::uint64_t float_exponent_bias = std::uint64_t{640} << 52;
+constexpr Value float_zero = 6;
+Value box_float(double d);
+std::uint64_t boxed_floats(); // 起動してからbox_floatした数
+inline Value make_float(double d) {
+  auto const bits = std::bit_cast<std::uint64_t>(d);
+  Value const v = std::rotl(bits + float_exponent_bias, 4);
+  if(is_small_float(v) && (v & ~Value{8}) != float_zero) return v;
+  if((bits << 1) == 0) return float_zero | bits >> 60;
+  return box_float(d);
+}
+inline double to_double(Value v) {
+  if((v & ~Value{8}) == float_zero) return std::bit_cast<double>((v & 8) << 60);
+  if(is_small_float(v)) return std::bit_cast<double>(std::rotr(v, 4) - float_exponent_bias);
+  return reinterpret_cast<Flonum const*>(v & ~Value{0b111})->value;
+}
+// fl+などの中身。引数はfixnumでもよい(doubleにしてから計算する)。数でなければchar const*を投げる。
+Value fl_add(Value lhs, Value rhs);
+Value fl_sub(Value lhs, Value rhs);
+Value fl_mul(Value lhs, Value rhs);
+Value fl_div(Value lhs, Value rhs);
+Value fl_less(Value lhs, Value rhs);
+Value fl_equal(Value lhs, Value rhs);
+Value flonum_p(Value v);
+Value to_flonum(Value v); // fixnum->flonum
+Value to_fixnum(Value v); // flonum->fixnum。0の方向に切り捨てる
+
 // for impl prelude(あとで隠す)
 Value make_symbol(char const* name);
-bool eq_bool(Value lhs, Value rhs);
-bool is_integer(Value v);
-bool is_self_eval(Value v);
-bool is_symbol(Value v);
-bool is_variable(Value v);
-bool is_atom_bool(Value v);
+bool equal_bool(Value lhs, Value rhs);
 char const* c_str(Value v); // only for debug!!!
-std::int64_t to_int(Value v);
 
 // for impl allocator
-ConsCell* to_ptr(Value v);
+Slot* to_ptr(Value v); // consのcarのslot
+Object* to_object(Value v);
+Value* object_fields(Object* obj);